@@ -11,16 +11,16 @@ namespace generated
 {
     
     template<class T>
-    concept Timer = requires(T t) {
-        { t.StartOrReset(double timerDelaySeconds) };
+    concept Timer = requires(T t, double timerDelaySeconds) {
+        { t.StartOrReset(timerDelaySeconds) };
         { t.Stop() };
     };
     
     template<Timer T>
-    using TimerFiredCallback = void(*)(const T* timer);
+    using TimerFiredCallback = std::function<void(T* timer)>;
     
     template<Timer T>
-    using TimerFactory = T*(*)(const char* timerName, TimerFiredCallback<T> callback);
+    using TimerFactory = std::function<T*(const char* timerName, TimerFiredCallback<T> callback)>;
     
     
     template <Timer T>
@@ -66,6 +66,11 @@ namespace generated
             m_currentState = State::Start;
         }
         
+        void Reset()
+        {
+            m_currentState = State::Start;
+        }
+        
         void ProcessEvent__authorized(string username, ulong userId, string firstName, string secondName, string middleName)
         {
             switch (m_currentState)
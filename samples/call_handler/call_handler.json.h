@@ -11,16 +11,16 @@ namespace generated
 {
     
     template<class T>
-    concept Timer = requires(T t) {
-        { t.StartOrReset(double timerDelaySeconds) };
+    concept Timer = requires(T t, double timerDelaySeconds) {
+        { t.StartOrReset(timerDelaySeconds) };
         { t.Stop() };
     };
     
     template<Timer T>
-    using TimerFiredCallback = void(*)(const T* timer);
+    using TimerFiredCallback = std::function<void(T* timer)>;
     
     template<Timer T>
-    using TimerFactory = T*(*)(const char* timerName, TimerFiredCallback<T> callback);
+    using TimerFactory = std::function<T*(const char* timerName, TimerFiredCallback<T> callback)>;
     
     
     template <Timer T>
@@ -75,6 +75,12 @@ namespace generated
             m_currentState = State::in_call;
         }
         
+        void Reset()
+        {
+            asr_timeout->Stop();
+            m_currentState = State::in_call;
+        }
+        
         void ProcessEvent__telephony_session_terminated()
         {
             switch (m_currentState)
@@ -204,7 +210,8 @@ namespace generated
             case State::early_termination:
                 m_currentState = State::early_termination;
                 if (OnStateEnter__early_termination) { OnStateEnter__early_termination(); }
-                SetState(State::termination);
+                m_currentState = State::termination;
+                if (OnStateEnter__termination) { OnStateEnter__termination(); }
                 break;
                 
             case State::termination:
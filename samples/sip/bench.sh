@@ -0,0 +1,34 @@
+#!/bin/sh
+# Runs cpp_bench of client__invite__udp.json generated with each of the given settings, one after another.
+# Every argument is a comma separated list of generator arguments, by default switch and table dispatch are compared:
+#   ./bench.sh
+#   ./bench.sh "" "--cpp:CompactLayout=true"
+#   ./bench.sh "--cpp:BatchProcessing=true" "--cpp:BatchProcessing=true,--cpp:CallbackMode=handler"
+# NSMG may be set to a built generator, CXX to the compiler (c++ by default), BENCH_ARGS to [steps] [instances] [seed] [large instances]
+set -e
+cd "$(dirname "$0")"
+NSMG=${NSMG:-"dotnet run -c Release --project ../../src/NiceStateMachineGenerator.App --"}
+CXX=${CXX:-c++}
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+if [ $# -eq 0 ]; then
+    set -- "--cpp:DispatchMode=switch" "--cpp:DispatchMode=table"
+fi
+
+# packets of the sample are passed by the user's type, which is not needed to measure dispatch
+echo "typedef int t_packet;" > "$OUT/prelude.h"
+
+n=0
+for settings in "$@"; do
+    n=$((n + 1))
+    args=$(echo "$settings" | tr ',' ' ')
+    # class is named after the output file
+    mkdir "$OUT/$n"
+    $NSMG client__invite__udp.json -m cpp -o "$OUT/$n/client__invite__udp.json.h" $args > /dev/null
+    $NSMG client__invite__udp.json -m cpp_bench -o "$OUT/$n/client__invite__udp.json.bench.cpp" $args > /dev/null
+    $CXX -std=c++20 -O2 -include "$OUT/prelude.h" -DNICE_STATE_MACHINE_BENCH_HEADER="\"$OUT/$n/client__invite__udp.json.h\"" \
+        "$OUT/$n/client__invite__udp.json.bench.cpp" -o "$OUT/$n/bench"
+    echo "== ${settings:-default settings}"
+    "$OUT/$n/bench" $BENCH_ARGS
+done
@@ -13,16 +13,16 @@ namespace sip::generated
 {
     
     template<class T>
-    concept Timer = requires(T t) {
-        { t.StartOrReset(double timerDelaySeconds) };
+    concept Timer = requires(T t, double timerDelaySeconds) {
+        { t.StartOrReset(timerDelaySeconds) };
         { t.Stop() };
     };
     
     template<Timer T>
-    using TimerFiredCallback = void(*)(const T* timer);
+    using TimerFiredCallback = std::function<void(T* timer)>;
     
     template<Timer T>
-    using TimerFactory = T*(*)(const char* timerName, TimerFiredCallback<T> callback);
+    using TimerFactory = std::function<T*(const char* timerName, TimerFiredCallback<T> callback)>;
     
     
     template <Timer T>
@@ -96,6 +96,15 @@ namespace sip::generated
             if (OnStateEnter__Calling_Start) { OnStateEnter__Calling_Start(); }
         }
         
+        void Reset()
+        {
+            Timer_A->Stop();
+            Timer_A2->Stop();
+            Timer_B->Stop();
+            Timer_D->Stop();
+            m_currentState = State::Calling_Start;
+        }
+        
         void ProcessEvent__SIP_1xx(t_packet packet)
         {
             switch (m_currentState)
@@ -13,16 +13,16 @@ namespace sip::generated
 {
     
     template<class T>
-    concept Timer = requires(T t) {
-        { t.StartOrReset(double timerDelaySeconds) };
+    concept Timer = requires(T t, double timerDelaySeconds) {
+        { t.StartOrReset(timerDelaySeconds) };
         { t.Stop() };
     };
     
     template<Timer T>
-    using TimerFiredCallback = void(*)(const T* timer);
+    using TimerFiredCallback = std::function<void(T* timer)>;
     
     template<Timer T>
-    using TimerFactory = T*(*)(const char* timerName, TimerFiredCallback<T> callback);
+    using TimerFactory = std::function<T*(const char* timerName, TimerFiredCallback<T> callback)>;
     
     
     template <Timer T>
@@ -96,6 +96,16 @@ namespace sip::generated
             if (OnStateEnter__Trying_Start) { OnStateEnter__Trying_Start(); }
         }
         
+        void Reset()
+        {
+            Timer_F->Stop();
+            Timer_E->Stop();
+            Timer_E2->Stop();
+            Timer_K->Stop();
+            m_Timer_E_delay = 0.5;
+            m_currentState = State::Trying_Start;
+        }
+        
         void ProcessEvent__SIP_1xx(t_packet packet)
         {
             switch (m_currentState)
@@ -277,12 +287,11 @@ namespace sip::generated
                 break;
                 
             case State::Completed:
-                m_currentState = State::Completed;
+                m_currentState = State::Completed_Consume;
                 Timer_E->Stop();
                 Timer_E2->Stop();
                 Timer_F->Stop();
                 Timer_K->StartOrReset(5);
-                SetState(State::Completed_Consume);
                 break;
                 
             case State::Completed_Consume:
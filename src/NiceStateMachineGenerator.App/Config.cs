@@ -14,6 +14,11 @@ namespace NiceStateMachineGenerator.App
         public string? out_common { get; set; } = null;
         public Mode mode { get; set; } = Mode.validate;
         public bool daemon { get; set; } = false;
+        public int validation_threads { get; set; } = 0; //0 means all available cores for a single state machine, and one per state machine otherwise
+        public string? cache { get; set; } = null;
+        public bool depfile { get; set; } = false;
+        public string? trace_dump { get; set; } = null; //input of 'trace' and 'trace_dot' modes
+        public string? trace_instance { get; set; } = null; //decode records of a single machine only, hex with 0x prefix or decimal
         public bool run_dot { get; set; } = false;
         public bool run_d2 { get; set; } = false;
         public int d2_theme { get; set; } = 8; //see https://d2lang.com/tour/themes
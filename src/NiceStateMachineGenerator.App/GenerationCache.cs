@@ -0,0 +1,103 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Reflection;
+using System.Security.Cryptography;
+using System.Text;
+using System.Text.Json;
+using System.Threading.Tasks;
+
+namespace NiceStateMachineGenerator.App
+{
+    //Remembers state machines generated by previous runs, so that unchanged ones are skipped.
+    //State machine is considered unchanged if hash of its file, effective configuration and generator build is the same,
+    //and all the files written for it are still there.
+    internal sealed class GenerationCache
+    {
+        public sealed class Entry
+        {
+            public string Hash { get; set; } = "";
+            public List<string> OutputFiles { get; set; } = new List<string>();
+        }
+
+        private readonly string m_fileName;
+        private readonly byte[] m_generationContext;
+        private readonly ConcurrentDictionary<string, Entry> m_entries;
+
+        private GenerationCache(string fileName, byte[] generationContext, IDictionary<string, Entry> entries)
+        {
+            this.m_fileName = fileName;
+            this.m_generationContext = generationContext;
+            this.m_entries = new ConcurrentDictionary<string, Entry>(entries);
+        }
+
+        public static GenerationCache Load(string fileName, Config config)
+        {
+            Dictionary<string, Entry>? entries = null;
+            if (File.Exists(fileName))
+            {
+                try
+                {
+                    entries = JsonSerializer.Deserialize<Dictionary<string, Entry>>(File.ReadAllText(fileName));
+                }
+                catch (JsonException e)
+                {
+                    Console.WriteLine($"Cache file {fileName} is malformed and will be rewritten: {e.Message}");
+                }
+            };
+            return new GenerationCache(fileName, ComposeGenerationContext(config), entries ?? new Dictionary<string, Entry>());
+        }
+
+        private static byte[] ComposeGenerationContext(Config config)
+        {
+            //assembly version is not bumped on every change, but module id is
+            Assembly generator = typeof(StateMachineDescr).Assembly;
+            string context = $"{generator.GetName().Version} {generator.ManifestModule.ModuleVersionId}\n{JsonSerializer.Serialize(config)}\n";
+            return Encoding.UTF8.GetBytes(context);
+        }
+
+        public string ComputeHash(string sourceFile)
+        {
+            byte[] source = File.ReadAllBytes(sourceFile);
+            using (SHA256 sha = SHA256.Create())
+            {
+                sha.TransformBlock(this.m_generationContext, 0, this.m_generationContext.Length, null, 0);
+                sha.TransformFinalBlock(source, 0, source.Length);
+                return Convert.ToHexString(sha.Hash!);
+            }
+        }
+
+        public bool IsUpToDate(string sourceFile, string hash)
+        {
+            return this.m_entries.TryGetValue(GetKey(sourceFile), out Entry? entry)
+                && entry.Hash == hash
+                && entry.OutputFiles.All(File.Exists);
+        }
+
+        public void Update(string sourceFile, string hash, List<string> outputFiles)
+        {
+            this.m_entries[GetKey(sourceFile)] = new Entry {
+                Hash = hash,
+                OutputFiles = outputFiles.Select(Path.GetFullPath).ToList()
+            };
+        }
+
+        public void Remove(string sourceFile)
+        {
+            this.m_entries.TryRemove(GetKey(sourceFile), out _);
+        }
+
+        public void Save()
+        {
+            SortedDictionary<string, Entry> entries = new SortedDictionary<string, Entry>(this.m_entries, StringComparer.Ordinal);
+            File.WriteAllText(this.m_fileName, JsonSerializer.Serialize(entries, new JsonSerializerOptions { WriteIndented = true }));
+        }
+
+        private static string GetKey(string sourceFile)
+        {
+            return Path.GetFullPath(sourceFile);
+        }
+    }
+}
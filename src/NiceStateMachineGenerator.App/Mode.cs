@@ -14,7 +14,12 @@ namespace NiceStateMachineGenerator.App
         d2,
 
         validate, //just validate
-        all
+        all,
+
+        trace, //decode C++ trace dump to text
+        trace_dot, //decode C++ trace dump to Graphwiz overlay
+
+        cpp_bench, //C++ benchmark of the code generated in cpp mode
     }
 
     public static class ModeExtensions
@@ -31,6 +36,12 @@ namespace NiceStateMachineGenerator.App
                 return ".h";
             case Mode.d2:
                 return ".d2";
+            case Mode.trace:
+                return ".txt";
+            case Mode.trace_dot:
+                return ".dot";
+            case Mode.cpp_bench:
+                return ".bench.cpp";
 
             case Mode.all:
             case Mode.validate:
@@ -1,11 +1,14 @@
 ﻿using Microsoft.Extensions.Configuration;
 using System;
+using System.Collections.Concurrent;
 using System.Collections.Generic;
 using System.Diagnostics;
+using System.Globalization;
 using System.IO;
 using System.Linq;
 using System.Reflection;
 using System.Threading;
+using System.Threading.Tasks;
 
 namespace NiceStateMachineGenerator.App
 {
@@ -15,22 +18,28 @@ namespace NiceStateMachineGenerator.App
         {
             try
             {
-                if (args.Length == 0)
+                //everything before the first option is state machine files
+                string[] sources = args.TakeWhile(arg => !arg.StartsWith('-')).ToArray();
+                if (sources.Length == 0)
                 {
                     WriteUsage();
                     Environment.Exit(1);
                 };
 
-                string sourceFile = args[0];
-                Config config = GetConfig(args.Skip(1).ToArray());
+                Config config = GetConfig(args.Skip(sources.Length).ToArray());
+                List<string> sourceFiles = ResolveSourceFiles(sources);
 
                 if (config.daemon)
                 {
-                    RunInDaemonMode(sourceFile, config);
+                    if (sourceFiles.Count != 1)
+                    {
+                        throw new ApplicationException("Daemon mode supports only a single state machine file");
+                    };
+                    RunInDaemonMode(sourceFiles[0], config);
                 }
                 else
                 {
-                    bool succeed = TryGenerateStateMachine(sourceFile, config);
+                    bool succeed = TryGenerateStateMachines(sourceFiles, config);
                     if (!succeed)
                     {
                         Environment.Exit(2);
@@ -47,7 +56,7 @@ namespace NiceStateMachineGenerator.App
         private static void RunInDaemonMode(string sourceFile, Config config)
         {
             // Generate at startup before starting to watch for changes
-            TryGenerateStateMachine(sourceFile, config);
+            TryGenerateStateMachine(sourceFile, config, null, GetValidationThreads(config, 1), Console.Out);
 
             string sourceDirectory = Path.GetDirectoryName(sourceFile)!;
             string sourceFilename = Path.GetFileName(sourceFile);
@@ -78,20 +87,20 @@ namespace NiceStateMachineGenerator.App
                         Thread.Sleep(100); // We need to wait for some time because this event triggers faster than filesystem write completes
                         Console.WriteLine("");
                         Console.WriteLine($"File {eventArgs.Name} changed at {fireTime}. Generating state machine");
-                        bool succeed = TryGenerateStateMachine(sourceFile, config);
+                        bool succeed = TryGenerateStateMachine(sourceFile, config, null, GetValidationThreads(config, 1), Console.Out);
                         if (succeed)
                         {
                             try
                             {
                                 if (config.run_dot)
                                 {
-                                    RunGraphwiz($"{eventArgs.FullPath}.dot");
+                                    RunGraphwiz($"{eventArgs.FullPath}.dot", Console.Out);
                                     Console.WriteLine("Graphwiz render complete");
                                 }
 
                                 if (config.run_d2)
                                 {
-                                    RunD2($"{eventArgs.FullPath}.d2", config);
+                                    RunD2($"{eventArgs.FullPath}.d2", config, Console.Out);
                                     Console.WriteLine("D2 render complete");
                                 }
                             }
@@ -110,41 +119,182 @@ namespace NiceStateMachineGenerator.App
             }
         }
 
-        private static bool TryGenerateStateMachine(string sourceFile, Config config)
+        //Each source is either a file name, a file name pattern, or '@<manifest file>'.
+        //Patterns may have wildcards in the file name and a '**' directory right before it to look into all subdirectories.
+        //Manifest is a text file listing sources one per line, relative to the manifest location. Empty lines and lines starting with '#' are skipped.
+        private static List<string> ResolveSourceFiles(IEnumerable<string> sources)
+        {
+            List<string> result = new List<string>();
+            foreach (string source in sources)
+            {
+                AddSourceFiles(source, "", result);
+            }
+            return result
+                .DistinctBy(file => Path.GetFullPath(file))
+                .ToList();
+        }
+
+        private static void AddSourceFiles(string source, string baseDirectory, List<string> result)
+        {
+            if (source.StartsWith('@'))
+            {
+                string manifestFile = Path.Combine(baseDirectory, source.Substring(1));
+                string manifestDirectory = Path.GetDirectoryName(manifestFile) ?? "";
+                foreach (string line in File.ReadAllLines(manifestFile))
+                {
+                    string entry = line.Trim();
+                    if (entry.Length == 0 || entry.StartsWith('#'))
+                    {
+                        continue;
+                    };
+                    AddSourceFiles(entry, manifestDirectory, result);
+                }
+                return;
+            };
+
+            string path = Path.Combine(baseDirectory, source);
+            string fileNamePattern = Path.GetFileName(path);
+            if (fileNamePattern.IndexOfAny(s_wildcards) < 0)
+            {
+                result.Add(path);
+                return;
+            };
+
+            string directory = Path.GetDirectoryName(path) ?? "";
+            SearchOption searchOption = SearchOption.TopDirectoryOnly;
+            if (Path.GetFileName(directory) == "**")
+            {
+                directory = Path.GetDirectoryName(directory) ?? "";
+                searchOption = SearchOption.AllDirectories;
+            };
+            if (directory.IndexOfAny(s_wildcards) >= 0)
+            {
+                throw new ApplicationException($"Wildcards in '{source}' are only supported in file name, and as '**' directory right before it");
+            };
+            string[] files = Directory.GetFiles(directory.Length == 0 ? "." : directory, fileNamePattern, searchOption);
+            if (files.Length == 0)
+            {
+                throw new ApplicationException($"No state machine files match '{source}'");
+            };
+            Array.Sort(files, StringComparer.Ordinal);
+            result.AddRange(files);
+        }
+
+        private static readonly char[] s_wildcards = new char[] { '*', '?' };
+
+        private static int GetValidationThreads(Config config, int stateMachinesCount)
+        {
+            if (config.validation_threads > 0)
+            {
+                return config.validation_threads;
+            };
+            //several state machines already keep all cores busy
+            return stateMachinesCount > 1 ? 1 : -1;
+        }
+
+        internal static bool TryGenerateStateMachines(List<string> sourceFiles, Config config)
+        {
+            if (sourceFiles.Count > 1 && config.output != null)
+            {
+                throw new ApplicationException("Output file name can not be specified for multiple state machines");
+            };
+
+            //decoded output depends on the dump, which is not tracked by cache
+            bool decodesTrace = config.mode == Mode.trace || config.mode == Mode.trace_dot;
+            GenerationCache? cache = config.cache == null || decodesTrace ? null : GenerationCache.Load(config.cache, config);
+            int validationThreads = GetValidationThreads(config, sourceFiles.Count);
+            bool succeed;
+            if (sourceFiles.Count == 1)
+            {
+                succeed = TryGenerateStateMachine(sourceFiles[0], config, cache, validationThreads, Console.Out);
+            }
+            else
+            {
+                int failedCount = 0;
+                object consoleLock = new object();
+                Parallel.ForEach(sourceFiles, sourceFile => {
+                    //output of every state machine is written at once, so it's not mixed with others
+                    using (StringWriter log = new StringWriter())
+                    {
+                        if (!TryGenerateStateMachine(sourceFile, config, cache, validationThreads, log))
+                        {
+                            Interlocked.Increment(ref failedCount);
+                        };
+                        lock (consoleLock)
+                        {
+                            Console.Write(log.ToString());
+                        }
+                    }
+                });
+                Console.WriteLine($"Generated {sourceFiles.Count - failedCount} of {sourceFiles.Count} state machines");
+                succeed = failedCount == 0;
+            };
+
+            cache?.Save();
+            return succeed;
+        }
+
+        private static bool TryGenerateStateMachine(string sourceFile, Config config, GenerationCache? cache, int validationThreads, TextWriter log)
         {
             try
             {
-                GenerateStateMachine(sourceFile, config);
+                string? hash = null;
+                if (cache != null)
+                {
+                    hash = cache.ComputeHash(sourceFile);
+                    if (cache.IsUpToDate(sourceFile, hash))
+                    {
+                        log.WriteLine($"State machine {sourceFile} is not changed since previous run");
+                        return true;
+                    };
+                };
+
+                List<string> outputFiles = new List<string>();
+                GenerateStateMachine(sourceFile, config, validationThreads, log, outputFiles);
+                if (cache != null)
+                {
+                    cache.Update(sourceFile, hash!, outputFiles);
+                };
                 return true;
             }
             catch (Exception e)
             {
-                Console.WriteLine(e);
+                log.WriteLine(e);
+                cache?.Remove(sourceFile);
                 return false;
             }
         }
 
-        private static void GenerateStateMachine(string sourceFile, Config config)
+        private static void GenerateStateMachine(string sourceFile, Config config, int validationThreads, TextWriter log, List<string> outputFiles)
         {
-            Console.WriteLine("Reading state machine description from " + sourceFile);
+            log.WriteLine("Reading state machine description from " + sourceFile);
             StateMachineDescr stateMachine = Parser.ParseFile(sourceFile);
 
-            Console.WriteLine("Validating state machine");
-            Validator.Validate(stateMachine);
-            Console.WriteLine("Validation done");
+            log.WriteLine("Validating state machine");
+            Validator.Validate(stateMachine, maxDegreeOfParallelism: validationThreads);
+            log.WriteLine("Validation done");
 
             switch (config.mode)
             {
             case Mode.validate:
-                Console.WriteLine("No file output mode specified");
+                log.WriteLine("No file output mode specified");
                 return;
+            case Mode.trace:
+            case Mode.trace_dot:
+                DecodeTrace(stateMachine, config, log, outputFiles);
+                break;
+            case Mode.cpp_bench:
+                ExportBenchmark(stateMachine, sourceFile, config, log, outputFiles);
+                break;
             case Mode.all:
                 {
                     string outFile = config.output ?? sourceFile;
-                    ExportSingleMode(stateMachine, outFile + Mode.dot.ToExtension(), config.out_common, Mode.dot, config);
-                    ExportSingleMode(stateMachine, outFile + Mode.d2.ToExtension(), config.out_common, Mode.d2, config);
-                    ExportSingleMode(stateMachine, outFile + Mode.cs.ToExtension(), config.out_common, Mode.cs, config);
-                    ExportSingleMode(stateMachine, outFile + Mode.cpp.ToExtension(), config.out_common, Mode.cpp, config);
+                    ExportSingleMode(stateMachine, outFile + Mode.dot.ToExtension(), config.out_common, Mode.dot, config, log, outputFiles);
+                    ExportSingleMode(stateMachine, outFile + Mode.d2.ToExtension(), config.out_common, Mode.d2, config, log, outputFiles);
+                    ExportSingleMode(stateMachine, outFile + Mode.cs.ToExtension(), config.out_common, Mode.cs, config, log, outputFiles);
+                    //C# and C++ common code can not share the same file
+                    string? cppOutCommon = config.out_common == null ? null : Path.ChangeExtension(config.out_common, Mode.cpp.ToExtension());
+                    ExportSingleMode(stateMachine, outFile + Mode.cpp.ToExtension(), cppOutCommon, Mode.cpp, config, log, outputFiles);
                 }
                 break;
             default:
@@ -153,51 +303,156 @@ namespace NiceStateMachineGenerator.App
                     config.output ?? sourceFile + config.mode.ToExtension(),
                     config.out_common,
                     config.mode,
-                    config
+                    config,
+                    log,
+                    outputFiles
                 );
                 break;
             }
+
+            if (config.depfile)
+            {
+                string depFile = (config.mode == Mode.all ? (config.output ?? sourceFile) : outputFiles[0]) + ".d";
+                WriteDepFile(depFile, sourceFile, config, log, outputFiles);
+                outputFiles.Add(depFile);
+            };
+        }
+
+        private static void DecodeTrace(StateMachineDescr stateMachine, Config config, TextWriter log, List<string> outputFiles)
+        {
+            if (config.trace_dump == null)
+            {
+                throw new ApplicationException($"Trace dump file should be specified with --trace_dump for mode {config.mode}");
+            };
+            log.WriteLine("Reading trace dump " + config.trace_dump);
+            List<TraceRecord> records = TraceDecoder.ReadDump(config.trace_dump, stateMachine);
+            if (config.trace_instance != null)
+            {
+                ulong instance = config.trace_instance.StartsWith("0x", StringComparison.OrdinalIgnoreCase)
+                    ? UInt64.Parse(config.trace_instance.Substring(2), NumberStyles.HexNumber, CultureInfo.InvariantCulture)
+                    : UInt64.Parse(config.trace_instance, CultureInfo.InvariantCulture);
+                records = records.Where(r => r.Instance == instance).ToList();
+            };
+
+            string outFileName = config.output ?? config.trace_dump + config.mode.ToExtension();
+            log.WriteLine($"Writing {records.Count} trace records to {outFileName}");
+            if (config.mode == Mode.trace)
+            {
+                TraceDecoder.ExportText(stateMachine, records, outFileName);
+            }
+            else
+            {
+                TraceDecoder.ExportGraphwiz(stateMachine, records, outFileName, config.graphwiz);
+                if (config.run_dot)
+                {
+                    RunGraphwiz(outFileName, log);
+                }
+            };
+            outputFiles.Add(outFileName);
         }
 
-        private static void ExportSingleMode(StateMachineDescr stateMachine, string outFileName, string? outCommonCodeFileName, Mode mode, Config config)
+        private static void ExportBenchmark(StateMachineDescr stateMachine, string sourceFile, Config config, TextWriter log, List<string> outputFiles)
         {
-            Console.WriteLine($"Writing output for mode {mode} to {outFileName} (common code in {(outCommonCodeFileName == null? "the same file" : outCommonCodeFileName)})");
+            string outFileName = config.output ?? sourceFile + Mode.cpp_bench.ToExtension();
+            //header generated in cpp mode with default output name, included relative to the benchmark
+            string headerFile = sourceFile + Mode.cpp.ToExtension();
+            string headerInclude = Path.GetRelativePath(Path.GetDirectoryName(Path.GetFullPath(outFileName))!, Path.GetFullPath(headerFile)).Replace('\\', '/');
+            log.WriteLine($"Writing C++ benchmark to {outFileName} (including {headerInclude})");
+            CppCodeExporter.ExportBenchmark(stateMachine, outFileName, headerInclude, config.cpp);
+            outputFiles.Add(outFileName);
+        }
+
+        //Make/Ninja style depfile: all outputs of the state machine depend on its description and configuration file
+        private static void WriteDepFile(string depFile, string sourceFile, Config config, TextWriter log, List<string> outputFiles)
+        {
+            List<string> inputFiles = new List<string>() { sourceFile };
+            if (config.config != null)
+            {
+                inputFiles.Add(config.config);
+            };
+            if ((config.mode == Mode.trace || config.mode == Mode.trace_dot) && config.trace_dump != null)
+            {
+                inputFiles.Add(config.trace_dump);
+            };
+            string targets = String.Join(" ", outputFiles.Select(EscapeDepFilePath).Distinct());
+            string dependencies = String.Join(" ", inputFiles.Select(EscapeDepFilePath));
+            log.WriteLine($"Writing dependencies to {depFile}");
+            OutputFileWriter.WriteIfChanged(depFile, $"{targets}: {dependencies}\n");
+        }
+
+        private static string EscapeDepFilePath(string fileName)
+        {
+            return Path.GetFullPath(fileName)
+                .Replace("$", "$$")
+                .Replace("#", "\\#")
+                .Replace(" ", "\\ ");
+        }
+
+        private static void ExportSingleMode(StateMachineDescr stateMachine, string outFileName, string? outCommonCodeFileName, Mode mode, Config config, TextWriter log, List<string> outputFiles)
+        {
+            log.WriteLine($"Writing output for mode {mode} to {outFileName} (common code in {(outCommonCodeFileName == null? "the same file" : outCommonCodeFileName)})");
             switch (mode)
             {
             case Mode.dot:
                 GraphwizExporter.Export(stateMachine, outFileName, config.graphwiz);
                 if (config.run_dot)
                 {
-                    RunGraphwiz(outFileName);
+                    RunGraphwiz(outFileName, log);
                 }
                 break;
             case Mode.cs:
-                CsharpCodeExporter.Export(stateMachine, outFileName, outCommonCodeFileName, config.c_sharp);
+                //common code file may be shared by state machines generated concurrently
+                lock (GetCommonCodeLock(outCommonCodeFileName))
+                {
+                    CsharpCodeExporter.Export(stateMachine, outFileName, outCommonCodeFileName, config.c_sharp);
+                }
                 break;
             case Mode.cpp:
-                CppCodeExporter.Export(stateMachine, outFileName, config.cpp);
+                lock (GetCommonCodeLock(outCommonCodeFileName))
+                {
+                    CppCodeExporter.Export(stateMachine, outFileName, outCommonCodeFileName, config.cpp);
+                }
                 break;
             case Mode.d2:
                 D2Exporter.Export(stateMachine, outFileName, config.d2);
                 if (config.run_d2)
                 {
-                    RunD2(outFileName, config);
+                    RunD2(outFileName, config, log);
                 }
                 break;
             default:
                 throw new Exception($"Unexpected output mode '{mode}'. Supported modes are: {String.Join(", ", Enum.GetNames<Mode>())}");
             }
+            outputFiles.Add(outFileName);
+            if (outCommonCodeFileName != null && mode != Mode.dot && mode != Mode.d2)
+            {
+                outputFiles.Add(outCommonCodeFileName);
+            };
+        }
+
+        private static readonly ConcurrentDictionary<string, object> s_commonCodeLocks = new ConcurrentDictionary<string, object>();
+
+        private static object GetCommonCodeLock(string? outCommonCodeFileName)
+        {
+            //without common code file there is nothing to share, so any fresh object would do
+            return outCommonCodeFileName == null
+                ? new object()
+                : s_commonCodeLocks.GetOrAdd(Path.GetFullPath(outCommonCodeFileName), _ => new object());
         }
 
         private static void WriteUsage()
         {
             Console.WriteLine("Usage: ");
-            Console.WriteLine($"{nameof(NiceStateMachineGenerator)}.{nameof(NiceStateMachineGenerator.App)} <state machine json file> [options]");
+            Console.WriteLine($"{nameof(NiceStateMachineGenerator)}.{nameof(NiceStateMachineGenerator.App)} <state machine json file> [<state machine json file> ...] [options]");
+            Console.WriteLine($"\t\tFile names may contain wildcards in file name, and '**' directory right before it to look into all subdirectories, e.g. 'protocols/**/*.json'.");
+            Console.WriteLine($"\t\t'@<manifest file>' reads file names and patterns from manifest, one per line, relative to manifest location.");
+            Console.WriteLine($"\t\tSeveral state machines are generated concurrently with the same options.");
             Console.WriteLine($"Possible options:");
             Console.WriteLine($"-c/--config <config.json> : configuration file. Contains settings for all exporters and may contain any of the settings below");
             Console.WriteLine($"-m/--mode <mode> : export mode. One of 'dot', 'cs', 'cpp'.");
             Console.WriteLine($"\t\tUse 'all' ti output all 3 type of files.");
             Console.WriteLine($"\t\tUse 'validate' to suppress file output (default mode). All other modes also do validation.");
+            Console.WriteLine($"\t\tUse 'cpp_bench' to write a C++ benchmark of the header generated in 'cpp' mode with the same settings (<input file name>.bench.cpp).");
             Console.WriteLine($"-o/--output <output file name> : output file name.");
             Console.WriteLine($"\t\tIf not specified then <input file name>.<mode-specific extension> is used.");
             Console.WriteLine($"\t\tIn case of 'all' mode specific extensions are added to <output file name>.");
@@ -207,20 +462,26 @@ namespace NiceStateMachineGenerator.App
             Console.WriteLine($"Also any option for exporter may be overriden via cmdline args. Nesting is specified by ':'");
             Console.WriteLine($"\t\tE.g.: '--c_sharp:ClassName=MyClass' or '--cpp:NamespaceName ns'");
             Console.WriteLine($"-d/--daemon true : start generator in daemon mode (automatically regenerates source code and graph on changes)");
+            Console.WriteLine($"--validation_threads <number> : number of threads used for validation. By default all available cores are used for a single state machine, and one per state machine otherwise.");
+            Console.WriteLine($"--depfile true : write Make/Ninja style depfile listing outputs and inputs of every state machine next to its output (<output>.d).");
+            Console.WriteLine($"--cache <cache file> : skip state machines that are not changed since previous run with the same cache file.");
+            Console.WriteLine($"\t\tState machine is regenerated if its file, effective configuration or generator build changes, or if any of its outputs is missing.");
+            Console.WriteLine($"--trace_dump <dump file> : binary trace dumped by C++ code generated with '--cpp:Trace=true', decoded in modes 'trace' (text) and 'trace_dot' (Graphwiz overlay).");
+            Console.WriteLine($"\t\tOutput is written to <dump file>.txt or <dump file>.dot unless specified by -o. Use --trace_instance <id> to decode records of a single machine only.");
         }
 
-        private static void RunGraphwiz(string dotFileName)
+        private static void RunGraphwiz(string dotFileName, TextWriter log)
         {
-            Console.WriteLine("Executing Graphwiz/dot");
+            log.WriteLine("Executing Graphwiz/dot");
             using (Process gw = Process.Start("dot", $"-Tpng -O {dotFileName}"))
             {
                 gw.WaitForExit();
             }
         }
 
-        private static void RunD2(string d2FileName, Config config)
+        private static void RunD2(string d2FileName, Config config, TextWriter log)
         {
-            Console.WriteLine("Executing D2");
+            log.WriteLine("Executing D2");
             using (Process gw = Process.Start("d2", $"-l {config.d2_layout} -t {config.d2_theme} {d2FileName} {d2FileName}.svg"))
             {
                 gw.WaitForExit();
@@ -0,0 +1,63 @@
+﻿using NiceStateMachineGenerator.App;
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using Xunit;
+
+namespace NiceStateMachineGenerator.Tests
+{
+    public sealed class MultipleStateMachinesTests : IDisposable
+    {
+        private static readonly string[] s_stateMachines = new string[] { "call_handler", "client__invite__udp", "client__non_invite__udp" };
+
+        private readonly string m_directory;
+
+        public MultipleStateMachinesTests()
+        {
+            this.m_directory = Path.Combine(Path.GetTempPath(), "NiceStateMachineGenerator.Tests", Guid.NewGuid().ToString("N"));
+            Directory.CreateDirectory(this.m_directory);
+        }
+
+        public void Dispose()
+        {
+            Directory.Delete(this.m_directory, recursive: true);
+        }
+
+        private List<string> CopySamples()
+        {
+            return s_stateMachines
+                .Select(name => {
+                    string file = Path.Combine(this.m_directory, name + ".json");
+                    File.Copy(Path.Combine(AppContext.BaseDirectory, "samples", name + ".json"), file);
+                    return file;
+                })
+                .ToList();
+        }
+
+        [Fact]
+        public void EveryStateMachineGetsItsOwnClassName()
+        {
+            List<string> sourceFiles = CopySamples();
+            Config config = new Config {
+                mode = Mode.all,
+                cache = Path.Combine(this.m_directory, "cache.json"),
+            };
+            string configBefore = System.Text.Json.JsonSerializer.Serialize(config);
+
+            //machines are generated in parallel, and share the same settings
+            Assert.True(Program.TryGenerateStateMachines(sourceFiles, config));
+
+            foreach (string name in s_stateMachines)
+            {
+                string source = Path.Combine(this.m_directory, name + ".json");
+                Assert.Contains($"class {name}\n", File.ReadAllText(source + Mode.cpp.ToExtension()).Replace("\r\n", "\n"));
+                Assert.Contains($"public partial class {name}:", File.ReadAllText(source + Mode.cs.ToExtension()));
+            }
+            Assert.Null(config.cpp.ClassName);
+            Assert.Null(config.c_sharp.ClassName);
+            //config is a part of the cache key, so the next run must not regenerate anything
+            Assert.Equal(configBefore, System.Text.Json.JsonSerializer.Serialize(config));
+        }
+    }
+}
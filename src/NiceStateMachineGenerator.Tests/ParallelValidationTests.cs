@@ -0,0 +1,50 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Threading.Tasks;
+using Xunit;
+
+namespace NiceStateMachineGenerator.Tests
+{
+    public sealed class ParallelValidationTests : IDisposable
+    {
+        private const string LOOP_MACHINE = @"{
+            ""events"": { ""E1"": {}, ""E2"": {} },
+            ""timers"": {},
+            ""start_state"": ""A"",
+            ""states"": {
+                ""A"": { ""on_event"": { ""E1"": ""B"", ""E2"": ""C"" } },
+                ""B"": { ""on_event"": { ""E1"": ""C"", ""E2"": ""A"" } },
+                ""C"": { ""on_event"": { ""E1"": ""A"", ""E2"": ""B"" } }
+            }
+        }";
+
+        private static readonly TimeSpan s_timeout = TimeSpan.FromSeconds(30);
+
+        private readonly string m_file;
+
+        public ParallelValidationTests()
+        {
+            this.m_file = Path.Combine(Path.GetTempPath(), Guid.NewGuid().ToString("N") + ".json");
+            File.WriteAllText(this.m_file, LOOP_MACHINE);
+        }
+
+        public void Dispose()
+        {
+            File.Delete(this.m_file);
+        }
+
+        //a next_state pointing nowhere can't come from parser, and fails the worker with an exception other than LogicValidationException
+        [Fact]
+        public void NonValidationFailureStopsAllWorkers()
+        {
+            StateMachineDescr stateMachine = Parser.ParseFile(this.m_file);
+            stateMachine.States["B"].NextStateName = "Missing";
+
+            Task validation = Task.Run(() => Validator.Validate(stateMachine, maxDegreeOfParallelism: 4));
+            Assert.True(Task.WhenAny(validation, Task.Delay(s_timeout)).Result == validation, "Validation hangs");
+            Assert.True(validation.IsFaulted);
+            Assert.IsType<KeyNotFoundException>(validation.Exception!.InnerException);
+        }
+    }
+}
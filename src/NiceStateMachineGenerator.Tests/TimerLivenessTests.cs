@@ -0,0 +1,71 @@
+﻿using System;
+using System.IO;
+using Xunit;
+
+namespace NiceStateMachineGenerator.Tests
+{
+    public sealed class TimerLivenessTests : IDisposable
+    {
+        //T1 is not stopped when it fires, so it's still running in B when T2 is started
+        private const string PERIODIC_TIMER_MACHINE = @"{
+            ""events"": {},
+            ""timers"": { ""T1"": 1, ""T2"": 2 },
+            ""start_state"": ""A"",
+            ""states"": {
+                ""A"": {
+                    ""start_timers"": [ ""T1"" ],
+                    ""on_timer"": { ""T1"": ""B"" }
+                },
+                ""B"": {
+                    ""start_timers"": [ ""T2"" ],
+                    ""on_timer"": { ""T1"": null, ""T2"": ""C"" }
+                },
+                ""C"": {
+                    ""stop_timers"": [ ""T1"", ""T2"" ],
+                    ""final"": true
+                }
+            }
+        }";
+
+        private readonly string m_file;
+
+        public TimerLivenessTests()
+        {
+            this.m_file = Path.Combine(Path.GetTempPath(), Guid.NewGuid().ToString("N") + ".json");
+            File.WriteAllText(this.m_file, PERIODIC_TIMER_MACHINE);
+        }
+
+        public void Dispose()
+        {
+            File.Delete(this.m_file);
+        }
+
+        private StateMachineDescr ParseMachine()
+        {
+            StateMachineDescr stateMachine = Parser.ParseFile(this.m_file);
+            Validator.Validate(stateMachine);
+            return stateMachine;
+        }
+
+        [Fact]
+        public void FiredTimerStaysEnabled()
+        {
+            TimerLiveness liveness = Validator.ComputeTimerLiveness(ParseMachine());
+            Assert.True(liveness.MayBeActiveOnEntry("C", "T1"));
+            Assert.True(liveness.MayBeActiveTogether("T1", "T2"));
+        }
+
+        [Fact]
+        public void TimersEnabledTogetherAreNotShared()
+        {
+            using (StringWriter writer = new StringWriter())
+            {
+                CppCodeExporter.Export(ParseMachine(), writer, new CppCodeExporter.Settings { ClassName = "periodic", ShareTimers = true });
+                string header = writer.ToString();
+                Assert.Contains("T* T1;", header);
+                Assert.Contains("T* T2;", header);
+                Assert.Contains("T1->Stop();", header);
+            }
+        }
+    }
+}
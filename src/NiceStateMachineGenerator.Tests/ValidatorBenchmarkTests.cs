@@ -0,0 +1,79 @@
+﻿using System;
+using System.Diagnostics;
+using System.IO;
+using System.Text;
+using Xunit;
+using Xunit.Abstractions;
+
+namespace NiceStateMachineGenerator.Tests
+{
+    public sealed class ValidatorBenchmarkTests : IDisposable
+    {
+        //every subset of fired only_once events may come with every state, while the number of paths grows exponentially with their length
+        private const int ONLY_ONCE_EVENTS_COUNT = 6;
+
+        private readonly ITestOutputHelper m_output;
+        private readonly string m_file;
+
+        public ValidatorBenchmarkTests(ITestOutputHelper output)
+        {
+            this.m_output = output;
+            this.m_file = Path.Combine(Path.GetTempPath(), Guid.NewGuid().ToString("N") + ".json");
+        }
+
+        public void Dispose()
+        {
+            File.Delete(this.m_file);
+        }
+
+        private static string ComposeStateName(int index)
+        {
+            return "S" + index;
+        }
+
+        //Ring of states: Step goes to the next state, and only_once event Jump<j> goes j + 2 states ahead.
+        //Tick is started in the first state and never stopped, so every state ignores it
+        private static string ComposeRingMachine(int statesCount)
+        {
+            StringBuilder builder = new StringBuilder();
+            builder.Append(@"{ ""events"": { ""Step"": {}");
+            for (int j = 0; j < ONLY_ONCE_EVENTS_COUNT; ++j)
+            {
+                builder.Append($@", ""Jump{j}"": {{ ""only_once"": true }}");
+            }
+            builder.Append($@" }}, ""timers"": {{ ""Tick"": 1 }}, ""start_state"": ""{ComposeStateName(0)}"", ""states"": {{");
+            for (int i = 0; i < statesCount; ++i)
+            {
+                builder.Append($@"{(i == 0 ? "" : ",")} ""{ComposeStateName(i)}"": {{ ""on_event"": {{ ""Step"": ""{ComposeStateName((i + 1) % statesCount)}""");
+                for (int j = 0; j < ONLY_ONCE_EVENTS_COUNT; ++j)
+                {
+                    builder.Append($@", ""Jump{j}"": ""{ComposeStateName((i + j + 2) % statesCount)}""");
+                }
+                builder.Append($@" }}, ""on_timer"": {{ ""Tick"": null }}{(i == 0 ? @", ""start_timers"": [ ""Tick"" ]" : "")} }}");
+            }
+            builder.Append(" } }");
+            return builder.ToString();
+        }
+
+        //Validation explores every reachable execution state exactly once, and there are statesCount * 2^ONLY_ONCE_EVENTS_COUNT of them here.
+        //Timings are reported only, as they depend on the machine running the tests
+        [Fact]
+        public void ValidationScalesWithExecutionStates()
+        {
+            foreach (int statesCount in new int[] { 100, 250, 500, 1000 })
+            {
+                File.WriteAllText(this.m_file, ComposeRingMachine(statesCount));
+                StateMachineDescr stateMachine = Parser.ParseFile(this.m_file);
+                int executionStates = statesCount << ONLY_ONCE_EVENTS_COUNT;
+                Stopwatch stopwatch = Stopwatch.StartNew();
+                Validator.Validate(stateMachine, maxDegreeOfParallelism: 1, out int exploredExecutionStates);
+                stopwatch.Stop();
+                Assert.Equal(executionStates, exploredExecutionStates);
+                this.m_output.WriteLine(
+                    $"{statesCount} states, {executionStates} execution states: {stopwatch.Elapsed.TotalMilliseconds:F1} ms, "
+                    + $"{stopwatch.Elapsed.TotalMilliseconds * 1e6 / executionStates:F1} ns/execution state"
+                );
+            }
+        }
+    }
+}
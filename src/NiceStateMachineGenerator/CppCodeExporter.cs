@@ -11,6 +11,51 @@ using System.Threading.Tasks;
 
 namespace NiceStateMachineGenerator
 {
+    public enum CppDispatchMode
+    {
+        //switch on current state in every ProcessEvent__*/OnTimer
+        @switch,
+
+        //constexpr [state][event] transition table with a single generic lookup
+        table,
+    }
+
+    public enum CppCallbackMode
+    {
+        //std::function data members, null-checked on every call
+        std_function,
+
+        //methods of a Handler template parameter, called directly. Unimplemented callbacks are compiled away
+        handler,
+
+        //non-function callbacks append typed records to a caller-provided buffer, function callbacks are std::function data members
+        actions,
+    }
+
+    public enum CppErrorMode
+    {
+        //std::runtime_error is thrown
+        exceptions,
+
+        //public methods return [[nodiscard]] Result, errors of timer events are passed to the error handler
+        status,
+
+        //errors are passed to a static noexcept error handler, processing of the event is stopped
+        handler,
+    }
+
+    public enum CppInstrumentation
+    {
+        //no statistics code is generated
+        none,
+
+        //per-thread counters of state entries, transitions and errors
+        counters,
+
+        //counters plus steady_clock latency histograms of every callback
+        latency,
+    }
+
     public sealed class CppCodeExporter
     {
         public sealed class Settings
@@ -18,17 +63,64 @@ namespace NiceStateMachineGenerator
             public string NamespaceName { get; set; } = "generated";
             public string? ClassName { get; set; } = null; //generate from file name
             public List<string>? AdditionalIncludes { get; set; } = null;
+            public CppDispatchMode DispatchMode { get; set; } = CppDispatchMode.@switch;
+            public CppCallbackMode CallbackMode { get; set; } = CppCallbackMode.std_function;
+            public bool CompactLayout { get; set; } = false;
+            public bool BatchProcessing { get; set; } = false;
+            public bool GeneratePool { get; set; } = false;
+            public bool GenerateObjectPool { get; set; } = false; //emit <ClassName>ObjectPool recycling machines through Reset()
+            public bool MappedPool { get; set; } = false; //pool keeps instance data in a memory-mapped file and resumes it after restart, POSIX only
+            public bool TimerWheel { get; set; } = false; //emit TimerWheel/WheelTimer runtime along with Timer concept
+            public CppErrorMode ErrorMode { get; set; } = CppErrorMode.exceptions;
+            public bool GenerateEventTypes { get; set; } = false; //emit struct per event and Process(...) entry points dispatching on them
+            public ArgPassMode ArgPassMode { get; set; } = ArgPassMode.value; //for event args without pass mode in description
+            public bool GenerateInbox { get; set; } = false; //emit <ClassName>Inbox wrapper: events posted from any thread are processed by Drain()
+            public CppInstrumentation Instrumentation { get; set; } = CppInstrumentation.none; //emit <ClassName>Stats with per-thread counters
+            public bool Trace { get; set; } = false; //emit <ClassName>Trace: every transition is recorded to a per-thread ring buffer
+            public int TraceCapacity { get; set; } = 4096; //records per thread, power of two
+            public bool GenerateSnapshot { get; set; } = false; //emit SnapshotData with Snapshot()/Restore() and its versioned binary encoding
+            public bool ShareTimers { get; set; } = false; //timers that are never running at the same time are backed by the same timer object
+            public bool LazyTimers { get; set; } = false; //timers of the machine class are created on first start and deleted when stopped or a final state is reached
+
+            //same settings are shared by all the state machines of a run, so class name of a single one goes to a copy
+            internal Settings WithClassName(string className)
+            {
+                Settings result = (Settings)this.MemberwiseClone();
+                result.ClassName = className;
+                return result;
+            }
         }
 
         public static void Export(StateMachineDescr stateMachine, string headerFile, Settings settings)
         {
-            using (StreamWriter writer = new StreamWriter(headerFile))
+            Export(stateMachine, headerFile, null, settings);
+        }
+
+        public static void Export(StateMachineDescr stateMachine, string headerFile, string? commonCodeFile, Settings settings)
+        {
+            if (String.IsNullOrEmpty(settings.ClassName))
+            {
+                settings = settings.WithClassName(ExportHelper.GetClassNameFromFileName(headerFile));
+            }
+            if (commonCodeFile != null && commonCodeFile != headerFile)
+            {
+                //common header is included relative to the main one
+                string commonCodeInclude = Path.GetRelativePath(Path.GetDirectoryName(Path.GetFullPath(headerFile))!, Path.GetFullPath(commonCodeFile)).Replace('\\', '/');
+                using (StringWriter writer = new StringWriter())
+                using (StringWriter commonCodeWriter = new StringWriter())
+                {
+                    Export(stateMachine, writer, commonCodeWriter, commonCodeInclude, settings);
+                    OutputFileWriter.WriteIfChanged(headerFile, writer.ToString());
+                    OutputFileWriter.WriteIfChanged(commonCodeFile, commonCodeWriter.ToString());
+                }
+            }
+            else
             {
-                if (String.IsNullOrEmpty(settings.ClassName))
+                using (StringWriter writer = new StringWriter())
                 {
-                    settings.ClassName = ExportHelper.GetClassNameFromFileName(headerFile);
+                    Export(stateMachine, writer, settings);
+                    OutputFileWriter.WriteIfChanged(headerFile, writer.ToString());
                 }
-                Export(stateMachine, writer, settings);
             }
         }
 
@@ -40,21 +132,74 @@ namespace NiceStateMachineGenerator
             }
         }
 
+        public static void Export(StateMachineDescr stateMachine, TextWriter writer, TextWriter commonCodeWriter, string commonCodeInclude, Settings settings)
+        {
+            using (IndentedTextWriter indentedWriter = new IndentedTextWriter(writer))
+            using (IndentedTextWriter commonCodeIndentedWriter = new IndentedTextWriter(commonCodeWriter))
+            {
+                Export(stateMachine, indentedWriter, commonCodeIndentedWriter, commonCodeInclude, settings);
+            }
+        }
+
         public static void Export(StateMachineDescr stateMachine, IndentedTextWriter header, Settings settings)
         {
-            CppCodeExporter exporter = new CppCodeExporter(stateMachine, header, settings);
+            CppCodeExporter exporter = new CppCodeExporter(stateMachine, header, null, null, settings);
+            exporter.ExportInternal();
+        }
+
+        public static void Export(StateMachineDescr stateMachine, IndentedTextWriter header, IndentedTextWriter commonCodeHeader, string commonCodeInclude, Settings settings)
+        {
+            CppCodeExporter exporter = new CppCodeExporter(stateMachine, header, commonCodeHeader, commonCodeInclude, settings);
             exporter.ExportInternal();
         }
 
+        //Standalone C++ translation unit measuring dispatch cost of the header generated from the same description with the same settings.
+        //headerInclude is used by the benchmark to #include the header
+        public static void ExportBenchmark(StateMachineDescr stateMachine, string benchmarkFile, string headerInclude, Settings settings)
+        {
+            if (String.IsNullOrEmpty(settings.ClassName))
+            {
+                settings = settings.WithClassName(ExportHelper.GetClassNameFromFileName(headerInclude));
+            }
+            using (StringWriter writer = new StringWriter())
+            {
+                ExportBenchmark(stateMachine, writer, headerInclude, settings);
+                OutputFileWriter.WriteIfChanged(benchmarkFile, writer.ToString());
+            }
+        }
+
+        public static void ExportBenchmark(StateMachineDescr stateMachine, TextWriter writer, string headerInclude, Settings settings)
+        {
+            using (IndentedTextWriter indentedWriter = new IndentedTextWriter(writer))
+            {
+                CppCodeExporter exporter = new CppCodeExporter(stateMachine, indentedWriter, null, null, settings);
+                exporter.ExportBenchmarkInternal(headerInclude);
+            }
+        }
+
         private readonly StateMachineDescr m_stateMachine;
         private readonly IndentedTextWriter m_writer; 
+        private readonly IndentedTextWriter? m_commonCodeWriter;
+        private readonly string? m_commonCodeInclude;
         private readonly Settings m_settings;
         private readonly HashSet<string> m_modifiedTimers;
+        private readonly TimerLiveness m_timerLiveness;
+        private readonly Dictionary<string, List<string>> m_timerObjects; //timers backed by each timer object, name of a shared one joins their names
+        private readonly Dictionary<string, string> m_timerToObject;
+        private readonly List<string> m_invokers; //events, then timers. Columns of the transition table
+        private readonly Dictionary<EdgeDescr, int> m_callbackSlots = new Dictionary<EdgeDescr, int>();
+        private readonly Dictionary<string, List<KeyValuePair<StateDescr, EdgeDescr>>> m_callbackSlotEdges = new Dictionary<string, List<KeyValuePair<StateDescr, EdgeDescr>>>();
+        private readonly List<string> m_latencyCallbacks = new List<string>();
+        private bool m_sharedCallbacks; //callbacks are function pointers in a per-type table instead of per-instance std::function members
+        private readonly List<(string name, EventDescr? @event)> m_actionCallbacks = new List<(string name, EventDescr? @event)>(); //recorded to action buffer, event is set if args are recorded
+        private bool m_writingPool = false; //instance data is accessed through arrays indexed with handle
 
-        private CppCodeExporter(StateMachineDescr stateMachine, IndentedTextWriter headerWriter, Settings settings)
+        private CppCodeExporter(StateMachineDescr stateMachine, IndentedTextWriter headerWriter, IndentedTextWriter? commonCodeWriter, string? commonCodeInclude, Settings settings)
         {
             this.m_stateMachine = stateMachine;
             this.m_writer = headerWriter;
+            this.m_commonCodeWriter = commonCodeWriter;
+            this.m_commonCodeInclude = commonCodeInclude;
             this.m_settings = settings;
 
 
@@ -63,13 +208,150 @@ namespace NiceStateMachineGenerator
                 .Where(t => t.Modify != null)
                 .Select(t => t.TimerName)
                 .ToHashSet();
+
+            this.m_timerLiveness = Validator.ComputeTimerLiveness(this.m_stateMachine);
+
+            //every timer goes to the first timer object none of whose timers may be running along with it
+            List<List<string>> timerGroups = new List<List<string>>();
+            foreach (string timer in this.m_stateMachine.Timers.Keys)
+            {
+                List<string>? group = this.m_settings.ShareTimers
+                    ? timerGroups.FirstOrDefault(g => g.All(t => !this.m_timerLiveness.MayBeActiveTogether(t, timer)))
+                    : null;
+                if (group == null)
+                {
+                    group = new List<string>();
+                    timerGroups.Add(group);
+                };
+                group.Add(timer);
+            }
+            this.m_timerObjects = timerGroups.ToDictionary(g => String.Join("__", g));
+            this.m_timerToObject = this.m_timerObjects
+                .SelectMany(o => o.Value.Select(t => new KeyValuePair<string, string>(t, o.Key)))
+                .ToDictionary(p => p.Key, p => p.Value);
+
+            this.m_invokers = this.m_stateMachine.Events.Keys
+                .Concat(this.m_stateMachine.Timers.Keys)
+                .ToList();
+
+            if (this.m_settings.DispatchMode == CppDispatchMode.table)
+            {
+                ComputeCallbackSlots();
+            };
+
+            if (this.m_settings.Instrumentation == CppInstrumentation.latency)
+            {
+                ComputeLatencyCallbacks();
+            };
+
+            if (this.m_settings.Trace)
+            {
+                if (this.m_settings.TraceCapacity <= 0 || (this.m_settings.TraceCapacity & (this.m_settings.TraceCapacity - 1)) != 0)
+                {
+                    throw new Exception($"Trace capacity should be a power of two, got {this.m_settings.TraceCapacity}");
+                };
+                //ids are 16 bit in trace records, and the last value is reserved
+                if (this.m_stateMachine.States.Count >= TraceDecoder.NO_ID || this.m_invokers.Count >= TraceDecoder.NO_ID)
+                {
+                    throw new Exception("Too many states or events to be traced");
+                };
+            };
+
+            if (this.m_settings.GenerateSnapshot && ComputeSnapshotRecordSize() > UInt16.MaxValue)
+            {
+                throw new Exception("Too many timers to be snapshotted");
+            };
+
+            if (this.m_settings.MappedPool && !this.m_settings.GeneratePool)
+            {
+                throw new Exception("Mapped pool requires pool generation to be enabled");
+            };
+
+            if (this.m_settings.LazyTimers && this.m_settings.CompactLayout)
+            {
+                throw new Exception("Lazy timers can't be generated for compact layout, as it holds timers by value");
+            };
+
+            if (this.m_settings.LazyTimers && this.m_settings.GenerateInbox)
+            {
+                //posted fires would outlive deleted timers
+                throw new Exception("Inbox can't be generated with lazy timers");
+            };
+
+            if (this.m_settings.GenerateInbox && this.m_settings.CompactLayout)
+            {
+                //timers are held by value and can't be wrapped to post their fires
+                throw new Exception("Inbox can't be generated for compact layout");
+            };
+
+            if (this.m_settings.CallbackMode == CppCallbackMode.actions)
+            {
+                //records point to the machine, while pool machines are handles and compact ones are kept as small as possible
+                if (this.m_settings.CompactLayout || this.m_settings.GeneratePool)
+                {
+                    throw new Exception("Action buffer can't be generated for compact layout or pool");
+                };
+                CollectActionCallbacks();
+            };
+
+            if (NeedEventIdEnum())
+            {
+                //events and timers share the EventId enum
+                string? clash = this.m_stateMachine.Events.Keys.FirstOrDefault(e => this.m_stateMachine.Timers.ContainsKey(e));
+                if (clash != null)
+                {
+                    throw new Exception($"Event and timer share the name '{clash}', which is not supported with error mode {this.m_settings.ErrorMode} or event types generation");
+                };
+            };
+
+            this.m_sharedCallbacks = this.m_settings.CompactLayout
+                && this.m_settings.CallbackMode == CppCallbackMode.std_function
+                && this.m_stateMachine.States.Values.Any(s => s.NeedOnEnterEvent
+                    || (s.EventEdges?.Values.Any(e => e.OnTraverseEventTypes.Count > 0) ?? false)
+                    || (s.TimerEdges?.Values.Any(e => e.OnTraverseEventTypes.Count > 0) ?? false)
+                );
         }
 
         private void ExportInternal()
         {
-            this.m_writer.WriteLine($"// generated by {nameof(NiceStateMachineGenerator)} v{Assembly.GetExecutingAssembly().GetName().Version}");
+            string generatedBy = $"// generated by {nameof(NiceStateMachineGenerator)} v{Assembly.GetExecutingAssembly().GetName().Version}";
+            if (this.m_commonCodeWriter != null)
+            {
+                this.m_commonCodeWriter.WriteLine(generatedBy);
+                WriteVerbatimCode(HEADER_PREAMBLE_CODE, this.m_commonCodeWriter);
+                foreach (string include in GetCommonCodeIncludes())
+                {
+                    this.m_commonCodeWriter.WriteLine($"#include <{include}>");
+                };
+                this.m_commonCodeWriter.WriteLine();
+                this.m_commonCodeWriter.WriteLine();
+                this.m_commonCodeWriter.WriteLine($"namespace {this.m_settings.NamespaceName}");
+                this.m_commonCodeWriter.WriteLine("{");
+                {
+                    ++this.m_commonCodeWriter.Indent;
+                    WriteCommonCode(this.m_commonCodeWriter);
+                    --this.m_commonCodeWriter.Indent;
+                }
+                this.m_commonCodeWriter.WriteLine("}"); //namespace
+            };
+
+            this.m_writer.WriteLine(generatedBy);
 
             WriteVerbatimCode(HEADER_PREAMBLE_CODE);
+            IEnumerable<string> extraIncludes = this.m_commonCodeWriter == null
+                ? GetCommonCodeIncludes().Concat(GetExtraIncludes()).Distinct()
+                : GetExtraIncludes();
+            foreach (string include in extraIncludes)
+            {
+                this.m_writer.WriteLine($"#include <{include}>");
+            };
+            this.m_writer.WriteLine();
+            this.m_writer.WriteLine();
+            if (this.m_commonCodeInclude != null)
+            {
+                this.m_writer.WriteLine($"#include \"{this.m_commonCodeInclude}\"");
+                this.m_writer.WriteLine();
+            };
             if (this.m_settings.AdditionalIncludes != null)
             {
                 foreach (string include in this.m_settings.AdditionalIncludes)
@@ -84,20 +366,47 @@ namespace NiceStateMachineGenerator
             {
                 ++this.m_writer.Indent;
 
-                WriteVerbatimCode(TIMER_CODE);
+                if (this.m_commonCodeWriter == null)
+                {
+                    WriteCommonCode(this.m_writer);
+                };
 
-                this.m_writer.WriteLine($"template <Timer T>");
+                if (this.m_settings.Instrumentation != CppInstrumentation.none)
+                {
+                    WriteStats();
+                };
+                if (this.m_settings.Trace)
+                {
+                    WriteTrace();
+                };
+
+                if (this.m_settings.GenerateInbox && this.m_settings.ErrorMode == CppErrorMode.status)
+                {
+                    //inbox reports errors of drained events
+                    WriteTemplateHeader();
+                    this.m_writer.WriteLine($"class {ComposeInboxClassName()};");
+                    this.m_writer.WriteLine();
+                };
+
+                WriteTemplateHeader();
                 this.m_writer.WriteLine($"class {this.m_settings.ClassName}");
                 this.m_writer.WriteLine("{");
                 {
                     this.m_writer.WriteLine("public:");
                     ++this.m_writer.Indent;
-                    WriteEnum(STATES_ENUM_NAME, this.m_stateMachine.States.Keys);
+                    WriteEnum(STATES_ENUM_NAME, this.m_settings.CompactLayout ? ComposeStatesUnderlyingType() : null, this.m_stateMachine.States.Keys);
+                    WriteEventTypes();
+                    WriteErrorTypes();
                     WriteCallbackEvents();
                     --this.m_writer.Indent;
 
                     this.m_writer.WriteLine("private:");
                     ++this.m_writer.Indent;
+                    if (this.m_settings.GenerateInbox && this.m_settings.ErrorMode == CppErrorMode.status)
+                    {
+                        this.m_writer.WriteLine($"{ComposeTemplateHeader("U")} friend class {ComposeInboxClassName()};");
+                    };
+                    WriteErrorHandlerField();
                     WriteFields();
                     --this.m_writer.Indent;
 
@@ -105,605 +414,6249 @@ namespace NiceStateMachineGenerator
                     ++this.m_writer.Indent;
                     WriteConstructorDestructorStateGetter();
                     WriteStart();
+                    WriteReset();
                     foreach (EventDescr @event in this.m_stateMachine.Events.Values)
                     {
                         WriteProcessEvent(@event);
                     };
+                    if (this.m_settings.BatchProcessing)
+                    {
+                        foreach (EventDescr @event in this.m_stateMachine.Events.Values)
+                        {
+                            WriteProcessEventBatch(@event, false);
+                            WriteProcessEventBatch(@event, true);
+                        };
+                    };
+                    WriteProcessEventTypes();
+                    if (this.m_settings.GenerateSnapshot)
+                    {
+                        WriteSnapshot();
+                    };
                     --this.m_writer.Indent;
 
                     this.m_writer.WriteLine("private:");
                     ++this.m_writer.Indent;
                     WriteOnTimer();
+                    if (IsWritingLazyTimers())
+                    {
+                        WriteLazyTimerHelpers();
+                    };
                     WriteSetState();
+                    WriteReportError();
+                    WriteProcessErasedEvent();
+                    if (this.m_settings.BatchProcessing)
+                    {
+                        WriteBatchTraverseHelpers();
+                    };
+                    if (this.m_settings.DispatchMode == CppDispatchMode.table)
+                    {
+                        WriteTransitionTable();
+                    };
                     --this.m_writer.Indent;
                 }
                 this.m_writer.WriteLine("};");  //class
+
+                if (this.m_settings.GeneratePool)
+                {
+                    this.m_writer.WriteLine();
+                    WritePool();
+                };
+                if (this.m_settings.GenerateObjectPool)
+                {
+                    this.m_writer.WriteLine();
+                    WriteObjectPool();
+                };
+                if (this.m_settings.GenerateInbox)
+                {
+                    this.m_writer.WriteLine();
+                    WriteInbox();
+                };
                 --this.m_writer.Indent;
             };
             this.m_writer.WriteLine("}"); //namespace
         }
 
-        private void WriteSetState()
+        private void CollectActionCallbacks()
         {
-            this.m_writer.WriteLine($"void SetState({STATES_ENUM_NAME} state)");
-            this.m_writer.WriteLine("{");
+            foreach (StateDescr state in this.m_stateMachine.States.Values)
             {
-                ++this.m_writer.Indent;
-                this.m_writer.WriteLine("switch (state)");
-                this.m_writer.WriteLine("{");
+                if (state.NeedOnEnterEvent && state.OnEnterEventAlluxTargets == null)
                 {
-                    foreach (StateDescr state in this.m_stateMachine.States.Values)
+                    this.m_actionCallbacks.Add((ComposeStateEnterCallback(state), null));
+                }
+            }
+            HashSet<string> declaredEventCallbacks = new HashSet<string>();
+            foreach (StateDescr state in this.m_stateMachine.States.Values)
+            {
+                IEnumerable<EdgeDescr> edges = (state.EventEdges?.Values ?? Enumerable.Empty<EdgeDescr>()).Concat(state.TimerEdges?.Values ?? Enumerable.Empty<EdgeDescr>());
+                foreach (EdgeDescr edge in edges)
+                {
+                    foreach (EdgeTraverseCallbackType callbackType in edge.OnTraverseEventTypes)
                     {
-                        this.m_writer.WriteLine($"case {STATES_ENUM_NAME}::{state.Name}:");
-                        ++this.m_writer.Indent;
+                        string callbackName = ExportHelper.ComposeEdgeTraveseCallbackName(callbackType, state, edge, out bool needArgs, out bool isFunction);
+                        if (isFunction || !declaredEventCallbacks.Add(callbackName))
                         {
-                            WriteStateEnterCode(state);
-                            if (state.NextStateName != null)
-                            {
-                                this.m_writer.WriteLine($"SetState({STATES_ENUM_NAME}::{state.NextStateName});");
-                            }
-                            this.m_writer.WriteLine("break;");
-                        }
-                        this.m_writer.WriteLine();
-                        --this.m_writer.Indent;
-                    };
-
-                    this.m_writer.WriteLine($"default:");
-                    ++this.m_writer.Indent;
-                    {
-                        this.m_writer.WriteLine("throw std::runtime_error(\"Unexpected state \" /* + state*/);");
+                            continue;
+                        };
+                        EventDescr? @event = edge.IsTimer ? null : this.m_stateMachine.Events[edge.InvokerName];
+                        this.m_actionCallbacks.Add((callbackName, needArgs && @event != null && @event.Args.Count > 0 ? @event : null));
                     }
-                    --this.m_writer.Indent;
                 }
-                this.m_writer.WriteLine("}");
-                --this.m_writer.Indent;
             }
-            this.m_writer.WriteLine("}");
-            this.m_writer.WriteLine();
         }
 
-        private void WriteProcessEvent(EventDescr @event)
+        private bool HasActionBuffer()
         {
-            this.m_writer.Write($"void ProcessEvent__{@event.Name}(");
-            for (int i = 0; i < @event.Args.Count; ++i)
+            return this.m_actionCallbacks.Count > 0;
+        }
+
+        private void WriteTemplateHeader()
+        {
+            if (this.m_settings.CallbackMode == CppCallbackMode.handler)
             {
-                KeyValuePair<string, string> arg = @event.Args[i];
-                if (i != 0)
-                {
-                    this.m_writer.Write(", ");
-                }
-                this.m_writer.Write($"{arg.Value} {arg.Key}");
+                this.m_writer.WriteLine($"template <Timer T, class Handler>");
             }
-            this.m_writer.WriteLine(")");
+            else
+            {
+                this.m_writer.WriteLine($"template <Timer T>");
+            };
+        }
+
+        private string ComposeTemplateHeader(string timerParameter)
+        {
+            return this.m_settings.CallbackMode == CppCallbackMode.handler
+                ? $"template <Timer {timerParameter}, class H>"
+                : $"template <Timer {timerParameter}>";
+        }
+
+        private string ComposeInboxClassName()
+        {
+            return this.m_settings.ClassName + "Inbox";
+        }
+
+        private void WriteInbox()
+        {
+            //machine runs on the thread calling Drain(), events are posted from any thread through a lock-free queue.
+            //Timers are wrapped with InboxTimer, so timer fires are delivered through the same queue
+            string inboxName = ComposeInboxClassName();
+            bool handler = this.m_settings.CallbackMode == CppCallbackMode.handler;
+            string machineType = handler ? $"{this.m_settings.ClassName}<InboxTimer<T>, Handler>" : $"{this.m_settings.ClassName}<InboxTimer<T>>";
+
+            WriteTemplateHeader();
+            this.m_writer.WriteLine($"class {inboxName}");
             this.m_writer.WriteLine("{");
             {
+                this.m_writer.WriteLine("public:");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine($"using Machine = {machineType};");
+                this.m_writer.WriteLine();
+                --this.m_writer.Indent;
+
+                this.m_writer.WriteLine("private:");
                 ++this.m_writer.Indent;
-                this.m_writer.WriteLine("switch (m_currentState)");
+                this.m_writer.WriteLine("struct TimerFired");
                 this.m_writer.WriteLine("{");
-                {
-                    foreach (StateDescr state in this.m_stateMachine.States.Values)
-                    {
-                        if (state.EventEdges != null && state.EventEdges.TryGetValue(@event.Name, out EdgeDescr? edge))
-                        {
-                            this.m_writer.WriteLine($"case {STATES_ENUM_NAME}::{state.Name}:");
-                            ++this.m_writer.Indent;
-                            {
-                                WriteEdgeTraverse(state, edge, out bool throwsException);
-                                if (!throwsException)
-                                {
-                                    this.m_writer.WriteLine("break;");
-                                }
-                            }
-                            this.m_writer.WriteLine();
-                            --this.m_writer.Indent;
-                        }
-                    };
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("InboxTimer<T>* timer;");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("};");
+                this.m_writer.WriteLine();
+                List<string> alternatives = new List<string>() { "std::monostate" };
+                alternatives.AddRange(this.m_stateMachine.Events.Keys.Select(e => $"typename Machine::Events::{e}"));
+                alternatives.Add("TimerFired");
+                this.m_writer.WriteLine($"using Record = std::variant<{String.Join(", ", alternatives)}>;");
+                this.m_writer.WriteLine();
+                this.m_writer.WriteLine("MpscQueue<Record> m_queue;");
+                this.m_writer.WriteLine("const size_t m_eventsCapacity;");
+                this.m_writer.WriteLine("std::atomic<size_t> m_events{ 0 };");
+                this.m_writer.WriteLine("Machine m_machine;");
+                this.m_writer.WriteLine();
+                --this.m_writer.Indent;
 
-                    this.m_writer.WriteLine($"default:");
+                this.m_writer.WriteLine("public:");
+                ++this.m_writer.Indent;
+                //queue must be initialized before machine, as machine creates timers.
+                //Every timer has at most one fire queued, so cells are reserved for them and for the record being consumed,
+                //and a timer fire always fits, even when posted from the draining thread
+                string queueCapacity = $"capacity + {this.m_stateMachine.Timers.Count + 1}";
+                if (handler)
+                {
+                    this.m_writer.WriteLine($"{inboxName}(size_t capacity, TimerFactory<T> timerFactory, Handler& handler)");
                     ++this.m_writer.Indent;
-                    {
-                        this.m_writer.WriteLine($"throw std::runtime_error(\"Event {@event.Name} is not expected in current state \" /* + this.CurrentState*/);");
-                    }
+                    this.m_writer.WriteLine($": m_queue({queueCapacity})");
+                    this.m_writer.WriteLine(", m_eventsCapacity(capacity)");
+                    this.m_writer.WriteLine(", m_machine(WrapTimerFactory(std::move(timerFactory)), handler)");
                     --this.m_writer.Indent;
                 }
+                else
+                {
+                    this.m_writer.WriteLine($"{inboxName}(size_t capacity, TimerFactory<T> timerFactory)");
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine($": m_queue({queueCapacity})");
+                    this.m_writer.WriteLine(", m_eventsCapacity(capacity)");
+                    this.m_writer.WriteLine(", m_machine(WrapTimerFactory(std::move(timerFactory)))");
+                    --this.m_writer.Indent;
+                };
+                this.m_writer.WriteLine("{");
                 this.m_writer.WriteLine("}");
-                --this.m_writer.Indent;
-            }
-            this.m_writer.WriteLine("}");
-            this.m_writer.WriteLine();
-        }
+                this.m_writer.WriteLine();
 
-        private void WriteOnTimer()
-        {
-            this.m_writer.WriteLine($"void OnTimer(T* timer)");
-            this.m_writer.WriteLine("{");
-            {
-                ++this.m_writer.Indent;
-                this.m_writer.WriteLine("switch (m_currentState)");
+                this.m_writer.WriteLine($"{inboxName}(const {inboxName}&) = delete;");
+                this.m_writer.WriteLine($"{inboxName}& operator=(const {inboxName}&) = delete;");
+                this.m_writer.WriteLine();
+
+                //for setting up callbacks and calling Start(), only on the draining thread
+                this.m_writer.WriteLine("Machine& GetMachine()");
                 this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("return m_machine;");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine();
+
+                //may be called from any thread, returns false if capacity events are already queued
+                foreach (EventDescr @event in this.m_stateMachine.Events.Values)
                 {
-                    foreach (StateDescr state in this.m_stateMachine.States.Values)
-                    {
-                        if (state.TimerEdges != null)
-                        {
-                            this.m_writer.WriteLine($"case {STATES_ENUM_NAME}::{state.Name}:");
-                            ++this.m_writer.Indent;
-                            {
-                                foreach (EdgeDescr edge in state.TimerEdges.Values)
-                                {
-                                    this.m_writer.WriteLine($"if (timer == {edge.InvokerName})");
-                                    this.m_writer.WriteLine("{");
-                                    {
-                                        ++this.m_writer.Indent;
-                                        WriteEdgeTraverse(state, edge, out _);
-                                        --this.m_writer.Indent;
-                                    }
-                                    this.m_writer.WriteLine("}");
-                                    this.m_writer.Write("else ");
-                                }
-                                this.m_writer.WriteLine();
-                                this.m_writer.WriteLine("{");
-                                {
-                                    ++this.m_writer.Indent;
-                                    this.m_writer.WriteLine($"throw std::runtime_error(\"Unexpected timer finish in state {state.Name}\");");
-                                    --this.m_writer.Indent;
-                                }
-                                this.m_writer.WriteLine("}");
-                                this.m_writer.WriteLine("break;");
-                            }
-                            this.m_writer.WriteLine();
-                            --this.m_writer.Indent;
-                        }
-                    };
+                    string parameters = String.Join(", ", @event.Args.Select(arg => $"{arg.Value} {arg.Key}"));
+                    string args = String.Join(", ", @event.Args.Select(arg => $"std::move({arg.Key})"));
+                    this.m_writer.WriteLine($"bool Post__{@event.Name}({parameters})");
+                    this.m_writer.WriteLine("{");
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine("if (m_events.fetch_add(1, std::memory_order_relaxed) >= m_eventsCapacity)");
+                    this.m_writer.WriteLine("{");
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine("m_events.fetch_sub(1, std::memory_order_relaxed);");
+                    this.m_writer.WriteLine("return false;");
+                    --this.m_writer.Indent;
+                    this.m_writer.WriteLine("}");
+                    this.m_writer.WriteLine($"return m_queue.TryPush(Record(std::in_place_type<typename Machine::Events::{@event.Name}>, typename Machine::Events::{@event.Name}{{ {args} }}));");
+                    --this.m_writer.Indent;
+                    this.m_writer.WriteLine("}");
+                    this.m_writer.WriteLine();
+                }
 
-                    this.m_writer.WriteLine($"default:");
+                //processes up to maxEvents of posted events and timer fires, returns number of processed ones
+                this.m_writer.WriteLine("size_t Drain(size_t maxEvents = SIZE_MAX)");
+                this.m_writer.WriteLine("{");
+                {
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine("size_t processed = 0;");
+                    this.m_writer.WriteLine("while (processed < maxEvents && m_queue.TryConsume([this](Record& record) { Dispatch(record); }))");
+                    this.m_writer.WriteLine("{");
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine("++processed;");
+                    --this.m_writer.Indent;
+                    this.m_writer.WriteLine("}");
+                    this.m_writer.WriteLine("return processed;");
+                    --this.m_writer.Indent;
+                }
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine();
+                --this.m_writer.Indent;
+
+                this.m_writer.WriteLine("private:");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("TimerFactory<InboxTimer<T>> WrapTimerFactory(TimerFactory<T> timerFactory)");
+                this.m_writer.WriteLine("{");
+                {
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine("return [this, timerFactory = std::move(timerFactory)](const char* timerName, TimerFiredCallback<InboxTimer<T>> callback)");
+                    this.m_writer.WriteLine("{");
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine("return new InboxTimer<T>(timerFactory, timerName, std::move(callback), [this](InboxTimer<T>* timer) { PostTimer(timer); });");
+                    --this.m_writer.Indent;
+                    this.m_writer.WriteLine("};");
+                    --this.m_writer.Indent;
+                }
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine();
+
+                this.m_writer.WriteLine("void PostTimer(InboxTimer<T>* timer)");
+                this.m_writer.WriteLine("{");
+                {
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine("//timer fires can't be dropped, and there is always a reserved cell for them");
+                    this.m_writer.WriteLine("if (!m_queue.TryPush(Record(std::in_place_type<TimerFired>, TimerFired{ timer }))) [[unlikely]]");
+                    this.m_writer.WriteLine("{");
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine("std::terminate();");
+                    --this.m_writer.Indent;
+                    this.m_writer.WriteLine("}");
+                    --this.m_writer.Indent;
+                }
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine();
+
+                this.m_writer.WriteLine("void Dispatch(Record& record)");
+                this.m_writer.WriteLine("{");
+                {
                     ++this.m_writer.Indent;
+                    this.m_writer.WriteLine("std::visit([this](auto& item)");
+                    this.m_writer.WriteLine("{");
                     {
-                        this.m_writer.WriteLine("throw std::runtime_error(\"No timer events expected in current state\" /*+ this.CurrentState*/);");
+                        ++this.m_writer.Indent;
+                        this.m_writer.WriteLine("using Item = std::decay_t<decltype(item)>;");
+                        this.m_writer.WriteLine("if constexpr (std::is_same_v<Item, TimerFired>)");
+                        this.m_writer.WriteLine("{");
+                        ++this.m_writer.Indent;
+                        this.m_writer.WriteLine("item.timer->Fire();");
+                        --this.m_writer.Indent;
+                        this.m_writer.WriteLine("}");
+                        this.m_writer.WriteLine("else if constexpr (!std::is_same_v<Item, std::monostate>)");
+                        this.m_writer.WriteLine("{");
+                        ++this.m_writer.Indent;
+                        //the cell stays taken until the record is processed, one extra cell is reserved for that
+                        this.m_writer.WriteLine("m_events.fetch_sub(1, std::memory_order_relaxed);");
+                        if (this.m_settings.ErrorMode == CppErrorMode.status)
+                        {
+                            this.m_writer.WriteLine("if (typename Machine::Result result = m_machine.Process(std::move(item)); !result) [[unlikely]] { m_machine.ReportError(result); }");
+                        }
+                        else
+                        {
+                            this.m_writer.WriteLine("m_machine.Process(std::move(item));");
+                        };
+                        --this.m_writer.Indent;
+                        this.m_writer.WriteLine("}");
+                        --this.m_writer.Indent;
                     }
+                    this.m_writer.WriteLine("}, record);");
                     --this.m_writer.Indent;
                 }
                 this.m_writer.WriteLine("}");
                 --this.m_writer.Indent;
             }
-            this.m_writer.WriteLine("}");
-            this.m_writer.WriteLine();
+            this.m_writer.WriteLine("};");
         }
 
-        private void WriteEdgeTraverse(StateDescr state, EdgeDescr edge, out bool throwsException)
+        private void WritePool()
         {
-            foreach (EdgeTraverseCallbackType callbackType in edge.OnTraverseEventTypes)
+            //same transition code as in the class, but instance data lives in arrays indexed by handle
+            bool sharedCallbacks = this.m_sharedCallbacks;
+            this.m_sharedCallbacks = false; //pool callbacks are not per-instance anyway
+            this.m_writingPool = true;
+            try
             {
-                string callbackName = ExportHelper.ComposeEdgeTraveseCallbackName(callbackType, state, edge, out bool needArgs, out bool isFunction);
+                string poolName = this.m_settings.ClassName + "Pool";
+                string startState = $"{STATES_ENUM_NAME}::{this.m_stateMachine.StartState}";
+                string delayType = this.m_settings.CompactLayout ? "float" : "double";
 
-                if (!isFunction)
-                {
-                    //regular callback code
-                    this.m_writer.Write($"if ({callbackName}) {{ {callbackName}(");
-                    WriteEdgeTraverseCallbackArgs(needArgs, edge);
-                    this.m_writer.WriteLine("); }");
-                }
-                else
+                WriteTemplateHeader();
+                this.m_writer.WriteLine($"class {poolName}");
+                this.m_writer.WriteLine("{");
                 {
-                    //functions are for choosing next state based on result
-                    if (edge.Targets == null)
+                    this.m_writer.WriteLine("public:");
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine("using Handle = uint32_t;");
+                    //states of pooled machines are the ones of the class, so they can be passed between the two
+                    this.m_writer.WriteLine($"using {STATES_ENUM_NAME} = typename {this.m_settings.ClassName}<{(this.m_settings.CallbackMode == CppCallbackMode.handler ? "T, Handler" : "T")}>::{STATES_ENUM_NAME};");
+                    this.m_writer.WriteLine();
+                    WriteEventTypes();
+                    WriteErrorTypes();
+                    WriteCallbackEvents();
+                    --this.m_writer.Indent;
+
+                    this.m_writer.WriteLine("private:");
+                    ++this.m_writer.Indent;
+                    WriteErrorHandlerField();
+                    if (this.m_settings.CallbackMode == CppCallbackMode.handler)
                     {
-                        throw new Exception("Should not happen! Check parser!");
+                        this.m_writer.WriteLine("Handler& m_handler;");
+                    };
+                    this.m_writer.WriteLine("TimerFactory<T> m_timerFactory;");
+                    if (this.m_settings.MappedPool)
+                    {
+                        WriteMappedPoolFields(delayType);
+                    }
+                    else
+                    {
+                        this.m_writer.WriteLine($"std::vector<{STATES_ENUM_NAME}> m_states;");
+                        foreach (string timerObject in this.m_timerObjects.Keys)
+                        {
+                            this.m_writer.WriteLine($"std::vector<T*> m_timers_{timerObject};");
+                        }
+                        WritePoolTimerOwnersFields();
+                        foreach (string timer in this.m_modifiedTimers)
+                        {
+                            this.m_writer.WriteLine($"std::vector<{delayType}> m_delays_{timer};");
+                        }
                     };
+                    this.m_writer.WriteLine("std::vector<Handle> m_freeList;");
+                    this.m_writer.WriteLine();
+                    --this.m_writer.Indent;
 
-                    this.m_writer.WriteLine("{"); //visibility guard
+                    this.m_writer.WriteLine("public:");
                     ++this.m_writer.Indent;
+                    if (this.m_settings.MappedPool)
+                    {
+                        WriteMappedPoolConstructor(poolName);
+                    }
+                    else if (this.m_settings.CallbackMode == CppCallbackMode.handler)
+                    {
+                        this.m_writer.WriteLine($"{poolName}(TimerFactory<T> timerFactory, Handler& handler)");
+                        ++this.m_writer.Indent;
+                        this.m_writer.WriteLine(": m_handler(handler)");
+                        this.m_writer.WriteLine(", m_timerFactory(timerFactory)");
+                        --this.m_writer.Indent;
+                    }
+                    else
+                    {
+                        this.m_writer.WriteLine($"{poolName}(TimerFactory<T> timerFactory)");
+                        ++this.m_writer.Indent;
+                        this.m_writer.WriteLine(": m_timerFactory(timerFactory)");
+                        --this.m_writer.Indent;
+                    };
+                    if (!this.m_settings.MappedPool)
                     {
-                        this.m_writer.Write($"std::optional<{STATES_ENUM_NAME}> nextState = {callbackName}(");
-                        WriteEdgeTraverseCallbackArgs(needArgs, edge);
-                        this.m_writer.WriteLine(");");
-
-                        this.m_writer.WriteLine($"if (nextState)");
                         this.m_writer.WriteLine("{");
+                        this.m_writer.WriteLine("}");
+                        this.m_writer.WriteLine();
+                    };
+
+                    //mapped slots keep deadlines of running timers for the next process
+                    this.m_writer.WriteLine($"~{poolName}()");
+                    this.m_writer.WriteLine("{");
+                    {
                         ++this.m_writer.Indent;
+                        foreach (string timerObject in this.m_timerObjects.Keys)
                         {
-                            this.m_writer.WriteLine($"switch (*nextState)");
-                            this.m_writer.WriteLine("{");
-                            {
-                                foreach (KeyValuePair<string, EdgeTarget> subEdge in edge.Targets)
-                                {
-                                    if (subEdge.Value.TargetType == EdgeTargetType.state)
-                                    {
-                                        this.m_writer.WriteLine($"case {STATES_ENUM_NAME}::{subEdge.Value.StateName}:");
-                                        ++this.m_writer.Indent;
-                                        this.m_writer.WriteLine($"/*{subEdge.Key}*/");
-                                        this.m_writer.WriteLine($"SetState({STATES_ENUM_NAME}::{subEdge.Value.StateName});");
-                                        this.m_writer.WriteLine($"break;");
-                                        --this.m_writer.Indent;
-                                    }
-                                };
-                                this.m_writer.WriteLine($"default:");
-                                ++this.m_writer.Indent;
-                                this.m_writer.WriteLine("throw std::runtime_error(\"Unexpected target state was chosen by callback function " + callbackName + "\");");
-                                --this.m_writer.Indent;
-                            }
-                            this.m_writer.WriteLine("}"); //switch
+                            this.m_writer.WriteLine($"for (T* timer : m_timers_{timerObject}) {{ delete timer; }}");
                         }
                         --this.m_writer.Indent;
-                        this.m_writer.WriteLine("}"); //if has value
+                    }
+                    this.m_writer.WriteLine("}");
+                    this.m_writer.WriteLine();
+
+                    //timers hold callbacks bound to this pool
+                    this.m_writer.WriteLine($"{poolName}(const {poolName}&) = delete;");
+                    this.m_writer.WriteLine($"{poolName}& operator=(const {poolName}&) = delete;");
+                    this.m_writer.WriteLine();
 
+                    if (this.m_settings.MappedPool)
+                    {
+                        WriteMappedPoolAllocateFree(poolName);
                     }
+                    else
+                    {
+                        WritePoolAllocateFree(poolName, startState);
+                    };
+
+                    this.m_writer.WriteLine($"{STATES_ENUM_NAME} GetCurrentState(Handle handle) const");
+                    this.m_writer.WriteLine("{");
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine($"return {ComposeStateVariable()};");
                     --this.m_writer.Indent;
-                    this.m_writer.WriteLine("}"); //visibility guard
-                }
-            };
+                    this.m_writer.WriteLine("}");
+                    this.m_writer.WriteLine();
 
-            throwsException = false;
-            //only happens in case of no function
-            if (edge.Target != null)
-            {
-                switch (edge.Target.TargetType)
-                {
-                case EdgeTargetType.state:
-                    this.m_writer.WriteLine($"SetState({STATES_ENUM_NAME}::{edge.Target.StateName});");
-                    break;
-                case EdgeTargetType.failure:
-                    this.m_writer.WriteLine($"throw std::runtime_error(\"Event {edge.InvokerName} is forbidden in current state\");");
-                    throwsException = true;
-                    break;
-                case EdgeTargetType.no_change:
-                    //notnhing to do
-                    break;
-                default:
-                    throw new Exception("Unexpected type " + edge.Target.TargetType);
+                    if (!this.m_settings.MappedPool)
+                    {
+                        //dense states of all the slots, including free ones
+                        this.m_writer.WriteLine($"std::span<const {STATES_ENUM_NAME}> GetStates() const");
+                        this.m_writer.WriteLine("{");
+                        ++this.m_writer.Indent;
+                        this.m_writer.WriteLine("return m_states;");
+                        --this.m_writer.Indent;
+                        this.m_writer.WriteLine("}");
+                        this.m_writer.WriteLine();
+                    };
+
+                    WriteStart();
+                    foreach (EventDescr @event in this.m_stateMachine.Events.Values)
+                    {
+                        WriteProcessEvent(@event);
+                    };
+                    WriteProcessEventTypes();
+                    if (this.m_settings.GenerateSnapshot)
+                    {
+                        WriteSnapshot();
+                    };
+                    --this.m_writer.Indent;
+
+                    this.m_writer.WriteLine("private:");
+                    ++this.m_writer.Indent;
+                    if (this.m_settings.MappedPool)
+                    {
+                        WriteMappedPoolCreateTimers(poolName);
+                    };
+                    WriteOnTimer();
+                    WriteSetState();
+                    WriteReportError();
+                    WriteProcessErasedEvent();
+                    --this.m_writer.Indent;
                 }
+                this.m_writer.WriteLine("};");  //class
+            }
+            finally
+            {
+                this.m_writingPool = false;
+                this.m_sharedCallbacks = sharedCallbacks;
             }
         }
 
-        private void WriteEdgeTraverseCallbackArgs(bool needArgs, EdgeDescr edge)
+        private void WriteObjectPool()
         {
-            if (needArgs)
+            //released machines are kept on a free list and handed out again, so a warmed up pool doesn't allocate
+            string poolName = this.m_settings.ClassName + "ObjectPool";
+            bool handler = this.m_settings.CallbackMode == CppCallbackMode.handler;
+            List<(string parameter, string field, string initializer, string arg)> machineArgs = new List<(string, string, string, string)>();
+            if (!this.m_settings.CompactLayout)
             {
-                EventDescr @event = this.m_stateMachine.Events[edge.InvokerName];
-                for (int i = 0; i < @event.Args.Count; ++i)
-                {
-                    KeyValuePair<string, string> arg = @event.Args[i];
-                    if (i != 0)
-                    {
-                        this.m_writer.Write(", ");
-                    }
-                    this.m_writer.Write(arg.Key);
-                }
+                machineArgs.Add(("TimerFactory<T> timerFactory", "TimerFactory<T> m_timerFactory;", "m_timerFactory(std::move(timerFactory))", "m_timerFactory"));
+            };
+            if (handler)
+            {
+                machineArgs.Add(("Handler& handler", "Handler& m_handler;", "m_handler(handler)", "m_handler"));
             }
-        }
+            else if (this.m_sharedCallbacks)
+            {
+                machineArgs.Add(("const typename Machine::Callbacks& callbacks", "const typename Machine::Callbacks& m_callbacks;", "m_callbacks(callbacks)", "m_callbacks"));
+                machineArgs.Add(("void* context", "void* m_context;", "m_context(context)", "m_context"));
+            };
 
-        private void WriteStart()
-        {
-            this.m_writer.WriteLine($"void Start()");
+            WriteTemplateHeader();
+            this.m_writer.WriteLine($"class {poolName}");
             this.m_writer.WriteLine("{");
             {
+                this.m_writer.WriteLine("public:");
                 ++this.m_writer.Indent;
-                WriteStateEnterCode(this.m_stateMachine.States[this.m_stateMachine.StartState]);
+                this.m_writer.WriteLine($"using Machine = {this.m_settings.ClassName}<{(handler ? "T, Handler" : "T")}>;");
+                this.m_writer.WriteLine("using Setup = std::function<void(Machine& machine)>; //called once for every created machine, e.g. to bind callbacks");
+                this.m_writer.WriteLine();
                 --this.m_writer.Indent;
-            }
-            this.m_writer.WriteLine("}");
-            this.m_writer.WriteLine();
-        }
-
-        private void WriteStateEnterCode(StateDescr state)
-        {
-            this.m_writer.WriteLine($"m_currentState = {STATES_ENUM_NAME}::{state.Name};");
 
-            foreach (string timer in state.StopTimers)
-            {
-                this.m_writer.WriteLine($"{timer}->Stop();");
-            }
-            foreach (TimerStartDescr timerStart in state.StartTimers.Values)
-            {
-                if (this.m_modifiedTimers.Contains(timerStart.TimerName))
-                {
-                    string delayVariable = ComposeTimerDelayVariable(timerStart.TimerName);
-                    if (timerStart.Modify != null)
-                    {
-                        if (timerStart.Modify.set != null)
-                        {
-                            this.m_writer.WriteLine($"{delayVariable} = {timerStart.Modify.set.Value.ToString(CultureInfo.InvariantCulture)};");
-                        }
-                        else
-                        {
-                            if (timerStart.Modify.multiplier != null)
-                            {
-                                this.m_writer.WriteLine($"{delayVariable} *= {timerStart.Modify.multiplier.Value.ToString(CultureInfo.InvariantCulture)};");
-                            };
-                            if (timerStart.Modify.increment != null)
-                            {
-                                this.m_writer.WriteLine($"{delayVariable} += {timerStart.Modify.increment.Value.ToString(CultureInfo.InvariantCulture)};");
-                            };
-                            if (timerStart.Modify.min != null)
-                            {
-                                this.m_writer.WriteLine($"if ({delayVariable} < {timerStart.Modify.min.Value.ToString(CultureInfo.InvariantCulture)}) {{ {delayVariable} = {timerStart.Modify.min.Value.ToString(CultureInfo.InvariantCulture)}; }}");
-                            };
-                            if (timerStart.Modify.max != null)
-                            {
-                                this.m_writer.WriteLine($"if ({delayVariable} > {timerStart.Modify.max.Value.ToString(CultureInfo.InvariantCulture)}) {{ {delayVariable} = {timerStart.Modify.max.Value.ToString(CultureInfo.InvariantCulture)}; }}");
-                            };
-                        };
-                    };
-                    this.m_writer.WriteLine($"{timerStart.TimerName}->StartOrReset({delayVariable});");
-                }
-                else
+                this.m_writer.WriteLine("private:");
+                ++this.m_writer.Indent;
+                foreach ((string parameter, string field, string initializer, string arg) machineArg in machineArgs)
                 {
-                    TimerDescr descr = this.m_stateMachine.Timers[timerStart.TimerName];
-                    this.m_writer.WriteLine($"{timerStart.TimerName}->StartOrReset({descr.IntervalSeconds.ToString(CultureInfo.InvariantCulture)});");
+                    this.m_writer.WriteLine(machineArg.field);
                 }
-            }
+                this.m_writer.WriteLine("Setup m_setup;");
+                this.m_writer.WriteLine("std::vector<std::unique_ptr<Machine>> m_machines;");
+                this.m_writer.WriteLine("std::vector<Machine*> m_freeList;");
+                this.m_writer.WriteLine();
+                --this.m_writer.Indent;
 
-            if (state.NeedOnEnterEvent)
-            {
-                string callbackName = ComposeStateEnterCallback(state);
-                if (state.OnEnterEventAlluxTargets == null)
+                this.m_writer.WriteLine("public:");
+                ++this.m_writer.Indent;
+                List<string> parameters = machineArgs.Select(a => a.parameter).ToList();
+                parameters.Add("Setup setup = {}");
+                this.m_writer.WriteLine($"{poolName}({String.Join(", ", parameters)})");
+                ++this.m_writer.Indent;
+                List<string> initializers = machineArgs.Select(a => a.initializer).ToList();
+                initializers.Add("m_setup(std::move(setup))");
+                for (int i = 0; i < initializers.Count; ++i)
                 {
-                    //regular plain callback
-                    this.m_writer.WriteLine($"if ({callbackName}) {{ {callbackName}(); }}");
+                    this.m_writer.WriteLine((i == 0 ? ": " : ", ") + initializers[i]);
                 }
-                else
-                {
-                    this.m_writer.WriteLine("{"); //visibility guard
-                    ++this.m_writer.Indent;
-                    {
-                        this.m_writer.WriteLine($"std::optional<{STATES_ENUM_NAME}> nextState = {callbackName}();");
-                        this.m_writer.WriteLine($"if (nextState)");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("{");
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine();
+
+                this.m_writer.WriteLine($"{poolName}(const {poolName}&) = delete;");
+                this.m_writer.WriteLine($"{poolName}& operator=(const {poolName}&) = delete;");
+                this.m_writer.WriteLine();
+
+                //machine is not started, same as a newly constructed one
+                this.m_writer.WriteLine("Machine& Acquire()");
+                this.m_writer.WriteLine("{");
+                {
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine("if (m_freeList.empty())");
+                    this.m_writer.WriteLine("{");
+                    {
+                        ++this.m_writer.Indent;
+                        this.m_writer.WriteLine($"m_machines.push_back(std::make_unique<Machine>({String.Join(", ", machineArgs.Select(a => a.arg))}));");
+                        this.m_writer.WriteLine("if (m_setup)");
                         this.m_writer.WriteLine("{");
                         ++this.m_writer.Indent;
+                        this.m_writer.WriteLine("m_setup(*m_machines.back());");
+                        --this.m_writer.Indent;
+                        this.m_writer.WriteLine("}");
+                        this.m_writer.WriteLine("return *m_machines.back();");
+                        --this.m_writer.Indent;
+                    }
+                    this.m_writer.WriteLine("}");
+                    this.m_writer.WriteLine("Machine* machine = m_freeList.back();");
+                    this.m_writer.WriteLine("m_freeList.pop_back();");
+                    this.m_writer.WriteLine("return *machine;");
+                    --this.m_writer.Indent;
+                }
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine();
+
+                //machine must have been acquired from this pool. Its timers are stopped, so it's not used until acquired again
+                this.m_writer.WriteLine("void Release(Machine& machine)");
+                this.m_writer.WriteLine("{");
+                {
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine("machine.Reset();");
+                    this.m_writer.WriteLine("m_freeList.push_back(&machine);");
+                    --this.m_writer.Indent;
+                }
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine();
+
+                this.m_writer.WriteLine("size_t GetCreatedCount() const");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("return m_machines.size();");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine();
+
+                this.m_writer.WriteLine("size_t GetFreeCount() const");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("return m_freeList.size();");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("};");  //class
+        }
+
+        private void WritePoolAllocateFree(string poolName, string startState)
+        {
+            //slots of freed machines are reused along with their timers, so there are no allocations once the pool is warmed up
+            this.m_writer.WriteLine("Handle Allocate()");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("if (m_freeList.empty())");
+                this.m_writer.WriteLine("{");
+                {
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine("const Handle handle = static_cast<Handle>(m_states.size());");
+                    this.m_writer.WriteLine($"m_states.push_back({startState});");
+                    foreach (string timerObject in this.m_timerObjects.Keys)
+                    {
+                        this.m_writer.WriteLine($"m_timers_{timerObject}.push_back(m_timerFactory(\"{timerObject}\", std::bind(&{poolName}::OnTimer, this, handle, std::placeholders::_1)));");
+                        if (IsSharedTimerObject(timerObject))
                         {
-                            this.m_writer.WriteLine($"switch (*nextState)");
-                            this.m_writer.WriteLine("{");
-                            {
-                                foreach (KeyValuePair<string, EdgeTarget> subEdge in state.OnEnterEventAlluxTargets)
-                                {
-                                    if (subEdge.Value.TargetType == EdgeTargetType.state)
-                                    {
-                                        this.m_writer.WriteLine($"case {STATES_ENUM_NAME}::{subEdge.Value.StateName}:");
-                                        ++this.m_writer.Indent;
-                                        this.m_writer.WriteLine($"/*{subEdge.Key}*/");
-                                        this.m_writer.WriteLine($"SetState({STATES_ENUM_NAME}::{subEdge.Value.StateName});");
-                                        this.m_writer.WriteLine($"break;");
-                                        --this.m_writer.Indent;
-                                    }
-                                };
-                                this.m_writer.WriteLine($"default:");
-                                ++this.m_writer.Indent;
-                                this.m_writer.WriteLine("throw std::runtime_error(\"Unexpected target state was chosen by callback function " + callbackName + "\");");
-                                --this.m_writer.Indent;
-                            }
-                            this.m_writer.WriteLine("}"); //switch
-                        }
+                            this.m_writer.WriteLine($"m_owners_{timerObject}.push_back(0);");
+                        };
+                    }
+                    foreach (string timer in this.m_modifiedTimers)
+                    {
+                        this.m_writer.WriteLine($"m_delays_{timer}.push_back({this.m_stateMachine.Timers[timer].IntervalSeconds.ToString(CultureInfo.InvariantCulture)});");
+                    }
+                    this.m_writer.WriteLine("return handle;");
+                    --this.m_writer.Indent;
+                }
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine("const Handle handle = m_freeList.back();");
+                this.m_writer.WriteLine("m_freeList.pop_back();");
+                this.m_writer.WriteLine($"m_states[handle] = {startState};");
+                foreach (string timer in this.m_modifiedTimers)
+                {
+                    this.m_writer.WriteLine($"m_delays_{timer}[handle] = {this.m_stateMachine.Timers[timer].IntervalSeconds.ToString(CultureInfo.InvariantCulture)};");
+                }
+                this.m_writer.WriteLine("return handle;");
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+
+            this.m_writer.WriteLine("void Free(Handle handle)");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                foreach (string timer in this.m_stateMachine.Timers.Keys)
+                {
+                    WriteTimerStop(timer);
+                }
+                this.m_writer.WriteLine("m_freeList.push_back(handle);");
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        private void WriteMappedPoolFields(string delayType)
+        {
+            this.m_writer.WriteLine($"static constexpr uint64_t SCHEMA_HASH = 0x{ComputeSchemaHash():x16}; //of states and timers, file of another schema is recreated");
+            this.m_writer.WriteLine();
+            //ordered by decreasing alignment to avoid padding, delays and state are laid out as in the class
+            this.m_writer.WriteLine("struct Slot");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                foreach (string timer in this.m_stateMachine.Timers.Keys)
+                {
+                    this.m_writer.WriteLine($"double {timer}_deadline = 0; //monotonic seconds, 0 if stopped");
+                }
+                WriteDelayAndStateFields(delayType);
+                this.m_writer.WriteLine("bool allocated = false;");
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("};");
+            this.m_writer.WriteLine("static_assert(std::is_trivially_copyable_v<Slot>);");
+            this.m_writer.WriteLine();
+            this.m_writer.WriteLine("MappedPoolFile m_file;");
+            this.m_writer.WriteLine("Slot* m_slots;");
+            foreach (string timerObject in this.m_timerObjects.Keys)
+            {
+                this.m_writer.WriteLine($"std::vector<T*> m_timers_{timerObject}; //created on first allocation of the slot");
+            }
+            WritePoolTimerOwnersFields();
+        }
+
+        private void WritePoolTimerOwnersFields()
+        {
+            foreach (string timerObject in this.m_timerObjects.Keys.Where(o => IsSharedTimerObject(o)))
+            {
+                this.m_writer.WriteLine($"std::vector<uint8_t> m_owners_{timerObject}; //{String.Join(", ", this.m_timerObjects[timerObject])}");
+            }
+        }
+
+        private void WriteMappedPoolConstructor(string poolName)
+        {
+            if (this.m_settings.CallbackMode == CppCallbackMode.handler)
+            {
+                this.m_writer.WriteLine($"{poolName}(const char* fileName, Handle capacity, TimerFactory<T> timerFactory, Handler& handler)");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine(": m_handler(handler)");
+                this.m_writer.WriteLine(", m_timerFactory(timerFactory)");
+            }
+            else
+            {
+                this.m_writer.WriteLine($"{poolName}(const char* fileName, Handle capacity, TimerFactory<T> timerFactory)");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine(": m_timerFactory(timerFactory)");
+            };
+            this.m_writer.WriteLine(", m_file(fileName, sizeof(Slot), SCHEMA_HASH, capacity)");
+            this.m_writer.WriteLine(", m_slots(static_cast<Slot*>(m_file.GetSlots()))");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("const Handle slotsCount = static_cast<Handle>(m_file.GetCapacity());");
+                foreach (string timerObject in this.m_timerObjects.Keys)
+                {
+                    this.m_writer.WriteLine($"m_timers_{timerObject}.resize(slotsCount, nullptr);");
+                    if (IsSharedTimerObject(timerObject))
+                    {
+                        this.m_writer.WriteLine($"m_owners_{timerObject}.resize(slotsCount, 0);");
+                    };
+                }
+                if (this.m_stateMachine.Timers.Count > 0)
+                {
+                    this.m_writer.WriteLine("const double now = GetMonotonicSeconds();");
+                };
+                //machines of the previous process go on right where they were, timers fire at the same deadlines
+                this.m_writer.WriteLine("for (Handle handle = slotsCount; handle-- > 0;)");
+                this.m_writer.WriteLine("{");
+                {
+                    ++this.m_writer.Indent;
+                    //a slot with a state out of range can't be resumed, and is freed
+                    this.m_writer.WriteLine($"if (!m_slots[handle].allocated || static_cast<size_t>(m_slots[handle].m_currentState) >= {this.m_stateMachine.States.Count})");
+                    this.m_writer.WriteLine("{");
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine("m_slots[handle].allocated = false;");
+                    this.m_writer.WriteLine("m_freeList.push_back(handle);");
+                    this.m_writer.WriteLine("continue;");
+                    --this.m_writer.Indent;
+                    this.m_writer.WriteLine("}");
+                    if (this.m_stateMachine.Timers.Count > 0)
+                    {
+                        this.m_writer.WriteLine("CreateTimers(handle);");
+                    };
+                    foreach (string timer in this.m_stateMachine.Timers.Keys)
+                    {
+                        //remaining time never exceeds the delay, which also covers monotonic clock reset by reboot
+                        string delay = this.m_modifiedTimers.Contains(timer)
+                            ? $"static_cast<double>({ComposeTimerDelayAccess(timer)})"
+                            : this.m_stateMachine.Timers[timer].IntervalSeconds.ToString("0.0###############", CultureInfo.InvariantCulture);
+                        this.m_writer.WriteLine($"if (m_slots[handle].{timer}_deadline != 0)");
+                        this.m_writer.WriteLine("{");
+                        ++this.m_writer.Indent;
+                        WriteTimerOwnerAssignment(timer);
+                        this.m_writer.WriteLine($"{ComposeTimerAccess(timer)}StartOrReset(std::clamp(m_slots[handle].{timer}_deadline - now, 0.0, {delay}));");
                         --this.m_writer.Indent;
-                        this.m_writer.WriteLine("}"); //if has value
+                        this.m_writer.WriteLine("}");
                     }
                     --this.m_writer.Indent;
-                    this.m_writer.WriteLine("}"); //visibility guard
                 }
+                this.m_writer.WriteLine("}");
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+
+            //false if the file was created anew, including when it was written for another version of the state machine
+            this.m_writer.WriteLine("bool IsResumed() const");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            this.m_writer.WriteLine("return m_file.IsResumed();");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+
+            this.m_writer.WriteLine("Handle GetCapacity() const");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            this.m_writer.WriteLine("return static_cast<Handle>(m_file.GetCapacity());");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+
+            //slots already survive a crash of the process, this is for a crash of the system
+            this.m_writer.WriteLine("void Sync()");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            this.m_writer.WriteLine("m_file.Sync();");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        private void WriteMappedPoolAllocateFree(string poolName)
+        {
+            //capacity is fixed, as machines point into the mapping
+            this.m_writer.WriteLine("Handle Allocate()");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("if (m_freeList.empty())");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine($"throw std::length_error(\"{poolName} is full\");");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine("const Handle handle = m_freeList.back();");
+                this.m_writer.WriteLine("m_freeList.pop_back();");
+                if (this.m_stateMachine.Timers.Count > 0)
+                {
+                    this.m_writer.WriteLine($"if (m_timers_{this.m_timerObjects.Keys.First()}[handle] == nullptr)");
+                    this.m_writer.WriteLine("{");
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine("CreateTimers(handle);");
+                    --this.m_writer.Indent;
+                    this.m_writer.WriteLine("}");
+                };
+                this.m_writer.WriteLine("Slot& slot = m_slots[handle];");
+                this.m_writer.WriteLine("slot = Slot{};");
+                this.m_writer.WriteLine("slot.allocated = true;");
+                this.m_writer.WriteLine("return handle;");
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+
+            this.m_writer.WriteLine("void Free(Handle handle)");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                foreach (string timer in this.m_stateMachine.Timers.Keys)
+                {
+                    WriteTimerStop(timer);
+                }
+                this.m_writer.WriteLine("m_slots[handle].allocated = false;");
+                this.m_writer.WriteLine("m_freeList.push_back(handle);");
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        private void WriteMappedPoolCreateTimers(string poolName)
+        {
+            if (this.m_stateMachine.Timers.Count == 0)
+            {
+                return;
+            };
+            this.m_writer.WriteLine("void CreateTimers(Handle handle)");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                foreach (KeyValuePair<string, List<string>> timerObject in this.m_timerObjects)
+                {
+                    //only the timer the object is started for has a deadline
+                    string clearDeadlines = String.Join(" ", timerObject.Value.Select(t => $"m_slots[handle].{t}_deadline = 0;"));
+                    this.m_writer.WriteLine($"m_timers_{timerObject.Key}[handle] = m_timerFactory(\"{timerObject.Key}\", [this, handle](T* timer) {{ {clearDeadlines} OnTimer(handle, timer); }});");
+                }
+                --this.m_writer.Indent;
             }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        private int GetSnapshotStateSize()
+        {
+            int count = this.m_stateMachine.States.Count;
+            return count <= Byte.MaxValue + 1 ? 1 : count <= UInt16.MaxValue + 1 ? 2 : 4;
+        }
+
+        private int ComputeSnapshotRecordSize()
+        {
+            //state, bits of active timers, float remaining times, then delays as they are stored
+            int delaySize = this.m_settings.CompactLayout ? sizeof(float) : sizeof(double);
+            int timersCount = this.m_stateMachine.Timers.Count;
+            return GetSnapshotStateSize() + (timersCount + 7) / 8 + timersCount * sizeof(float) + this.m_modifiedTimers.Count * delaySize;
+        }
+
+        private ulong ComputeSchemaHash()
+        {
+            //any change of states, timers or their delay modifications makes older snapshots and pool files unusable
+            return ExportHelper.ComputeFnv1aHash(String.Join("\n", this.m_stateMachine.States.Keys)
+                + "\n\n" + String.Join("\n", this.m_stateMachine.Timers.Keys)
+                + "\n\n" + String.Join("\n", this.m_stateMachine.Timers.Keys.Where(t => this.m_modifiedTimers.Contains(t)))
+                + "\n\n" + (this.m_settings.CompactLayout ? "float" : "double"));
         }
 
-        private string ComposeTimerDelayVariable(string timerName)
+        private void WriteSnapshot()
+        {
+            string delayType = this.m_settings.CompactLayout ? "float" : "double";
+            List<string> timers = this.m_stateMachine.Timers.Keys.ToList();
+            List<string> modifiedTimers = timers.Where(t => this.m_modifiedTimers.Contains(t)).ToList();
+
+            this.m_writer.WriteLine("//state and timers of a machine, without callbacks");
+            this.m_writer.WriteLine("struct SnapshotData");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine($"{STATES_ENUM_NAME} state;");
+                foreach (string timer in timers)
+                {
+                    this.m_writer.WriteLine($"TimerSnapshot {timer};");
+                }
+                foreach (string timer in modifiedTimers)
+                {
+                    this.m_writer.WriteLine($"{delayType} {timer}_delay;");
+                }
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("};");
+            this.m_writer.WriteLine("static_assert(std::is_trivially_copyable_v<SnapshotData>);");
+            this.m_writer.WriteLine();
+
+            this.m_writer.WriteLine("static constexpr uint32_t SNAPSHOT_VERSION = 1;");
+            this.m_writer.WriteLine($"static constexpr uint32_t SNAPSHOT_RECORD_SIZE = {ComputeSnapshotRecordSize()};");
+            this.m_writer.WriteLine($"static constexpr uint64_t SNAPSHOT_SCHEMA_HASH = 0x{ComputeSchemaHash():x16}; //of states and timers, checked by decoder");
+            this.m_writer.WriteLine();
+
+            this.m_writer.WriteLine($"SnapshotData Snapshot({ComposeInstanceParameters("")}) requires SnapshotTimer<T>");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("SnapshotData snapshot{};");
+                this.m_writer.WriteLine($"snapshot.state = {ComposeStateVariable()};");
+                foreach (string timer in timers)
+                {
+                    this.m_writer.WriteLine($"if ({ComposeTimerIsActive(timer)})");
+                    this.m_writer.WriteLine("{");
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine($"snapshot.{timer} = {{ true, static_cast<float>({ComposeTimerAccess(timer)}GetRemainingSeconds()) }};");
+                    --this.m_writer.Indent;
+                    this.m_writer.WriteLine("}");
+                }
+                foreach (string timer in modifiedTimers)
+                {
+                    this.m_writer.WriteLine($"snapshot.{timer}_delay = {ComposeTimerDelayAccess(timer)};");
+                }
+                this.m_writer.WriteLine("return snapshot;");
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+
+            //no callbacks are invoked, as the machine has already entered the state before the snapshot was taken
+            this.m_writer.WriteLine("//timers are restarted for their remaining time, on_enter callbacks are not invoked");
+            this.m_writer.WriteLine($"void Restore({ComposeInstanceParameters("const SnapshotData& snapshot")})");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine($"{ComposeStateVariable()} = snapshot.state;");
+                foreach (string timer in modifiedTimers)
+                {
+                    this.m_writer.WriteLine($"{ComposeTimerDelayAccess(timer)} = snapshot.{timer}_delay;");
+                }
+                foreach (string timer in timers)
+                {
+                    this.m_writer.WriteLine($"if (snapshot.{timer}.active)");
+                    this.m_writer.WriteLine("{");
+                    ++this.m_writer.Indent;
+                    WriteTimerStart(timer, $"snapshot.{timer}.remainingSeconds");
+                    --this.m_writer.Indent;
+                    this.m_writer.WriteLine("}");
+                    this.m_writer.WriteLine("else");
+                    this.m_writer.WriteLine("{");
+                    ++this.m_writer.Indent;
+                    WriteTimerStop(timer);
+                    --this.m_writer.Indent;
+                    this.m_writer.WriteLine("}");
+                }
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+
+            this.m_writer.WriteLine("//appends header and a fixed size record per snapshot to the buffer");
+            this.m_writer.WriteLine("static void EncodeSnapshots(std::span<const SnapshotData> snapshots, std::vector<uint8_t>& buffer)");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("const size_t offset = buffer.size();");
+                this.m_writer.WriteLine("buffer.resize(offset + SNAPSHOT_HEADER_SIZE + snapshots.size() * SNAPSHOT_RECORD_SIZE);");
+                this.m_writer.WriteLine("SnapshotWriter writer(buffer.data() + offset);");
+                this.m_writer.WriteLine("writer.WriteHeader(SNAPSHOT_VERSION, SNAPSHOT_RECORD_SIZE, SNAPSHOT_SCHEMA_HASH, snapshots.size());");
+                this.m_writer.WriteLine("for (const SnapshotData& snapshot : snapshots)");
+                this.m_writer.WriteLine("{");
+                {
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine($"writer.Write(static_cast<uint64_t>(snapshot.state), {GetSnapshotStateSize()});");
+                    for (int i = 0; i < timers.Count; i += 8)
+                    {
+                        IEnumerable<string> bits = timers.Skip(i).Take(8).Select((timer, bit) => bit == 0
+                            ? $"static_cast<uint64_t>(snapshot.{timer}.active)"
+                            : $"static_cast<uint64_t>(snapshot.{timer}.active) << {bit}");
+                        this.m_writer.WriteLine($"writer.Write({String.Join(" | ", bits)}, 1);");
+                    }
+                    foreach (string timer in timers)
+                    {
+                        this.m_writer.WriteLine($"writer.Write(snapshot.{timer}.remainingSeconds);");
+                    }
+                    foreach (string timer in modifiedTimers)
+                    {
+                        this.m_writer.WriteLine($"writer.Write(snapshot.{timer}_delay);");
+                    }
+                    --this.m_writer.Indent;
+                }
+                this.m_writer.WriteLine("}");
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+
+            this.m_writer.WriteLine("//appends decoded snapshots, returns false and leaves the result intact if data was encoded for other version of the state machine or is malformed");
+            this.m_writer.WriteLine("static bool DecodeSnapshots(std::span<const uint8_t> data, std::vector<SnapshotData>& result)");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("size_t count = 0;");
+                this.m_writer.WriteLine("if (!ReadSnapshotHeader(data, SNAPSHOT_VERSION, SNAPSHOT_RECORD_SIZE, SNAPSHOT_SCHEMA_HASH, count))");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("return false;");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine("const size_t offset = result.size();");
+                this.m_writer.WriteLine("result.resize(offset + count);");
+                this.m_writer.WriteLine("SnapshotReader reader(data.data() + SNAPSHOT_HEADER_SIZE);");
+                this.m_writer.WriteLine("for (size_t i = 0; i < count; ++i)");
+                this.m_writer.WriteLine("{");
+                {
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine("SnapshotData& snapshot = result[offset + i];");
+                    this.m_writer.WriteLine($"const uint64_t state = reader.Read({GetSnapshotStateSize()});");
+                    this.m_writer.WriteLine($"if (state >= {this.m_stateMachine.States.Count})");
+                    this.m_writer.WriteLine("{");
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine("result.resize(offset);");
+                    this.m_writer.WriteLine("return false;");
+                    --this.m_writer.Indent;
+                    this.m_writer.WriteLine("}");
+                    this.m_writer.WriteLine($"snapshot.state = static_cast<{STATES_ENUM_NAME}>(state);");
+                    for (int i = 0; i < timers.Count; i += 8)
+                    {
+                        string bitsVariable = $"active{i / 8}";
+                        this.m_writer.WriteLine($"const uint64_t {bitsVariable} = reader.Read(1);");
+                        for (int bit = 0; bit < 8 && i + bit < timers.Count; ++bit)
+                        {
+                            this.m_writer.WriteLine($"snapshot.{timers[i + bit]}.active = ({bitsVariable} & {1 << bit}) != 0;");
+                        }
+                    }
+                    foreach (string timer in timers)
+                    {
+                        this.m_writer.WriteLine($"snapshot.{timer}.remainingSeconds = reader.ReadFloat();");
+                    }
+                    foreach (string timer in modifiedTimers)
+                    {
+                        this.m_writer.WriteLine($"snapshot.{timer}_delay = reader.Read{(this.m_settings.CompactLayout ? "Float" : "Double")}();");
+                    }
+                    --this.m_writer.Indent;
+                }
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine("return true;");
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        private string ComposeStatsClassName()
+        {
+            return this.m_settings.ClassName + "Stats";
+        }
+
+        private void WriteStats()
+        {
+            string className = ComposeStatsClassName();
+            bool latency = this.m_settings.Instrumentation == CppInstrumentation.latency;
+
+            //not a member of the machine class, so that template instantiations and the pool share the same counters
+            this.m_writer.WriteLine($"//statistics of all {this.m_settings.ClassName} machines, every thread counts into its own cache line aligned block");
+            this.m_writer.WriteLine($"struct {className}");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            {
+                this.m_writer.WriteLine($"static constexpr size_t STATES_COUNT = {this.m_stateMachine.States.Count};");
+                this.m_writer.WriteLine($"static constexpr size_t EVENTS_COUNT = {this.m_stateMachine.Events.Count};");
+                this.m_writer.WriteLine($"static constexpr size_t INVOKERS_COUNT = {this.m_invokers.Count}; //events, then timers");
+                if (latency)
+                {
+                    this.m_writer.WriteLine($"static constexpr size_t CALLBACKS_COUNT = {this.m_latencyCallbacks.Count};");
+                };
+                this.m_writer.WriteLine();
+                WriteStatsNames("s_stateNames", "STATES_COUNT", this.m_stateMachine.States.Keys);
+                WriteStatsNames("s_invokerNames", "INVOKERS_COUNT", this.m_invokers);
+                if (latency)
+                {
+                    WriteStatsNames("s_callbackNames", "CALLBACKS_COUNT", this.m_latencyCallbacks);
+                };
+                this.m_writer.WriteLine();
+
+                this.m_writer.WriteLine("struct alignas(64) Counters");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                WriteStatsFields("StatCounter", "LatencyCounters", "");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("};");
+                this.m_writer.WriteLine();
+
+                WriteStatsFields("uint64_t", "LatencyHistogram", "{}");
+                this.m_writer.WriteLine();
+
+                this.m_writer.WriteLine($"void Merge(const {className}& other)");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("Accumulate(*this, other);");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine();
+
+                this.m_writer.WriteLine("//sums counters of all the threads, including finished ones");
+                this.m_writer.WriteLine($"static {className} Snapshot()");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine($"{className} result;");
+                this.m_writer.WriteLine("Registry().ForEach([&result](const Counters& counters) { Accumulate(result, counters); });");
+                this.m_writer.WriteLine("return result;");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine();
+
+                this.m_writer.WriteLine("//counters of the calling thread");
+                this.m_writer.WriteLine("static Counters& Local()");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("thread_local Counters& local = Registry().Add();");
+                this.m_writer.WriteLine("return local;");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine();
+            }
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("private:");
+            ++this.m_writer.Indent;
+            {
+                this.m_writer.WriteLine("template<class From>");
+                this.m_writer.WriteLine($"static void Accumulate({className}& to, const From& from)");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                foreach (string field in new[] { "stateEnters", "transitions", "notExpected", "forbidden", "unexpectedTimers" })
+                {
+                    this.m_writer.WriteLine($"AccumulateStats(to.{field}, from.{field});");
+                }
+                if (latency)
+                {
+                    this.m_writer.WriteLine("AccumulateStats(to.callbacks, from.callbacks);");
+                };
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine();
+
+                this.m_writer.WriteLine("static ThreadRegistry<Counters>& Registry()");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("//never destroyed, as threads may still count after static objects are gone");
+                this.m_writer.WriteLine("static ThreadRegistry<Counters>* registry = new ThreadRegistry<Counters>();");
+                this.m_writer.WriteLine("return *registry;");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+            }
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("};");
+            this.m_writer.WriteLine();
+        }
+
+        private void WriteStatsNames(string name, string count, IEnumerable<string> values)
+        {
+            this.m_writer.WriteLine($"static constexpr std::array<const char*, {count}> {name} = {{");
+            ++this.m_writer.Indent;
+            foreach (string value in values)
+            {
+                this.m_writer.WriteLine($"\"{value}\",");
+            }
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("};");
+        }
+
+        private void WriteStatsFields(string counterType, string latencyType, string initializer)
+        {
+            this.m_writer.WriteLine($"std::array<{counterType}, STATES_COUNT> stateEnters{initializer};");
+            this.m_writer.WriteLine($"std::array<std::array<{counterType}, INVOKERS_COUNT>, STATES_COUNT> transitions{initializer}; //[state][event or timer]");
+            this.m_writer.WriteLine($"std::array<{counterType}, EVENTS_COUNT> notExpected{initializer};");
+            this.m_writer.WriteLine($"std::array<{counterType}, INVOKERS_COUNT> forbidden{initializer};");
+            this.m_writer.WriteLine($"{counterType} unexpectedTimers{initializer}; //timer fired in a state not expecting it");
+            if (this.m_settings.Instrumentation == CppInstrumentation.latency)
+            {
+                this.m_writer.WriteLine($"std::array<{latencyType}, CALLBACKS_COUNT> callbacks{initializer};");
+            };
+        }
+
+        private string ComposeTransitionCounter(string state, string invokerName)
+        {
+            return $"transitions[{state}][{this.m_invokers.IndexOf(invokerName)} /*{invokerName}*/]";
+        }
+
+        private string ComposeStatsIncrement(string counter, string amount = "")
+        {
+            if (this.m_settings.Instrumentation == CppInstrumentation.none)
+            {
+                return "";
+            };
+            return $"{ComposeStatsClassName()}::Local().{counter}.Increment({amount}); ";
+        }
+
+        private void WriteStatsIncrement(string counter, string amount = "")
+        {
+            string increment = ComposeStatsIncrement(counter, amount);
+            if (increment.Length > 0)
+            {
+                this.m_writer.WriteLine(increment.TrimEnd());
+            };
+        }
+
+        private string ComposeLatencyScope(string callbackName)
+        {
+            if (this.m_settings.Instrumentation != CppInstrumentation.latency)
+            {
+                return "";
+            };
+            int index = this.m_latencyCallbacks.IndexOf(callbackName);
+            if (index < 0)
+            {
+                throw new Exception("Should not happen! Callback " + callbackName + " is not measured");
+            };
+            return $"const LatencyScope latency({ComposeStatsClassName()}::Local().callbacks[{index} /*{callbackName}*/]);";
+        }
+
+        private void ComputeLatencyCallbacks()
+        {
+            foreach (StateDescr state in this.m_stateMachine.States.Values)
+            {
+                if (state.NeedOnEnterEvent)
+                {
+                    this.m_latencyCallbacks.Add(ComposeStateEnterCallback(state));
+                };
+                IEnumerable<EdgeDescr> edges = (state.EventEdges?.Values ?? Enumerable.Empty<EdgeDescr>())
+                    .Concat(state.TimerEdges?.Values ?? Enumerable.Empty<EdgeDescr>());
+                foreach (EdgeDescr edge in edges)
+                {
+                    foreach (EdgeTraverseCallbackType callbackType in edge.OnTraverseEventTypes)
+                    {
+                        this.m_latencyCallbacks.Add(ExportHelper.ComposeEdgeTraveseCallbackName(callbackType, state, edge, out _, out _));
+                    }
+                }
+            }
+            //callbacks shared by several edges get a single histogram
+            List<string> distinct = this.m_latencyCallbacks.Distinct().ToList();
+            this.m_latencyCallbacks.Clear();
+            this.m_latencyCallbacks.AddRange(distinct);
+        }
+
+        private string ComposeTraceClassName()
+        {
+            return this.m_settings.ClassName + "Trace";
+        }
+
+        private void WriteTrace()
+        {
+            string className = ComposeTraceClassName();
+
+            this.m_writer.WriteLine($"//transitions of all {this.m_settings.ClassName} machines, every thread records into its own ring of the last {this.m_settings.TraceCapacity} records");
+            this.m_writer.WriteLine($"struct {className}");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            {
+                this.m_writer.WriteLine($"static constexpr size_t CAPACITY = {this.m_settings.TraceCapacity};");
+                this.m_writer.WriteLine($"static constexpr uint16_t NO_ID = {TraceDecoder.NO_ID};");
+                this.m_writer.WriteLine($"static constexpr uint64_t METADATA_HASH = 0x{TraceDecoder.ComputeMetadataHash(this.m_stateMachine):x16}; //of the names below, checked by decoder");
+                this.m_writer.WriteLine();
+                WriteStatsNames("s_stateNames", this.m_stateMachine.States.Count.ToString(), this.m_stateMachine.States.Keys);
+                WriteStatsNames("s_invokerNames", this.m_invokers.Count.ToString(), this.m_invokers);
+                this.m_writer.WriteLine();
+
+                this.m_writer.WriteLine("static void Record(uint64_t instance, uint16_t from, uint16_t invoker, uint16_t to)");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("Local().Push(NICE_STATE_MACHINE_TRACE_TIMESTAMP(), instance, from, invoker, to);");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine();
+
+                this.m_writer.WriteLine("//records of all the threads ordered by timestamp, while other threads keep recording");
+                this.m_writer.WriteLine("static std::vector<TraceRecord> Collect()");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("std::vector<TraceRecord> result;");
+                this.m_writer.WriteLine("uint16_t thread = 0;");
+                this.m_writer.WriteLine("Registry().ForEach([&result, &thread](const TraceRing<CAPACITY>& ring) { ring.CopyTo(result, thread++); });");
+                this.m_writer.WriteLine("std::stable_sort(result.begin(), result.end(), [](const TraceRecord& a, const TraceRecord& b) { return a.timestamp < b.timestamp; });");
+                this.m_writer.WriteLine("return result;");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine();
+
+                this.m_writer.WriteLine("//binary dump for the generator trace decoder");
+                this.m_writer.WriteLine("static void Dump(std::ostream& out)");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("WriteTraceDump(out, METADATA_HASH, Collect());");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine();
+            }
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("private:");
+            ++this.m_writer.Indent;
+            {
+                this.m_writer.WriteLine("static TraceRing<CAPACITY>& Local()");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("thread_local TraceRing<CAPACITY>& local = Registry().Add();");
+                this.m_writer.WriteLine("return local;");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine();
+
+                this.m_writer.WriteLine("static ThreadRegistry<TraceRing<CAPACITY>>& Registry()");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("//never destroyed, as threads may still record after static objects are gone");
+                this.m_writer.WriteLine("static ThreadRegistry<TraceRing<CAPACITY>>* registry = new ThreadRegistry<TraceRing<CAPACITY>>();");
+                this.m_writer.WriteLine("return *registry;");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+            }
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("};");
+            this.m_writer.WriteLine();
+        }
+
+        private static string ComposeTraceId(string state)
+        {
+            return $"static_cast<uint16_t>({state})";
+        }
+
+        //null ids are recorded as NO_ID
+        private void WriteTraceRecord(string? fromId, string? invoker, string? toState)
+        {
+            if (!this.m_settings.Trace)
+            {
+                return;
+            };
+            string className = ComposeTraceClassName();
+            string instance = this.m_writingPool ? "handle" : "reinterpret_cast<uintptr_t>(this)";
+            string toId = toState == null ? $"{className}::NO_ID" : ComposeTraceId(toState);
+            this.m_writer.WriteLine($"{className}::Record({instance}, {fromId ?? $"{className}::NO_ID"}, {invoker ?? $"{className}::NO_ID"}, {toId});");
+        }
+
+        private void WriteTraceFrom()
+        {
+            //table transitions are applied in place, so the source state is kept for the record
+            if (this.m_settings.Trace)
+            {
+                this.m_writer.WriteLine($"const uint16_t traceFrom = {ComposeTraceId("m_currentState")};");
+            };
+        }
+
+        private void ExportBenchmarkInternal(string headerInclude)
+        {
+            this.m_writer.WriteLine($"// generated by {nameof(NiceStateMachineGenerator)} v{Assembly.GetExecutingAssembly().GetName().Version}");
+            this.m_writer.WriteLine($"// benchmark of {this.m_settings.ClassName}: random walks over the state machine are replayed on a single instance and on many instances");
+            this.m_writer.WriteLine("// build with the header generated with the same settings, e.g. c++ -std=c++20 -O2, and run with [steps] [instances] [seed] [large instances] arguments");
+            this.m_writer.WriteLine();
+            this.m_writer.WriteLine("#ifndef NICE_STATE_MACHINE_BENCH_HEADER");
+            this.m_writer.WriteLine("//may be defined to include the header from another location");
+            this.m_writer.WriteLine($"#define NICE_STATE_MACHINE_BENCH_HEADER \"{headerInclude}\"");
+            this.m_writer.WriteLine("#endif");
+            this.m_writer.WriteLine("#include NICE_STATE_MACHINE_BENCH_HEADER");
+            this.m_writer.WriteLine();
+            foreach (string include in s_benchmarkIncludes)
+            {
+                this.m_writer.WriteLine($"#include <{include}>");
+            };
+            this.m_writer.WriteLine();
+            WriteVerbatimCode(BENCHMARK_ALLOCATIONS_CODE);
+
+            this.m_writer.WriteLine("namespace");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine($"using namespace {this.m_settings.NamespaceName};");
+                this.m_writer.WriteLine();
+                WriteBenchmarkModel();
+                WriteVerbatimCode(BENCHMARK_TIMER_CODE);
+                WriteBenchmarkMachine();
+                WriteVerbatimCode(BENCHMARK_DRIVER_CODE);
+                WriteBenchmarkDispatch();
+                WriteVerbatimCode(BENCHMARK_RUN_CODE);
+                if (this.m_settings.BatchProcessing)
+                {
+                    WriteBenchmarkBatchDispatch();
+                    WriteVerbatimCode(BENCHMARK_BATCH_CODE);
+                };
+                if (this.m_settings.TimerWheel)
+                {
+                    WriteVerbatimCode(BENCHMARK_WHEEL_CODE);
+                };
+                if (this.m_settings.GenerateInbox)
+                {
+                    WriteVerbatimCode(BENCHMARK_INBOX_CODE);
+                };
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}"); //namespace
+            this.m_writer.WriteLine();
+            WriteBenchmarkMain();
+        }
+
+        private static readonly string[] s_benchmarkIncludes = new string[] {
+            "algorithm", "array", "atomic", "chrono", "cstddef", "cstdint", "cstdio", "cstdlib", "cstring", "exception", "functional", "memory", "mutex", "new", "optional", "queue", "random", "span", "thread", "utility", "vector"
+        };
+
+        //tables driving random walks. Bits of masks have the same layout as execution state of Validator
+        private void WriteBenchmarkModel()
+        {
+            List<string> states = this.m_stateMachine.States.Keys.ToList();
+            List<string> events = this.m_stateMachine.Events.Keys.ToList();
+            List<string> timers = this.m_stateMachine.Timers.Keys.ToList();
+            int firedBitsOffset = events.Count;
+            int timerBitsOffset = 2 * events.Count;
+            int wordsCount = (timerBitsOffset + timers.Count + 63) / 64;
+
+            this.m_writer.WriteLine($"constexpr const char* MACHINE_NAME = \"{this.m_settings.ClassName}\";");
+            this.m_writer.WriteLine($"constexpr size_t STATES_COUNT = {states.Count};");
+            this.m_writer.WriteLine($"constexpr size_t EVENTS_COUNT = {events.Count};");
+            this.m_writer.WriteLine($"constexpr size_t TIMERS_COUNT = {timers.Count};");
+            this.m_writer.WriteLine("constexpr size_t INVOKERS_COUNT = EVENTS_COUNT + TIMERS_COUNT;");
+            this.m_writer.WriteLine("constexpr uint16_t RESTART = INVOKERS_COUNT; //step calling Start()");
+            this.m_writer.WriteLine("constexpr int16_t NO_STATE = -1;");
+            this.m_writer.WriteLine($"constexpr int16_t START_STATE = {states.IndexOf(this.m_stateMachine.StartState)}; //{this.m_stateMachine.StartState}");
+            this.m_writer.WriteLine();
+            this.m_writer.WriteLine("//bits of events enabled by after_states, then of fired only_once events, then of started timers");
+            this.m_writer.WriteLine("constexpr size_t FIRED_BITS_OFFSET = EVENTS_COUNT;");
+            this.m_writer.WriteLine("constexpr size_t TIMER_BITS_OFFSET = 2 * EVENTS_COUNT;");
+            this.m_writer.WriteLine("constexpr size_t MASK_WORDS = (TIMER_BITS_OFFSET + TIMERS_COUNT + 63) / 64;");
+            this.m_writer.WriteLine("using Mask = std::array<uint64_t, MASK_WORDS>;");
+            this.m_writer.WriteLine();
+            this.m_writer.WriteLine("struct StateModel");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            this.m_writer.WriteLine("Mask keep; //bits surviving entering the state");
+            this.m_writer.WriteLine("Mask set; //bits set by entering the state");
+            this.m_writer.WriteLine("int16_t next; //next_state");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("};");
+            this.m_writer.WriteLine();
+
+            //names of timer objects, a shared one is registered for each of its timers
+            this.m_writer.WriteLine($"constexpr std::array<const char*, TIMERS_COUNT> s_timerNames = {{ {String.Join(", ", timers.Select(t => $"\"{this.m_timerToObject[t]}\""))} }};");
+            this.m_writer.WriteLine($"constexpr std::array<bool, EVENTS_COUNT> s_onlyOnce = {{ {String.Join(", ", this.m_stateMachine.Events.Values.Select(e => e.OnlyOnce ? "true" : "false"))} }};");
+            ulong[] initialMask = new ulong[wordsCount];
+            for (int eventIndex = 0; eventIndex < events.Count; ++eventIndex)
+            {
+                if (this.m_stateMachine.Events[events[eventIndex]].AfterStates == null)
+                {
+                    initialMask[eventIndex / 64] |= 1UL << (eventIndex % 64);
+                }
+            }
+            this.m_writer.WriteLine($"constexpr Mask s_initialMask = {ComposeBenchmarkMask(initialMask)};");
+            this.m_writer.WriteLine();
+
+            this.m_writer.WriteLine("constexpr std::array<StateModel, STATES_COUNT> s_stateModels = {");
+            ++this.m_writer.Indent;
+            foreach (StateDescr state in this.m_stateMachine.States.Values)
+            {
+                ulong[] keepMask = Enumerable.Repeat(UInt64.MaxValue, wordsCount).ToArray();
+                ulong[] setMask = new ulong[wordsCount];
+                for (int timerIndex = 0; timerIndex < timers.Count; ++timerIndex)
+                {
+                    int bit = timerBitsOffset + timerIndex;
+                    if (state.StartTimers.ContainsKey(timers[timerIndex]))
+                    {
+                        setMask[bit / 64] |= 1UL << (bit % 64);
+                    }
+                    else if (state.StopTimers.Contains(timers[timerIndex]))
+                    {
+                        keepMask[bit / 64] &= ~(1UL << (bit % 64));
+                    }
+                }
+                for (int eventIndex = 0; eventIndex < events.Count; ++eventIndex)
+                {
+                    HashSet<string>? afterStates = this.m_stateMachine.Events[events[eventIndex]].AfterStates;
+                    if (afterStates != null && afterStates.Contains(state.Name))
+                    {
+                        setMask[eventIndex / 64] |= 1UL << (eventIndex % 64);
+                    }
+                }
+                string next = state.NextStateName == null ? "NO_STATE" : states.IndexOf(state.NextStateName).ToString(CultureInfo.InvariantCulture);
+                this.m_writer.WriteLine($"StateModel{{ {ComposeBenchmarkMask(keepMask)}, {ComposeBenchmarkMask(setMask)}, {next} }}, //{state.Name}");
+            }
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("};");
+            this.m_writer.WriteLine();
+
+            //targets are listed by [state][invoker], offsets point to the first target of each pair
+            List<int> offsets = new List<int>();
+            List<string> targetLines = new List<string>();
+            int targetsCount = 0;
+            foreach (StateDescr state in this.m_stateMachine.States.Values)
+            {
+                List<string> stateTargets = new List<string>();
+                for (int invokerIndex = 0; invokerIndex < this.m_invokers.Count; ++invokerIndex)
+                {
+                    offsets.Add(targetsCount);
+                    string invoker = this.m_invokers[invokerIndex];
+                    EdgeDescr? edge = invokerIndex < events.Count ? state.EventEdges?.GetValueOrDefault(invoker) : state.TimerEdges?.GetValueOrDefault(invoker);
+                    foreach (EdgeTarget target in GetBenchmarkTargets(edge))
+                    {
+                        stateTargets.Add(target.TargetType == EdgeTargetType.state ? states.IndexOf(target.StateName!).ToString(CultureInfo.InvariantCulture) : "NO_STATE");
+                        ++targetsCount;
+                    }
+                }
+                if (stateTargets.Count > 0)
+                {
+                    targetLines.Add($"{String.Join(", ", stateTargets)}, //{state.Name}");
+                };
+            }
+            offsets.Add(targetsCount);
+
+            this.m_writer.WriteLine("//states the edges lead to, NO_STATE for the ones keeping current state. Failure targets are never taken");
+            this.m_writer.WriteLine($"constexpr std::array<int16_t, {targetsCount}> s_targets = {{");
+            ++this.m_writer.Indent;
+            foreach (string line in targetLines)
+            {
+                this.m_writer.WriteLine(line);
+            }
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("};");
+            this.m_writer.WriteLine("//targets of the edge taken from state by invoker start at [state * INVOKERS_COUNT + invoker]");
+            this.m_writer.WriteLine("constexpr std::array<uint32_t, STATES_COUNT * INVOKERS_COUNT + 1> s_targetOffsets = {");
+            ++this.m_writer.Indent;
+            for (int stateIndex = 0; stateIndex < states.Count; ++stateIndex)
+            {
+                this.m_writer.WriteLine($"{String.Join(", ", offsets.Skip(stateIndex * this.m_invokers.Count).Take(this.m_invokers.Count))}, //{states[stateIndex]}");
+            }
+            this.m_writer.WriteLine($"{targetsCount}");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("};");
+            this.m_writer.WriteLine();
+        }
+
+        private static IEnumerable<EdgeTarget> GetBenchmarkTargets(EdgeDescr? edge)
+        {
+            if (edge == null)
+            {
+                return Enumerable.Empty<EdgeTarget>();
+            };
+            IEnumerable<EdgeTarget> targets = edge.Target != null ? new[] { edge.Target } : edge.Targets!.Values;
+            return targets.Where(t => t.TargetType != EdgeTargetType.failure);
+        }
+
+        private static string ComposeBenchmarkMask(ulong[] words)
+        {
+            if (words.Length == 0)
+            {
+                return "Mask{}";
+            };
+            return $"Mask{{ {String.Join(", ", words.Select(w => $"0x{w:x}ULL"))} }}";
+        }
+
+        private void WriteBenchmarkMachine()
+        {
+            bool handler = this.m_settings.CallbackMode == CppCallbackMode.handler;
+            if (handler)
+            {
+                this.m_writer.WriteLine("struct BenchHandler;");
+            };
+            this.m_writer.WriteLine($"using Machine = {this.m_settings.ClassName}<{(handler ? "BenchTimer, BenchHandler" : "BenchTimer")}>;");
+            this.m_writer.WriteLine($"using {STATES_ENUM_NAME} = Machine::{STATES_ENUM_NAME};");
+            this.m_writer.WriteLine();
+
+            //name, argument types and returned expression for function callbacks
+            List<(string name, string argTypes, string? result)> callbacks = new List<(string name, string argTypes, string? result)>();
+            foreach (StateDescr state in this.m_stateMachine.States.Values)
+            {
+                if (state.NeedOnEnterEvent)
+                {
+                    //states chosen on enter are not followed by Validator either
+                    callbacks.Add((ComposeStateEnterCallback(state), "", state.OnEnterEventAlluxTargets == null ? null : "std::nullopt"));
+                }
+            }
+            HashSet<string> declaredEventCallbacks = new HashSet<string>();
+            foreach (StateDescr state in this.m_stateMachine.States.Values)
+            {
+                IEnumerable<EdgeDescr> edges = (state.EventEdges?.Values ?? Enumerable.Empty<EdgeDescr>()).Concat(state.TimerEdges?.Values ?? Enumerable.Empty<EdgeDescr>());
+                foreach (EdgeDescr edge in edges)
+                {
+                    foreach (EdgeTraverseCallbackType callbackType in edge.OnTraverseEventTypes)
+                    {
+                        string callbackName = ExportHelper.ComposeEdgeTraveseCallbackName(callbackType, state, edge, out bool needArgs, out bool isFunction);
+                        if (!declaredEventCallbacks.Add(callbackName))
+                        {
+                            continue;
+                        };
+                        EventDescr? @event = edge.IsTimer ? null : this.m_stateMachine.Events[edge.InvokerName];
+                        string argTypes = needArgs && @event != null && @event.Args.Count > 0 ? ComposeEventArgTypes(@event) : "";
+                        callbacks.Add((callbackName, argTypes, isFunction ? "TakeChoice()" : null));
+                    }
+                }
+            }
+
+            if (NeedBenchmarkChoice())
+            {
+                this.m_writer.WriteLine("//state returned by function callbacks for the step being replayed");
+                this.m_writer.WriteLine($"std::optional<{STATES_ENUM_NAME}> s_choice;");
+                if (this.m_settings.BatchProcessing)
+                {
+                    this.m_writer.WriteLine("//states returned by function callbacks of batched machines, in the order the batch processes them");
+                    this.m_writer.WriteLine($"const std::optional<{STATES_ENUM_NAME}>* s_batchChoices = nullptr;");
+                };
+                this.m_writer.WriteLine();
+                this.m_writer.WriteLine($"std::optional<{STATES_ENUM_NAME}> TakeChoice()");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                if (this.m_settings.BatchProcessing)
+                {
+                    this.m_writer.WriteLine("if (s_batchChoices != nullptr)");
+                    this.m_writer.WriteLine("{");
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine("return *s_batchChoices++;");
+                    --this.m_writer.Indent;
+                    this.m_writer.WriteLine("}");
+                };
+                this.m_writer.WriteLine("return std::exchange(s_choice, std::nullopt);");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine();
+            };
+
+            //all callbacks are set, so that calling them is measured too
+            List<string> constructorArgs = new List<string>();
+            if (!this.m_settings.CompactLayout)
+            {
+                //lazy timers are created after other machines were constructed, so they are registered with their own machine
+                constructorArgs.Add(this.m_settings.LazyTimers
+                    ? "[timers = BenchTimer::s_constructed](const char* timerName, TimerFiredCallback<BenchTimer> callback) { BenchTimer::s_constructed = timers; return new BenchTimer(timerName, std::move(callback)); }"
+                    : "[](const char* timerName, TimerFiredCallback<BenchTimer> callback) { return new BenchTimer(timerName, std::move(callback)); }");
+            };
+            bool setCallbacks = false;
+            if (HasActionBuffer())
+            {
+                //only function callbacks remain, actions are dropped by Dispatch() after every step
+                callbacks.RemoveAll(c => c.result == null);
+                this.m_writer.WriteLine("std::vector<Machine::Action> s_actions;");
+                this.m_writer.WriteLine();
+            };
+            if (handler)
+            {
+                this.m_writer.WriteLine("struct BenchHandler");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                foreach ((string name, string argTypes, string? result) in callbacks)
+                {
+                    this.m_writer.WriteLine(result == null
+                        ? $"void {name}({argTypes}) {{}}"
+                        : $"std::optional<{STATES_ENUM_NAME}> {name}({argTypes}) {{ return {result}; }}"
+                    );
+                }
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("};");
+                this.m_writer.WriteLine();
+                this.m_writer.WriteLine("BenchHandler s_handler;");
+                this.m_writer.WriteLine();
+                constructorArgs.Add("s_handler");
+            }
+            else if (this.m_sharedCallbacks)
+            {
+                this.m_writer.WriteLine("Machine::Callbacks MakeCallbacks()");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("Machine::Callbacks callbacks;");
+                foreach ((string name, string argTypes, string? result) in callbacks)
+                {
+                    this.m_writer.WriteLine($"callbacks.{name} = {ComposeBenchmarkLambda(ComposeSharedCallbackArgs("void*", argTypes), result)};");
+                }
+                this.m_writer.WriteLine("return callbacks;");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine();
+                this.m_writer.WriteLine("const Machine::Callbacks s_callbacks = MakeCallbacks();");
+                this.m_writer.WriteLine();
+                constructorArgs.Add("s_callbacks");
+                constructorArgs.Add("nullptr");
+            }
+            else if (callbacks.Count > 0)
+            {
+                this.m_writer.WriteLine("void SetCallbacks(Machine& machine)");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                foreach ((string name, string argTypes, string? result) in callbacks)
+                {
+                    this.m_writer.WriteLine($"machine.{name} = {ComposeBenchmarkLambda(argTypes, result)};");
+                }
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine();
+                setCallbacks = true;
+            };
+
+            //timers of compact machines are constructed in place
+            this.m_writer.WriteLine("std::unique_ptr<Machine> CreateMachine()");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            this.m_writer.WriteLine($"std::unique_ptr<Machine> machine = std::make_unique<Machine>({String.Join(", ", constructorArgs)});");
+            if (setCallbacks)
+            {
+                this.m_writer.WriteLine("SetCallbacks(*machine);");
+            };
+            if (HasActionBuffer())
+            {
+                this.m_writer.WriteLine("machine->SetActionBuffer(&s_actions);");
+            };
+            this.m_writer.WriteLine("return machine;");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        //edges with several targets let function callbacks choose the state
+        private bool NeedBenchmarkChoice()
+        {
+            return this.m_stateMachine.States.Values.Any(s => (s.EventEdges?.Values.Any(e => e.Targets != null) ?? false)
+                || (s.TimerEdges?.Values.Any(e => e.Targets != null) ?? false)
+            );
+        }
+
+        private string ComposeBenchmarkLambda(string argTypes, string? result)
+        {
+            return result == null
+                ? $"[]({argTypes}) {{}}"
+                : $"[]({argTypes}) -> std::optional<{STATES_ENUM_NAME}> {{ return {result}; }}";
+        }
+
+        private void WriteBenchmarkDispatch()
+        {
+            this.m_writer.WriteLine("void Dispatch(Instance& instance, Step step)");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            if (NeedBenchmarkChoice())
+            {
+                this.m_writer.WriteLine($"s_choice = step.target == NO_STATE ? std::nullopt : std::optional<{STATES_ENUM_NAME}>(static_cast<{STATES_ENUM_NAME}>(step.target));");
+            };
+            this.m_writer.WriteLine("switch (step.invoker)");
+            this.m_writer.WriteLine("{");
+            int invokerIndex = 0;
+            foreach (EventDescr @event in this.m_stateMachine.Events.Values)
+            {
+                this.m_writer.WriteLine($"case {invokerIndex}: //{@event.Name}");
+                ++this.m_writer.Indent;
+                WriteBenchmarkCall($"ProcessEvent__{@event.Name}({String.Join(", ", @event.Args.Select(_ => "{}"))})");
+                this.m_writer.WriteLine("break;");
+                --this.m_writer.Indent;
+                ++invokerIndex;
+            }
+            int timerIndex = 0;
+            foreach (string timer in this.m_stateMachine.Timers.Keys)
+            {
+                this.m_writer.WriteLine($"case {invokerIndex}: //{timer}");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine($"instance.timers[{timerIndex}]->Fire();");
+                this.m_writer.WriteLine("break;");
+                --this.m_writer.Indent;
+                ++invokerIndex;
+                ++timerIndex;
+            }
+            this.m_writer.WriteLine("default: //RESTART");
+            ++this.m_writer.Indent;
+            WriteBenchmarkCall("Start()");
+            this.m_writer.WriteLine("break;");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+            if (HasActionBuffer())
+            {
+                this.m_writer.WriteLine("s_actions.clear();");
+            };
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        private void WriteBenchmarkBatchDispatch()
+        {
+            //only edges with function callbacks take choices, and batches process machines grouped by state
+            List<string> states = this.m_stateMachine.States.Keys.ToList();
+            this.m_writer.WriteLine("//whether a function callback chooses the target of the edge taken by an event, [state * EVENTS_COUNT + event]");
+            this.m_writer.WriteLine("constexpr std::array<bool, STATES_COUNT * EVENTS_COUNT> s_eventChoices = {");
+            ++this.m_writer.Indent;
+            foreach (StateDescr state in this.m_stateMachine.States.Values)
+            {
+                IEnumerable<string> choices = this.m_stateMachine.Events.Keys.Select(e => state.EventEdges != null && state.EventEdges.TryGetValue(e, out EdgeDescr? edge) && edge.Targets != null ? "true" : "false");
+                this.m_writer.WriteLine($"{String.Join(", ", choices)}, //{state.Name}");
+            }
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("};");
+            this.m_writer.WriteLine();
+
+            this.m_writer.WriteLine($"void SetBatchChoices(const std::optional<{STATES_ENUM_NAME}>*{(NeedBenchmarkChoice() ? " choices" : "")})");
+            this.m_writer.WriteLine("{");
+            if (NeedBenchmarkChoice())
+            {
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("s_batchChoices = choices;");
+                --this.m_writer.Indent;
+            };
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+
+            //the struct-of-arrays overload is taken when states are given
+            this.m_writer.WriteLine($"void DispatchBatch(uint16_t event, std::span<{STATES_ENUM_NAME}> states, std::span<Machine* const> machines, std::span<size_t> scratch)");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            this.m_writer.WriteLine("switch (event)");
+            this.m_writer.WriteLine("{");
+            int eventIndex = 0;
+            foreach (EventDescr @event in this.m_stateMachine.Events.Values)
+            {
+                this.m_writer.WriteLine($"case {eventIndex}: //{@event.Name}");
+                ++this.m_writer.Indent;
+                string call = $"Machine::ProcessEventBatch__{@event.Name}({String.Join(", ", new[] { "machines", "scratch" }.Concat(@event.Args.Select(_ => "{}")))})";
+                string structOfArraysCall = $"Machine::ProcessEventBatch__{@event.Name}({String.Join(", ", new[] { "states", "machines", "scratch" }.Concat(@event.Args.Select(_ => "{}")))})";
+                if (this.m_settings.ErrorMode == CppErrorMode.status)
+                {
+                    this.m_writer.WriteLine($"if (states.empty() ? !{call} : !{structOfArraysCall}) {{ ++s_errors; }}");
+                }
+                else
+                {
+                    this.m_writer.WriteLine($"if (states.empty()) {{ {call}; }}");
+                    this.m_writer.WriteLine($"else {{ {structOfArraysCall}; }}");
+                };
+                this.m_writer.WriteLine("break;");
+                --this.m_writer.Indent;
+                ++eventIndex;
+            }
+            this.m_writer.WriteLine("default:");
+            ++this.m_writer.Indent;
+            this.m_writer.WriteLine("break;");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+            if (HasActionBuffer())
+            {
+                this.m_writer.WriteLine("s_actions.clear();");
+            };
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        private void WriteBenchmarkCall(string call)
+        {
+            if (this.m_settings.ErrorMode == CppErrorMode.status)
+            {
+                this.m_writer.WriteLine($"if (!instance.machine->{call}) {{ ++s_errors; }}");
+            }
+            else
+            {
+                this.m_writer.WriteLine($"instance.machine->{call};");
+            };
+        }
+
+        private void WriteBenchmarkMain()
+        {
+            bool exceptions = this.m_settings.ErrorMode == CppErrorMode.exceptions;
+            this.m_writer.WriteLine("int main(int argc, char** argv)");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            WriteVerbatimCode(BENCHMARK_ARGUMENTS_CODE);
+            if (!exceptions)
+            {
+                this.m_writer.WriteLine("Machine::SetErrorHandler([](Machine&, const Machine::Result&) noexcept { ++s_errors; });");
+            };
+            this.m_writer.WriteLine("std::printf(\"%s, seed %llu\\n\", MACHINE_NAME, static_cast<unsigned long long>(seed));");
+            if (exceptions)
+            {
+                this.m_writer.WriteLine("try");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+            };
+            this.m_writer.WriteLine("Run(\"single instance\", 1, steps, seed);");
+            this.m_writer.WriteLine("Run(\"many instances\", instances, std::max<size_t>(steps / instances, 1), seed);");
+            this.m_writer.WriteLine("RunLifecycles(\"short lifecycles\", std::max<size_t>(steps / 16, 1), 16, seed);");
+            this.m_writer.WriteLine("RunFootprint(\"footprint\", largeInstances);");
+            if (this.m_settings.BatchProcessing)
+            {
+                this.m_writer.WriteLine("RunBatches(\"batches\", 10000, std::max<size_t>(steps / 10000, 1), seed);");
+                this.m_writer.WriteLine("RunBatches(\"batches\", largeInstances, std::max<size_t>(steps / largeInstances, 1), seed);");
+            };
+            if (this.m_settings.TimerWheel)
+            {
+                this.m_writer.WriteLine("RunChurn<WheelTimers>(\"timer wheel churn\", std::max<size_t>(largeInstances / 2, 1), 10, seed);");
+                this.m_writer.WriteLine("RunChurn<HeapTimers>(\"priority queue churn\", std::max<size_t>(largeInstances / 2, 1), 10, seed);");
+            };
+            if (this.m_settings.GenerateInbox)
+            {
+                this.m_writer.WriteLine("for (size_t producers = 1; producers <= 8; producers *= 2)");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("RunContention(\"contention\", producers, steps, seed);");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+            };
+            if (exceptions)
+            {
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine("catch (const std::exception& e)");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("std::printf(\"Failed: %s\\n\", e.what());");
+                this.m_writer.WriteLine("return 2;");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+            };
+            this.m_writer.WriteLine("if (s_errors > 0)");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            this.m_writer.WriteLine("std::printf(\"Failed: %llu errors, machine did not follow its description\\n\", static_cast<unsigned long long>(s_errors));");
+            this.m_writer.WriteLine("return 2;");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine("return 0;");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+        }
+
+        private void WriteCommonCode(IndentedTextWriter writer)
+        {
+            WriteVerbatimCode(TIMER_CODE, writer);
+            if (this.m_settings.TimerWheel)
+            {
+                WriteVerbatimCode(TIMER_WHEEL_CODE, writer);
+            };
+            if (this.m_settings.GenerateInbox)
+            {
+                WriteVerbatimCode(INBOX_CODE, writer);
+            };
+            if (this.m_settings.GenerateSnapshot)
+            {
+                WriteVerbatimCode(SNAPSHOT_CODE, writer);
+            };
+            if (this.m_settings.MappedPool)
+            {
+                WriteVerbatimCode(MAPPED_POOL_CODE, writer);
+            };
+            if (this.m_settings.Instrumentation != CppInstrumentation.none || this.m_settings.Trace)
+            {
+                WriteVerbatimCode(THREAD_REGISTRY_CODE, writer);
+            };
+            if (this.m_settings.Instrumentation != CppInstrumentation.none)
+            {
+                WriteVerbatimCode(STATS_CODE, writer);
+            };
+            if (this.m_settings.Instrumentation == CppInstrumentation.latency)
+            {
+                WriteVerbatimCode(LATENCY_STATS_CODE, writer);
+            };
+            if (this.m_settings.Trace)
+            {
+                WriteVerbatimCode(TRACE_CODE, writer);
+            };
+        }
+
+        private List<string> GetCommonCodeIncludes()
+        {
+            List<string> result = new List<string>();
+            if (this.m_settings.TimerWheel)
+            {
+                result.Add("cmath");
+                result.Add("cstddef");
+                result.Add("cstdint");
+                result.Add("utility");
+            };
+            if (this.m_settings.GenerateInbox)
+            {
+                result.Add("atomic");
+                result.Add("cstddef");
+                result.Add("cstdint");
+                result.Add("memory");
+                result.Add("utility");
+            };
+            if (this.m_settings.Instrumentation != CppInstrumentation.none || this.m_settings.Trace)
+            {
+                result.Add("memory");
+                result.Add("mutex");
+                result.Add("vector");
+            };
+            if (this.m_settings.Instrumentation != CppInstrumentation.none)
+            {
+                result.Add("array");
+                result.Add("atomic");
+                result.Add("cstddef");
+                result.Add("cstdint");
+            };
+            if (this.m_settings.Instrumentation == CppInstrumentation.latency)
+            {
+                result.Add("algorithm");
+                result.Add("bit");
+                result.Add("chrono");
+            };
+            if (this.m_settings.Trace)
+            {
+                result.Add("algorithm");
+                result.Add("array");
+                result.Add("atomic");
+                result.Add("chrono");
+                result.Add("cstddef");
+                result.Add("cstdint");
+                result.Add("ostream");
+            };
+            if (this.m_settings.MappedPool)
+            {
+                result.Add("algorithm");
+                result.Add("cerrno");
+                result.Add("chrono");
+                result.Add("cstddef");
+                result.Add("cstdint");
+                result.Add("cstring");
+                result.Add("system_error");
+                result.Add("fcntl.h");
+                result.Add("sys/mman.h");
+                result.Add("sys/stat.h");
+                result.Add("unistd.h");
+            };
+            if (this.m_settings.GenerateSnapshot)
+            {
+                result.Add("bit");
+                result.Add("concepts");
+                result.Add("cstddef");
+                result.Add("cstdint");
+                result.Add("cstring");
+                result.Add("span");
+            };
+            return result.Distinct().ToList();
+        }
+
+        private List<string> GetExtraIncludes()
+        {
+            //standard headers needed by non-default settings
+            List<string> result = new List<string>();
+            if (this.m_settings.DispatchMode == CppDispatchMode.table)
+            {
+                result.Add("cstddef");
+                result.Add("cstdint");
+                result.Add("string");
+            };
+            if (this.m_settings.CompactLayout)
+            {
+                result.Add("cstddef");
+                result.Add("cstdint");
+            };
+            if (this.m_settings.GeneratePool)
+            {
+                result.Add("cstdint");
+                result.Add("span");
+                result.Add("vector");
+            };
+            if (this.m_settings.MappedPool)
+            {
+                result.Add("algorithm");
+                result.Add("type_traits");
+            };
+            if (HasActionBuffer())
+            {
+                result.Add("cstdint");
+                result.Add("variant");
+                result.Add("vector");
+            };
+            if (this.m_settings.GenerateObjectPool)
+            {
+                result.Add("cstddef");
+                result.Add("functional");
+                result.Add("memory");
+                result.Add("vector");
+            };
+            if (this.m_settings.ErrorMode != CppErrorMode.exceptions)
+            {
+                result.Add("cstdint");
+            };
+            foreach (EventDescr @event in this.m_stateMachine.Events.Values)
+            {
+                foreach (KeyValuePair<string, string> arg in @event.Args)
+                {
+                    string argType = ComposeArgType(@event, arg);
+                    if (argType.StartsWith("std::string_view"))
+                    {
+                        result.Add("string_view");
+                    }
+                    else if (argType.StartsWith("std::span"))
+                    {
+                        result.Add("span");
+                    };
+                }
+            };
+            if (NeedEventTypes())
+            {
+                result.Add("cstddef");
+                result.Add("type_traits");
+                result.Add("utility");
+                result.Add("variant");
+            };
+            if (this.m_settings.GenerateInbox)
+            {
+                result.Add("atomic");
+                result.Add("cstdint");
+                result.Add("exception");
+                result.Add("vector");
+            };
+            if (this.m_settings.BatchProcessing)
+            {
+                result.Add("array");
+                result.Add("cassert");
+                result.Add("cstddef");
+                result.Add("span");
+                result.Add("utility");
+            };
+            if (this.m_settings.Instrumentation != CppInstrumentation.none || this.m_settings.Trace)
+            {
+                result.Add("array");
+                result.Add("cstddef");
+                result.Add("cstdint");
+            };
+            if (this.m_settings.Trace)
+            {
+                result.Add("ostream");
+                result.Add("vector");
+            };
+            if (this.m_settings.GenerateSnapshot)
+            {
+                result.Add("cstddef");
+                result.Add("cstdint");
+                result.Add("span");
+                result.Add("type_traits");
+                result.Add("vector");
+            };
+            return result.Distinct().ToList();
+        }
+
+        private void WriteSetState()
+        {
+            string returnType = ComposeReturnType(true, false);
+            //states with next_state are entered along with the whole chain, only on_enter redirects and cycles go to another case
+            bool needLoop = this.m_stateMachine.States.Values.Any(s => CollectNextStateChain(s).Last().NextStateName != null
+                || (s.NeedOnEnterEvent && s.OnEnterEventAlluxTargets != null));
+
+            this.m_writer.WriteLine($"{returnType} SetState({ComposeInstanceParameters($"{STATES_ENUM_NAME} state")})");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                if (needLoop)
+                {
+                    this.m_writer.WriteLine("for (;;)");
+                    this.m_writer.WriteLine("{");
+                    ++this.m_writer.Indent;
+                };
+                this.m_writer.WriteLine("switch (state)");
+                this.m_writer.WriteLine("{");
+                {
+                    foreach (StateDescr state in this.m_stateMachine.States.Values)
+                    {
+                        this.m_writer.WriteLine($"case {STATES_ENUM_NAME}::{state.Name}:");
+                        ++this.m_writer.Indent;
+                        {
+                            List<StateDescr> chain = CollectNextStateChain(state);
+                            string? cycleTarget = chain.Last().NextStateName;
+                            WriteStateChainEnterCode(returnType, chain, needLoop && cycleTarget == null);
+                            if (cycleTarget != null)
+                            {
+                                this.m_writer.WriteLine($"state = {STATES_ENUM_NAME}::{cycleTarget};");
+                                this.m_writer.WriteLine("continue;");
+                            }
+                            else
+                            {
+                                this.m_writer.WriteLine("break;");
+                            };
+                        }
+                        this.m_writer.WriteLine();
+                        --this.m_writer.Indent;
+                    };
+
+                    this.m_writer.WriteLine($"default:");
+                    ++this.m_writer.Indent;
+                    {
+                        this.m_writer.WriteLine(ComposeErrorStatement(returnType, "unexpected_state", null, "\"Unexpected state \" /* + state*/"));
+                    }
+                    --this.m_writer.Indent;
+                }
+                this.m_writer.WriteLine("}");
+                if (needLoop)
+                {
+                    this.m_writer.WriteLine("break;");
+                    --this.m_writer.Indent;
+                    this.m_writer.WriteLine("}");
+                };
+                WriteSuccessReturn(returnType);
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        //state followed by its next_state successors, up to the first repeated one
+        private List<StateDescr> CollectNextStateChain(StateDescr state)
+        {
+            List<StateDescr> chain = new List<StateDescr>() { state };
+            while (chain.Last().NextStateName is string next && !chain.Any(s => s.Name == next))
+            {
+                chain.Add(this.m_stateMachine.States[next]);
+            }
+            return chain;
+        }
+
+        private void WriteProcessEvent(EventDescr @event)
+        {
+            string returnType = ComposeReturnType(false, false);
+            this.m_writer.WriteLine($"{returnType} ProcessEvent__{@event.Name}({ComposeInstanceParameters(ComposeEventParameters(@event))})");
+            this.m_writer.WriteLine("{");
+            if (this.m_settings.DispatchMode == CppDispatchMode.table && !this.m_writingPool)
+            {
+                ++this.m_writer.Indent;
+                int invokerIndex = this.m_invokers.IndexOf(@event.Name);
+                WriteTableDispatch(returnType, $"{invokerIndex} /*{@event.Name}*/", $"EventId::{@event.Name}", false);
+                WriteTableTransitionCallbacks(returnType, ComposeCallbackSlotScope(false, @event.Name));
+                WriteTableTransitionApply(returnType, $"{invokerIndex} /*{@event.Name}*/", $"EventId::{@event.Name}", false);
+                WriteTraceRecord("traceFrom", $"{invokerIndex} /*{@event.Name}*/", ComposeStateVariable());
+                WriteSuccessReturn(returnType);
+                --this.m_writer.Indent;
+            }
+            else
+            {
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine($"switch ({ComposeStateVariable()})");
+                this.m_writer.WriteLine("{");
+                {
+                    foreach (StateDescr state in this.m_stateMachine.States.Values)
+                    {
+                        if (state.EventEdges != null && state.EventEdges.TryGetValue(@event.Name, out EdgeDescr? edge))
+                        {
+                            this.m_writer.WriteLine($"case {STATES_ENUM_NAME}::{state.Name}:");
+                            ++this.m_writer.Indent;
+                            {
+                                WriteEdgeTraverse(returnType, state, edge, true, out bool throwsException);
+                                if (!throwsException)
+                                {
+                                    this.m_writer.WriteLine("break;");
+                                }
+                            }
+                            this.m_writer.WriteLine();
+                            --this.m_writer.Indent;
+                        }
+                    };
+
+                    this.m_writer.WriteLine($"default:");
+                    ++this.m_writer.Indent;
+                    {
+                        WriteStatsIncrement($"notExpected[{this.m_invokers.IndexOf(@event.Name)} /*{@event.Name}*/]");
+                        WriteTraceRecord(ComposeTraceId(ComposeStateVariable()), $"{this.m_invokers.IndexOf(@event.Name)} /*{@event.Name}*/", null);
+                        this.m_writer.WriteLine(ComposeErrorStatement(returnType, "event_not_expected", $"EventId::{@event.Name}", $"\"Event {@event.Name} is not expected in current state \" /* + this.CurrentState*/"));
+                    }
+                    --this.m_writer.Indent;
+                }
+                this.m_writer.WriteLine("}");
+                WriteSuccessReturn(returnType);
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        private string ComposeEventParameters(EventDescr @event)
+        {
+            return String.Join(", ", @event.Args.Select(arg => $"{ComposeArgType(@event, arg)} {arg.Key}"));
+        }
+
+        private string ComposeEventArgTypes(EventDescr @event)
+        {
+            return String.Join(", ", @event.Args.Select(arg => ComposeArgType(@event, arg)));
+        }
+
+        private ArgPassMode GetArgPassMode(EventDescr @event, string argName)
+        {
+            return @event.ArgPassModes.TryGetValue(argName, out ArgPassMode passMode) ? passMode : this.m_settings.ArgPassMode;
+        }
+
+        private static readonly Regex s_vectorTypeRegex = new Regex(@"^\s*(?:std::)?vector\s*<(.+)>\s*$", RegexOptions.Compiled);
+
+        private string ComposeArgType(EventDescr @event, KeyValuePair<string, string> arg)
+        {
+            string type = arg.Value.Trim();
+            switch (GetArgPassMode(@event, arg.Key))
+            {
+            case ArgPassMode.value:
+            case ArgPassMode.move:
+                return arg.Value;
+            case ArgPassMode.const_ref:
+                return $"const {type}&";
+            case ArgPassMode.view:
+                if (type == "std::string" || type == "string")
+                {
+                    return "std::string_view";
+                };
+                Match match = s_vectorTypeRegex.Match(type);
+                if (match.Success)
+                {
+                    return $"std::span<const {match.Groups[1].Value.Trim()}>";
+                };
+                return $"const {type}&";
+            default:
+                throw new Exception("Unexpected pass mode " + GetArgPassMode(@event, arg.Key));
+            }
+        }
+
+        private static string ComposeBatchTraverseHelperName(StateDescr state, EventDescr @event)
+        {
+            return $"BatchTraverse__{state.Name}__{@event.Name}";
+        }
+
+        private void WriteProcessEventBatch(EventDescr @event, bool structOfArrays)
+        {
+            string returnType = ComposeReturnType(false, false);
+            //machines are grouped by current state with a counting sort, then each group runs the same transition code in a tight loop.
+            //grouped indices go to scratch space provided by caller, so nothing is allocated per call.
+            //struct-of-arrays variant reads states from a dense array kept by caller, scatters indices in order of machines,
+            //and writes states back after transitions, so every machine is read only by its transition.
+            //otherwise state of every machine is read only once before transitions: it's packed with machine index into scratch,
+            //which is then grouped in place, so a batch of machines that don't fit in cache doesn't go through them once more.
+            //callbacks must not process events of other machines of the batch, which is checked by an assert only
+            string className = this.m_settings.ClassName!;
+            string parameters = structOfArrays
+                ? $"std::span<{STATES_ENUM_NAME}> states, std::span<{className}* const> machines, std::span<size_t> scratch"
+                : $"std::span<{className}* const> machines, std::span<size_t> scratch";
+            if (@event.Args.Count > 0)
+            {
+                parameters += ", " + ComposeEventParameters(@event);
+            };
+            string stateOf = structOfArrays ? "states[i]" : "machines[i]->m_currentState";
+            string args = String.Join(", ", @event.Args.Select(arg => arg.Key));
+
+            this.m_writer.WriteLine($"static {returnType} ProcessEventBatch__{@event.Name}({parameters})");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            {
+                WriteBatchArgumentsCheck(@event, structOfArrays);
+                if (!structOfArrays)
+                {
+                    int stateBits = 1;
+                    while ((1 << stateBits) < this.m_stateMachine.States.Count)
+                    {
+                        ++stateBits;
+                    };
+                    this.m_writer.WriteLine($"constexpr size_t STATE_BITS = {stateBits};");
+                };
+                this.m_writer.WriteLine($"std::array<size_t, {this.m_stateMachine.States.Count + 1}> offsets{{}};");
+                this.m_writer.WriteLine("for (size_t i = 0; i < machines.size(); ++i)");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                if (structOfArrays)
+                {
+                    this.m_writer.WriteLine($"++offsets[static_cast<size_t>({stateOf}) + 1];");
+                }
+                else
+                {
+                    this.m_writer.WriteLine($"const size_t state = static_cast<size_t>({stateOf});");
+                    this.m_writer.WriteLine("++offsets[state + 1];");
+                    this.m_writer.WriteLine("scratch[i] = (i << STATE_BITS) | state;");
+                };
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+
+                //check all the machines before changing any of them
+                foreach (StateDescr state in this.m_stateMachine.States.Values)
+                {
+                    EdgeDescr? edge = null;
+                    state.EventEdges?.TryGetValue(@event.Name, out edge);
+                    string message;
+                    string errorCode;
+                    if (edge == null)
+                    {
+                        message = $"Event {@event.Name} is not expected in current state";
+                        errorCode = "event_not_expected";
+                    }
+                    else if (edge.Target != null && edge.Target.TargetType == EdgeTargetType.failure)
+                    {
+                        message = $"Event {@event.Name} is forbidden in current state";
+                        errorCode = "event_forbidden";
+                    }
+                    else
+                    {
+                        continue;
+                    };
+                    string count = $"offsets[static_cast<size_t>({STATES_ENUM_NAME}::{state.Name}) + 1]";
+                    string condition = $"{count} != 0";
+                    string error = ComposeErrorResult(errorCode, $"EventId::{@event.Name}", $"{STATES_ENUM_NAME}::{state.Name}");
+                    //every machine in a wrong state is counted
+                    string statsCounter = $"{(edge == null ? "notExpected" : "forbidden")}[{this.m_invokers.IndexOf(@event.Name)} /*{@event.Name}*/]";
+                    string statsIncrement = ComposeStatsIncrement(statsCounter, count);
+                    switch (this.m_settings.ErrorMode)
+                    {
+                    case CppErrorMode.exceptions:
+                        this.m_writer.WriteLine($"if ({condition}) {{ {statsIncrement}throw std::runtime_error(\"{message}\"); }}");
+                        break;
+                    case CppErrorMode.status:
+                        this.m_writer.WriteLine($"if ({condition}) [[unlikely]] {{ {statsIncrement}return {error}; }}");
+                        break;
+                    case CppErrorMode.handler:
+                        //every machine in a wrong state is reported, and none of them is changed
+                        this.m_writer.WriteLine($"if ({condition}) [[unlikely]]");
+                        this.m_writer.WriteLine("{");
+                        ++this.m_writer.Indent;
+                        WriteStatsIncrement(statsCounter, count);
+                        this.m_writer.WriteLine("for (size_t i = 0; i < machines.size(); ++i)");
+                        this.m_writer.WriteLine("{");
+                        ++this.m_writer.Indent;
+                        this.m_writer.WriteLine($"if ({stateOf} == {STATES_ENUM_NAME}::{state.Name}) {{ machines[i]->ReportError({error}); }}");
+                        --this.m_writer.Indent;
+                        this.m_writer.WriteLine("}");
+                        this.m_writer.WriteLine("return;");
+                        --this.m_writer.Indent;
+                        this.m_writer.WriteLine("}");
+                        break;
+                    default:
+                        throw new Exception("Unexpected error mode " + this.m_settings.ErrorMode);
+                    }
+                };
+
+                if (this.m_settings.Instrumentation != CppInstrumentation.none)
+                {
+                    //transitions are counted per group, helpers don't count them
+                    this.m_writer.WriteLine($"{ComposeStatsClassName()}::Counters& stats = {ComposeStatsClassName()}::Local();");
+                    foreach (StateDescr state in this.m_stateMachine.States.Values)
+                    {
+                        if (state.EventEdges != null && state.EventEdges.TryGetValue(@event.Name, out EdgeDescr? edge) && (edge.Target == null || edge.Target.TargetType != EdgeTargetType.failure))
+                        {
+                            this.m_writer.WriteLine($"stats.{ComposeTransitionCounter($"static_cast<size_t>({STATES_ENUM_NAME}::{state.Name})", @event.Name)}.Increment(offsets[static_cast<size_t>({STATES_ENUM_NAME}::{state.Name}) + 1]);");
+                        };
+                    }
+                };
+                this.m_writer.WriteLine("for (size_t s = 1; s < offsets.size(); ++s)");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("offsets[s] += offsets[s - 1];");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine("decltype(offsets) next = offsets;");
+                if (structOfArrays)
+                {
+                    //dense states are cheap to read twice, and indices scattered in order keep machines of a group in memory order
+                    this.m_writer.WriteLine("for (size_t i = 0; i < machines.size(); ++i)");
+                    this.m_writer.WriteLine("{");
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine($"scratch[next[static_cast<size_t>({stateOf})]++] = i;");
+                    --this.m_writer.Indent;
+                    this.m_writer.WriteLine("}");
+                }
+                else
+                {
+                    //entries are swapped to their groups in place, machines that already come grouped by state are left as they are
+                    this.m_writer.WriteLine("for (size_t s = 0; s + 1 < offsets.size(); ++s)");
+                    this.m_writer.WriteLine("{");
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine("while (next[s] < offsets[s + 1])");
+                    this.m_writer.WriteLine("{");
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine("const size_t group = scratch[next[s]] & ((size_t{ 1 } << STATE_BITS) - 1);");
+                    this.m_writer.WriteLine("if (group == s) { ++next[s]; }");
+                    this.m_writer.WriteLine("else { std::swap(scratch[next[s]], scratch[next[group]++]); }");
+                    --this.m_writer.Indent;
+                    this.m_writer.WriteLine("}");
+                    --this.m_writer.Indent;
+                    this.m_writer.WriteLine("}");
+                };
+
+                foreach (StateDescr state in this.m_stateMachine.States.Values)
+                {
+                    if (!NeedBatchTraceRecord(state, @event))
+                    {
+                        //groups of states not accepting the event are empty
+                        continue;
+                    };
+                    bool needHelper = NeedBatchTraverseHelper(state, @event);
+                    this.m_writer.WriteLine($"for (size_t g = offsets[static_cast<size_t>({STATES_ENUM_NAME}::{state.Name})]; g < offsets[static_cast<size_t>({STATES_ENUM_NAME}::{state.Name}) + 1]; ++g)");
+                    this.m_writer.WriteLine("{");
+                    ++this.m_writer.Indent;
+                    {
+                        this.m_writer.WriteLine(structOfArrays ? "const size_t i = scratch[g];" : "const size_t i = scratch[g] >> STATE_BITS;");
+                        this.m_writer.WriteLine($"assert(machines[i]->m_currentState == {STATES_ENUM_NAME}::{state.Name} && \"Callbacks should not process events of other machines of the batch\");");
+                        if (!needHelper)
+                        {
+                            //plain no_change edge, helper records traversals otherwise
+                            if (this.m_settings.Trace)
+                            {
+                                this.m_writer.WriteLine($"{ComposeTraceClassName()}::Record(reinterpret_cast<uintptr_t>(machines[i]), {ComposeTraceId($"{STATES_ENUM_NAME}::{state.Name}")}, {this.m_invokers.IndexOf(@event.Name)} /*{@event.Name}*/, {ComposeTraceId($"{STATES_ENUM_NAME}::{state.Name}")});");
+                            };
+                        }
+                        else if (this.m_settings.ErrorMode == CppErrorMode.status)
+                        {
+                            this.m_writer.WriteLine($"const Result result = machines[i]->{ComposeBatchTraverseHelperName(state, @event)}({args});");
+                        }
+                        else
+                        {
+                            this.m_writer.WriteLine($"machines[i]->{ComposeBatchTraverseHelperName(state, @event)}({args});");
+                        };
+                        if (structOfArrays && needHelper)
+                        {
+                            this.m_writer.WriteLine("states[i] = machines[i]->m_currentState;");
+                        };
+                        if (this.m_settings.ErrorMode == CppErrorMode.status && needHelper)
+                        {
+                            this.m_writer.WriteLine("if (!result) [[unlikely]] { return result; }");
+                        };
+                    }
+                    --this.m_writer.Indent;
+                    this.m_writer.WriteLine("}");
+                }
+                WriteSuccessReturn(returnType);
+            }
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        private void WriteBatchArgumentsCheck(EventDescr @event, bool structOfArrays)
+        {
+            string condition;
+            string message;
+            if (structOfArrays)
+            {
+                //a stale state would put the machine into a wrong group, but checking it reads every machine, which this overload is to avoid
+                this.m_writer.WriteLine("#ifndef NDEBUG");
+                this.m_writer.WriteLine("for (size_t i = 0; i < states.size() && i < machines.size(); ++i)");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("assert(states[i] == machines[i]->m_currentState && \"Batch states should be current states of machines\");");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine("#endif");
+                condition = "states.size() != machines.size() || scratch.size() < machines.size()";
+                message = "\"Batch states and machines differ in size, or scratch is too small\"";
+            }
+            else
+            {
+                condition = "scratch.size() < machines.size()";
+                message = "\"Batch scratch is smaller than machines\"";
+            };
+            switch (this.m_settings.ErrorMode)
+            {
+            case CppErrorMode.exceptions:
+                this.m_writer.WriteLine($"if ({condition}) {{ throw std::runtime_error({message}); }}");
+                break;
+            case CppErrorMode.status:
+                this.m_writer.WriteLine($"if ({condition}) [[unlikely]] {{ return {ComposeErrorResult("invalid_batch", $"EventId::{@event.Name}", $"{STATES_ENUM_NAME}{{}}")}; }}");
+                break;
+            case CppErrorMode.handler:
+                //the whole batch is rejected, so the error is reported to every machine of it
+                this.m_writer.WriteLine($"if ({condition}) [[unlikely]]");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine($"for ({this.m_settings.ClassName}* machine : machines)");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine($"machine->ReportError({ComposeErrorResult("invalid_batch", $"EventId::{@event.Name}", "machine->m_currentState")});");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine("return;");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                break;
+            default:
+                throw new Exception("Unexpected error mode " + this.m_settings.ErrorMode);
+            }
+        }
+
+
+        private bool NeedBatchTraverseHelper(StateDescr state, EventDescr @event)
+        {
+            if (state.EventEdges == null || !state.EventEdges.TryGetValue(@event.Name, out EdgeDescr? edge))
+            {
+                return false;
+            };
+            if (edge.Target != null && edge.OnTraverseEventTypes.Count == 0)
+            {
+                //nothing to do for plain no_change edges, and failures are checked in advance
+                return edge.Target.TargetType == EdgeTargetType.state;
+            };
+            return edge.Target == null || edge.Target.TargetType != EdgeTargetType.failure;
+        }
+
+        private bool NeedBatchTraceRecord(StateDescr state, EventDescr @event)
+        {
+            return state.EventEdges != null
+                && state.EventEdges.TryGetValue(@event.Name, out EdgeDescr? edge)
+                && (edge.Target == null || edge.Target.TargetType != EdgeTargetType.failure);
+        }
+
+        private void WriteBatchTraverseHelpers()
+        {
+            foreach (EventDescr @event in this.m_stateMachine.Events.Values)
+            {
+                foreach (StateDescr state in this.m_stateMachine.States.Values)
+                {
+                    if (!NeedBatchTraverseHelper(state, @event))
+                    {
+                        continue;
+                    };
+                    //args are left unnamed when no callback of the edge takes them
+                    EdgeDescr edge = state.EventEdges![@event.Name];
+                    bool argsUsed = edge.OnTraverseEventTypes.Any(t => { ExportHelper.ComposeEdgeTraveseCallbackName(t, state, edge, out bool needArgs, out _); return needArgs; });
+                    string parameters = argsUsed ? ComposeEventParameters(@event) : ComposeEventArgTypes(@event);
+                    string returnType = ComposeReturnType(false, false);
+                    this.m_writer.WriteLine($"{returnType} {ComposeBatchTraverseHelperName(state, @event)}({parameters})");
+                    this.m_writer.WriteLine("{");
+                    ++this.m_writer.Indent;
+                    WriteEdgeTraverse(returnType, state, edge, false, out _);
+                    WriteSuccessReturn(returnType);
+                    --this.m_writer.Indent;
+                    this.m_writer.WriteLine("}");
+                    this.m_writer.WriteLine();
+                }
+            }
+        }
+
+        private void WriteOnTimer()
+        {
+            string returnType = ComposeReturnType(false, true);
+            this.m_writer.WriteLine($"{returnType} OnTimer({ComposeInstanceParameters("T* timer")})");
+            this.m_writer.WriteLine("{");
+            if (this.m_settings.DispatchMode == CppDispatchMode.table && !this.m_writingPool)
+            {
+                ++this.m_writer.Indent;
+                if (this.m_stateMachine.Timers.Count == 0)
+                {
+                    WriteStatsIncrement("unexpectedTimers");
+                    WriteTraceRecord(ComposeTraceId(ComposeStateVariable()), null, null);
+                    this.m_writer.WriteLine(ComposeErrorStatement(returnType, "unexpected_timer", null, "\"No timer events expected in current state\""));
+                }
+                else
+                {
+                    this.m_writer.WriteLine("size_t invoker;");
+                    foreach (string timer in this.m_stateMachine.Timers.Keys)
+                    {
+                        this.m_writer.WriteLine($"if ({ComposeTimerMatch(timer)}) {{ invoker = {this.m_invokers.IndexOf(timer)}; }}");
+                        this.m_writer.Write("else ");
+                    }
+                    if (this.m_settings.Instrumentation != CppInstrumentation.none || this.m_settings.Trace)
+                    {
+                        this.m_writer.WriteLine("{");
+                        ++this.m_writer.Indent;
+                        WriteStatsIncrement("unexpectedTimers");
+                        WriteTraceRecord(ComposeTraceId(ComposeStateVariable()), null, null);
+                        this.m_writer.WriteLine(ComposeErrorStatement(returnType, "unexpected_timer", null, "\"Unexpected timer\""));
+                        --this.m_writer.Indent;
+                        this.m_writer.WriteLine("}");
+                    }
+                    else
+                    {
+                        this.m_writer.WriteLine($"{{ {ComposeErrorStatement(returnType, "unexpected_timer", null, "\"Unexpected timer\"")} }}");
+                    };
+                    WriteTableDispatch(returnType, "invoker", "static_cast<EventId>(invoker)", true);
+                    WriteTableTransitionCallbacks(returnType, ComposeCallbackSlotScope(true, ""));
+                    WriteTableTransitionApply(returnType, "invoker", "static_cast<EventId>(invoker)", true);
+                    WriteTraceRecord("traceFrom", "static_cast<uint16_t>(invoker)", ComposeStateVariable());
+                };
+                --this.m_writer.Indent;
+            }
+            else
+            {
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine($"switch ({ComposeStateVariable()})");
+                this.m_writer.WriteLine("{");
+                {
+                    foreach (StateDescr state in this.m_stateMachine.States.Values)
+                    {
+                        if (state.TimerEdges != null)
+                        {
+                            this.m_writer.WriteLine($"case {STATES_ENUM_NAME}::{state.Name}:");
+                            ++this.m_writer.Indent;
+                            {
+                                foreach (EdgeDescr edge in state.TimerEdges.Values)
+                                {
+                                    this.m_writer.WriteLine($"if ({ComposeTimerMatch(edge.InvokerName)})");
+                                    this.m_writer.WriteLine("{");
+                                    {
+                                        ++this.m_writer.Indent;
+                                        WriteEdgeTraverse(returnType, state, edge, true, out _);
+                                        --this.m_writer.Indent;
+                                    }
+                                    this.m_writer.WriteLine("}");
+                                    this.m_writer.Write("else ");
+                                }
+                                this.m_writer.WriteLine();
+                                this.m_writer.WriteLine("{");
+                                {
+                                    ++this.m_writer.Indent;
+                                    WriteStatsIncrement("unexpectedTimers");
+                                    WriteTraceRecord(ComposeTraceId(ComposeStateVariable()), null, null);
+                                    //the other branch of the last if is already marked as unlikely when it's a forbidden timer, and both can't be
+                                    bool afterFailure = state.TimerEdges.Values.Last().Target?.TargetType == EdgeTargetType.failure;
+                                    this.m_writer.WriteLine(ComposeErrorStatement(returnType, "unexpected_timer", null, $"\"Unexpected timer finish in state {state.Name}\"", !afterFailure));
+                                    --this.m_writer.Indent;
+                                }
+                                this.m_writer.WriteLine("}");
+                                this.m_writer.WriteLine("break;");
+                            }
+                            this.m_writer.WriteLine();
+                            --this.m_writer.Indent;
+                        }
+                    };
+
+                    this.m_writer.WriteLine($"default:");
+                    ++this.m_writer.Indent;
+                    {
+                        WriteStatsIncrement("unexpectedTimers");
+                        WriteTraceRecord(ComposeTraceId(ComposeStateVariable()), null, null);
+                        this.m_writer.WriteLine(ComposeErrorStatement(returnType, "unexpected_timer", null, "\"No timer events expected in current state\" /*+ this.CurrentState*/"));
+                    }
+                    --this.m_writer.Indent;
+                }
+                this.m_writer.WriteLine("}");
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        private void WriteEdgeTraverse(string returnType, StateDescr state, EdgeDescr edge, bool countTransition, out bool throwsException)
+        {
+            if (countTransition && (edge.Target == null || edge.Target.TargetType != EdgeTargetType.failure))
+            {
+                WriteStatsIncrement(ComposeTransitionCounter($"static_cast<size_t>({STATES_ENUM_NAME}::{state.Name})", edge.InvokerName));
+            };
+            WriteEdgeTraverseCallbacks(returnType, state, edge);
+
+            throwsException = false;
+            //only happens in case of no function
+            if (edge.Target != null)
+            {
+                switch (edge.Target.TargetType)
+                {
+                case EdgeTargetType.state:
+                    WriteSetStateCall(returnType, $"{STATES_ENUM_NAME}::{edge.Target.StateName}");
+                    break;
+                case EdgeTargetType.failure:
+                    WriteStatsIncrement($"forbidden[{this.m_invokers.IndexOf(edge.InvokerName)} /*{edge.InvokerName}*/]");
+                    WriteTraceRecord(ComposeTraceId($"{STATES_ENUM_NAME}::{state.Name}"), $"{this.m_invokers.IndexOf(edge.InvokerName)} /*{edge.InvokerName}*/", null);
+                    this.m_writer.WriteLine(ComposeErrorStatement(returnType, "event_forbidden", $"EventId::{edge.InvokerName}", $"\"Event {edge.InvokerName} is forbidden in current state\""));
+                    throwsException = true;
+                    break;
+                case EdgeTargetType.no_change:
+                    //notnhing to do
+                    break;
+                default:
+                    throw new Exception("Unexpected type " + edge.Target.TargetType);
+                }
+            }
+            if (!throwsException)
+            {
+                //state after next_state and on_enter transitions
+                WriteTraceRecord(ComposeTraceId($"{STATES_ENUM_NAME}::{state.Name}"), $"{this.m_invokers.IndexOf(edge.InvokerName)} /*{edge.InvokerName}*/", ComposeStateVariable());
+            };
+        }
+
+        private void WriteEdgeTraverseCallbacks(string returnType, StateDescr state, EdgeDescr edge)
+        {
+            //args in move mode are moved to the last callback using them
+            EdgeTraverseCallbackType? lastArgsUse = edge.OnTraverseEventTypes
+                .Where(t => { ExportHelper.ComposeEdgeTraveseCallbackName(t, state, edge, out bool needArgs, out _); return needArgs; })
+                .Cast<EdgeTraverseCallbackType?>()
+                .LastOrDefault();
+            foreach (EdgeTraverseCallbackType callbackType in edge.OnTraverseEventTypes)
+            {
+                string callbackName = ExportHelper.ComposeEdgeTraveseCallbackName(callbackType, state, edge, out bool needArgs, out bool isFunction);
+                bool lastUse = callbackType == lastArgsUse;
+
+                if (!isFunction)
+                {
+                    //regular callback code
+                    WriteCallbackInvocation(callbackName, this.m_settings.CallbackMode == CppCallbackMode.actions
+                        ? ComposeActionRecordArgs(needArgs, edge, lastUse)
+                        : ComposeEdgeTraverseCallbackArgs(needArgs, edge, lastUse)
+                    );
+                }
+                else
+                {
+                    //functions are for choosing next state based on result
+                    if (edge.Targets == null)
+                    {
+                        throw new Exception("Should not happen! Check parser!");
+                    };
+
+                    this.m_writer.WriteLine("{"); //visibility guard
+                    ++this.m_writer.Indent;
+                    {
+                        WriteFunctionCallbackInvocation(callbackName, ComposeEdgeTraverseCallbackArgs(needArgs, edge, lastUse));
+
+                        this.m_writer.WriteLine($"if (nextState)");
+                        this.m_writer.WriteLine("{");
+                        ++this.m_writer.Indent;
+                        {
+                            this.m_writer.WriteLine($"switch (*nextState)");
+                            this.m_writer.WriteLine("{");
+                            {
+                                foreach (KeyValuePair<string, EdgeTarget> subEdge in edge.Targets)
+                                {
+                                    if (subEdge.Value.TargetType == EdgeTargetType.state)
+                                    {
+                                        this.m_writer.WriteLine($"case {STATES_ENUM_NAME}::{subEdge.Value.StateName}:");
+                                        ++this.m_writer.Indent;
+                                        this.m_writer.WriteLine($"/*{subEdge.Key}*/");
+                                        WriteSetStateCall(returnType, $"{STATES_ENUM_NAME}::{subEdge.Value.StateName}");
+                                        this.m_writer.WriteLine($"break;");
+                                        --this.m_writer.Indent;
+                                    }
+                                };
+                                this.m_writer.WriteLine($"default:");
+                                ++this.m_writer.Indent;
+                                this.m_writer.WriteLine(ComposeErrorStatement(returnType, "unexpected_target_state", $"EventId::{edge.InvokerName}", "\"Unexpected target state was chosen by callback function " + callbackName + "\""));
+                                --this.m_writer.Indent;
+                            }
+                            this.m_writer.WriteLine("}"); //switch
+                        }
+                        --this.m_writer.Indent;
+                        this.m_writer.WriteLine("}"); //if has value
+
+                    }
+                    --this.m_writer.Indent;
+                    this.m_writer.WriteLine("}"); //visibility guard
+                }
+            };
+        }
+
+        private string ComposeEdgeTraverseCallbackArgs(bool needArgs, EdgeDescr edge, bool lastUse)
+        {
+            if (!needArgs)
+            {
+                return "";
+            };
+            EventDescr @event = this.m_stateMachine.Events[edge.InvokerName];
+            return String.Join(", ", @event.Args.Select(arg => lastUse && GetArgPassMode(@event, arg.Key) == ArgPassMode.move ? $"std::move({arg.Key})" : arg.Key));
+        }
+
+        //records own their args, so views are copied into the types declared for the event
+        private string ComposeActionRecordArgs(bool needArgs, EdgeDescr edge, bool lastUse)
+        {
+            if (!needArgs)
+            {
+                return "";
+            };
+            EventDescr @event = this.m_stateMachine.Events[edge.InvokerName];
+            return String.Join(", ", @event.Args.Select(arg => {
+                ArgPassMode passMode = GetArgPassMode(@event, arg.Key);
+                if (passMode == ArgPassMode.move && lastUse)
+                {
+                    return $"std::move({arg.Key})";
+                }
+                else if (passMode == ArgPassMode.view && ComposeArgType(@event, arg).StartsWith("std::string_view"))
+                {
+                    return $"{arg.Value.Trim()}({arg.Key})";
+                }
+                else if (passMode == ArgPassMode.view && ComposeArgType(@event, arg).StartsWith("std::span"))
+                {
+                    return $"{arg.Value.Trim()}({arg.Key}.begin(), {arg.Key}.end())";
+                };
+                return arg.Key;
+            }));
+        }
+
+        private void WriteCallbackInvocation(string callbackName, string args)
+        {
+            args = ComposeInstanceArguments(args);
+            string latencyScope = ComposeLatencyScope(callbackName);
+            if (latencyScope.Length > 0)
+            {
+                latencyScope = $"{latencyScope} ";
+            };
+            if (this.m_settings.CallbackMode == CppCallbackMode.handler)
+            {
+                //handler is not required to implement non-function callbacks, but a method with this name that can't be called with these args is a mistake
+                this.m_writer.WriteLine($"if constexpr (requires {{ m_handler.{callbackName}({args}); }}) {{ {latencyScope}m_handler.{callbackName}({args}); }}");
+                this.m_writer.WriteLine($"else {{ static_assert(!requires {{ &Handler::{callbackName}; }}, \"Handler::{callbackName} doesn't match the expected signature\"); }}");
+            }
+            else if (this.m_settings.CallbackMode == CppCallbackMode.actions)
+            {
+                //args are already converted to the types of record fields. Appending is not a callback, so it's not measured
+                string record = args.Length > 0 ? $"typename Actions::{callbackName}{{ {args} }}" : $"typename Actions::{callbackName}{{}}";
+                this.m_writer.WriteLine($"if (m_actions != nullptr) {{ m_actions->push_back(Action{{ this, {record} }}); }}");
+            }
+            else if (this.m_sharedCallbacks)
+            {
+                this.m_writer.WriteLine($"if (m_callbacks->{callbackName}) {{ {latencyScope}m_callbacks->{callbackName}({ComposeSharedCallbackArgs("m_context", args)}); }}");
+            }
+            else
+            {
+                this.m_writer.WriteLine($"if ({callbackName}) {{ {latencyScope}{callbackName}({args}); }}");
+            }
+        }
+
+        private void WriteFunctionCallbackInvocation(string callbackName, string args)
+        {
+            string invocation = ComposeFunctionCallbackInvocation(callbackName, args);
+            string latencyScope = ComposeLatencyScope(callbackName);
+            if (latencyScope.Length == 0)
+            {
+                this.m_writer.WriteLine($"std::optional<{STATES_ENUM_NAME}> nextState = {invocation};");
+                return;
+            };
+            //measured scope should not include the transition to the chosen state
+            this.m_writer.WriteLine($"std::optional<{STATES_ENUM_NAME}> nextState;");
+            this.m_writer.WriteLine($"{{ {latencyScope} nextState = {invocation}; }}");
+        }
+
+        private string ComposeFunctionCallbackInvocation(string callbackName, string args)
+        {
+            args = ComposeInstanceArguments(args);
+            //function callbacks are mandatory in all modes
+            if (this.m_settings.CallbackMode == CppCallbackMode.handler)
+            {
+                return $"m_handler.{callbackName}({args})";
+            }
+            else if (this.m_sharedCallbacks)
+            {
+                return $"m_callbacks->{callbackName}({ComposeSharedCallbackArgs("m_context", args)})";
+            }
+            else
+            {
+                return $"{callbackName}({args})";
+            }
+        }
+
+        private static string ComposeSharedCallbackArgs(string context, string args)
+        {
+            return args.Length > 0 ? $"{context}, {args}" : context;
+        }
+
+        private void WriteTimerStart(string timer, string delay)
+        {
+            if (IsWritingMappedPool())
+            {
+                this.m_writer.WriteLine($"m_slots[handle].{timer}_deadline = GetMonotonicSeconds() + {delay};");
+            };
+            WriteTimerOwnerAssignment(timer);
+            if (IsWritingLazyTimers())
+            {
+                string timerObject = this.m_timerToObject[timer];
+                this.m_writer.WriteLine($"AcquireTimer({timerObject}, \"{timerObject}\")->StartOrReset({delay});");
+                return;
+            };
+            this.m_writer.WriteLine($"{ComposeTimerAccess(timer)}StartOrReset({delay});");
+        }
+
+        //shared timer object is stopped only if it's started for this timer.
+        //restartedLater: the timer object is then started for another timer, so only the deadline is cleared
+        private void WriteTimerStop(string timer, bool restartedLater = false)
+        {
+            if (IsWritingMappedPool())
+            {
+                this.m_writer.WriteLine($"m_slots[handle].{timer}_deadline = 0;");
+            };
+            string timerObject = this.m_timerToObject[timer];
+            string stop = IsWritingLazyTimers() ? $"ReleaseTimer({timerObject});" : $"{ComposeTimerAccess(timer)}Stop();";
+            if (restartedLater)
+            {
+                return;
+            }
+            else if (IsSharedTimerObject(timerObject))
+            {
+                this.m_writer.WriteLine($"if ({ComposeTimerOwnerAccess(timerObject)} == {this.m_timerObjects[timerObject].IndexOf(timer)}) {{ {stop} }}");
+            }
+            else
+            {
+                this.m_writer.WriteLine(stop);
+            };
+        }
+
+        private bool IsWritingLazyTimers()
+        {
+            return this.m_settings.LazyTimers && !this.m_writingPool;
+        }
+
+        //timers are deleted right away, including from their own fired callbacks, the same way as by the destructor
+        private void WriteLazyTimerHelpers()
+        {
+            if (this.m_stateMachine.Timers.Count == 0)
+            {
+                return;
+            };
+            this.m_writer.WriteLine("T* AcquireTimer(T*& timer, const char* timerName)");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("if (timer == nullptr)");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine($"timer = m_timerFactory(timerName, std::bind(&{this.m_settings.ClassName}::OnTimer, this, std::placeholders::_1));");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine("return timer;");
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+
+            this.m_writer.WriteLine("void ReleaseTimer(T*& timer)");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("if (timer != nullptr)");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("timer->Stop();");
+                this.m_writer.WriteLine("delete timer;");
+                this.m_writer.WriteLine("timer = nullptr;");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        private void WriteTimerOwnerAssignment(string timer)
+        {
+            string timerObject = this.m_timerToObject[timer];
+            if (IsSharedTimerObject(timerObject))
+            {
+                this.m_writer.WriteLine($"{ComposeTimerOwnerAccess(timerObject)} = {this.m_timerObjects[timerObject].IndexOf(timer)}; //{timer}");
+            };
+        }
+
+        private void WriteStart()
+        {
+            string returnType = ComposeReturnType(false, false);
+            this.m_writer.WriteLine($"{returnType} Start({ComposeInstanceParameters("")})");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                WriteStateEnterCode(returnType, this.m_stateMachine.States[this.m_stateMachine.StartState]);
+                WriteTraceRecord(null, null, ComposeStateVariable());
+                WriteSuccessReturn(returnType);
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        //back to the configuration of a newly constructed machine, keeping callbacks and timer objects.
+        //No callbacks are invoked, Start() should be called to start the machine again
+        private void WriteReset()
+        {
+            this.m_writer.WriteLine("void Reset()");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                foreach (KeyValuePair<string, List<string>> timerObject in this.m_timerObjects)
+                {
+                    if (IsWritingLazyTimers())
+                    {
+                        this.m_writer.WriteLine($"if ({timerObject.Key} != nullptr) {{ {timerObject.Key}->Stop(); }}");
+                    }
+                    else
+                    {
+                        this.m_writer.WriteLine($"{ComposeTimerAccess(timerObject.Value[0])}Stop();");
+                    };
+                    if (IsSharedTimerObject(timerObject.Key))
+                    {
+                        this.m_writer.WriteLine($"{ComposeTimerOwnerAccess(timerObject.Key)} = 0;");
+                    };
+                }
+                foreach (string timer in this.m_modifiedTimers)
+                {
+                    this.m_writer.WriteLine($"{ComposeTimerDelayVariable(timer)} = {this.m_stateMachine.Timers[timer].IntervalSeconds.ToString(CultureInfo.InvariantCulture)};");
+                }
+                this.m_writer.WriteLine($"m_currentState = {STATES_ENUM_NAME}::{this.m_stateMachine.StartState};");
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        private void WriteStateEnterCode(string returnType, StateDescr state)
+        {
+            WriteStateChainEnterCode(returnType, new List<StateDescr>() { state }, false);
+        }
+
+        //Chain is split into segments ending with on_enter callbacks. Within a segment the state is written once and
+        //only the last start or stop of every timer is performed, so callbacks observe the same state as with entering
+        //states one by one. redirectInLoop: on_enter redirect of the last state continues the SetState loop instead of recursion
+        private void WriteStateChainEnterCode(string returnType, List<StateDescr> chain, bool redirectInLoop)
+        {
+            //timers that may be running before the segment, further states of the chain are only entered from the previous one
+            HashSet<string> activeTimers = new HashSet<string>(this.m_timerLiveness.GetActiveOnEntry(chain[0].Name));
+            int segmentStart = 0;
+            for (int i = 0; i < chain.Count; ++i)
+            {
+                StateDescr state = chain[i];
+                bool isLast = i == chain.Count - 1;
+                if (!state.NeedOnEnterEvent && !isLast)
+                {
+                    continue;
+                };
+                List<StateDescr> segment = chain.GetRange(segmentStart, i - segmentStart + 1);
+                WriteStateSegmentEnterCode(segment, activeTimers);
+                foreach (StateDescr segmentState in segment)
+                {
+                    activeTimers.IntersectWith(this.m_timerLiveness.GetActiveOnEntry(segmentState.Name));
+                    activeTimers.ExceptWith(segmentState.StopTimers);
+                    activeTimers.UnionWith(segmentState.StartTimers.Keys);
+                }
+                if (state.IsFinal && IsWritingLazyTimers())
+                {
+                    //timers that are left after they fired are not needed anymore
+                    foreach (KeyValuePair<string, List<string>> timerObject in this.m_timerObjects.Where(o => !o.Value.Any(t => activeTimers.Contains(t))))
+                    {
+                        this.m_writer.WriteLine($"ReleaseTimer({timerObject.Key});");
+                    }
+                };
+                if (state.NeedOnEnterEvent)
+                {
+                    WriteStateEnterCallback(returnType, state, redirectInLoop && isLast);
+                };
+                segmentStart = i + 1;
+            }
+        }
+
+        //stops of timers that are not in activeTimers are omitted, as they can't be running there
+        private void WriteStateSegmentEnterCode(List<StateDescr> segment, IReadOnlySet<string> activeTimers)
+        {
+            this.m_writer.WriteLine($"{ComposeStateVariable()} = {STATES_ENUM_NAME}::{segment.Last().Name};");
+            foreach (StateDescr state in segment)
+            {
+                WriteStatsIncrement($"stateEnters[static_cast<size_t>({STATES_ENUM_NAME}::{state.Name})]");
+            }
+
+            //stop or start of every timer, delay modifications are kept even if the start itself is overridden
+            List<KeyValuePair<string, TimerStartDescr?>> operations = new List<KeyValuePair<string, TimerStartDescr?>>();
+            HashSet<int> overridden = new HashSet<int>();
+            foreach (StateDescr state in segment)
+            {
+                foreach (string timer in state.StopTimers)
+                {
+                    AddTimerOperation(operations, overridden, timer, null);
+                }
+                foreach (TimerStartDescr timerStart in state.StartTimers.Values)
+                {
+                    AddTimerOperation(operations, overridden, timerStart.TimerName, timerStart);
+                }
+            }
+
+            //starting a shared timer object for one timer replaces whichever of its timers was running
+            HashSet<string> startedTimerObjects = operations
+                .Where((operation, i) => operation.Value != null && !overridden.Contains(i))
+                .Select(operation => this.m_timerToObject[operation.Key])
+                .ToHashSet();
+
+            for (int i = 0; i < operations.Count; ++i)
+            {
+                string timer = operations[i].Key;
+                TimerStartDescr? timerStart = operations[i].Value;
+                if (timerStart == null)
+                {
+                    if (!overridden.Contains(i) && activeTimers.Contains(timer))
+                    {
+                        WriteTimerStop(timer, startedTimerObjects.Contains(this.m_timerToObject[timer]));
+                    };
+                }
+                else if (this.m_modifiedTimers.Contains(timer))
+                {
+                    string delayVariable = ComposeTimerDelayAccess(timer);
+                    WriteTimerDelayModification(timerStart, delayVariable);
+                    if (!overridden.Contains(i))
+                    {
+                        WriteTimerStart(timer, delayVariable);
+                    };
+                }
+                else if (!overridden.Contains(i))
+                {
+                    TimerDescr descr = this.m_stateMachine.Timers[timer];
+                    WriteTimerStart(timer, descr.IntervalSeconds.ToString(CultureInfo.InvariantCulture));
+                };
+            }
+        }
+
+        private static void AddTimerOperation(List<KeyValuePair<string, TimerStartDescr?>> operations, HashSet<int> overridden, string timer, TimerStartDescr? timerStart)
+        {
+            for (int i = 0; i < operations.Count; ++i)
+            {
+                if (operations[i].Key == timer)
+                {
+                    overridden.Add(i);
+                }
+            }
+            operations.Add(new KeyValuePair<string, TimerStartDescr?>(timer, timerStart));
+        }
+
+        private void WriteTimerDelayModification(TimerStartDescr timerStart, string delayVariable)
+        {
+            if (timerStart.Modify == null)
+            {
+                return;
+            };
+            if (timerStart.Modify.set != null)
+            {
+                this.m_writer.WriteLine($"{delayVariable} = {timerStart.Modify.set.Value.ToString(CultureInfo.InvariantCulture)};");
+            }
+            else
+            {
+                if (timerStart.Modify.multiplier != null)
+                {
+                    this.m_writer.WriteLine($"{delayVariable} *= {timerStart.Modify.multiplier.Value.ToString(CultureInfo.InvariantCulture)};");
+                };
+                if (timerStart.Modify.increment != null)
+                {
+                    this.m_writer.WriteLine($"{delayVariable} += {timerStart.Modify.increment.Value.ToString(CultureInfo.InvariantCulture)};");
+                };
+                if (timerStart.Modify.min != null)
+                {
+                    this.m_writer.WriteLine($"if ({delayVariable} < {timerStart.Modify.min.Value.ToString(CultureInfo.InvariantCulture)}) {{ {delayVariable} = {timerStart.Modify.min.Value.ToString(CultureInfo.InvariantCulture)}; }}");
+                };
+                if (timerStart.Modify.max != null)
+                {
+                    this.m_writer.WriteLine($"if ({delayVariable} > {timerStart.Modify.max.Value.ToString(CultureInfo.InvariantCulture)}) {{ {delayVariable} = {timerStart.Modify.max.Value.ToString(CultureInfo.InvariantCulture)}; }}");
+                };
+            };
+        }
+
+        private void WriteStateEnterCallback(string returnType, StateDescr state, bool redirectInLoop)
+        {
+            string callbackName = ComposeStateEnterCallback(state);
+            if (state.OnEnterEventAlluxTargets == null)
+            {
+                //regular plain callback
+                WriteCallbackInvocation(callbackName, "");
+                return;
+            };
+
+            this.m_writer.WriteLine("{"); //visibility guard
+            ++this.m_writer.Indent;
+            {
+                WriteFunctionCallbackInvocation(callbackName, "");
+                this.m_writer.WriteLine($"if (nextState)");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                {
+                    this.m_writer.WriteLine($"switch (*nextState)");
+                    this.m_writer.WriteLine("{");
+                    {
+                        foreach (KeyValuePair<string, EdgeTarget> subEdge in state.OnEnterEventAlluxTargets)
+                        {
+                            if (subEdge.Value.TargetType == EdgeTargetType.state)
+                            {
+                                this.m_writer.WriteLine($"case {STATES_ENUM_NAME}::{subEdge.Value.StateName}:");
+                                ++this.m_writer.Indent;
+                                this.m_writer.WriteLine($"/*{subEdge.Key}*/");
+                                if (redirectInLoop)
+                                {
+                                    this.m_writer.WriteLine($"state = {STATES_ENUM_NAME}::{subEdge.Value.StateName};");
+                                    this.m_writer.WriteLine("continue;");
+                                }
+                                else
+                                {
+                                    WriteSetStateCall(returnType, $"{STATES_ENUM_NAME}::{subEdge.Value.StateName}");
+                                    this.m_writer.WriteLine($"break;");
+                                };
+                                --this.m_writer.Indent;
+                            }
+                        };
+                        this.m_writer.WriteLine($"default:");
+                        ++this.m_writer.Indent;
+                        this.m_writer.WriteLine(ComposeErrorStatement(returnType, "unexpected_target_state", null, "\"Unexpected target state was chosen by callback function " + callbackName + "\""));
+                        --this.m_writer.Indent;
+                    }
+                    this.m_writer.WriteLine("}"); //switch
+                }
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}"); //if has value
+            }
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}"); //visibility guard
+        }
+
+        private void ComputeCallbackSlots()
+        {
+            Dictionary<string, Dictionary<string, int>> slotsByKey = new Dictionary<string, Dictionary<string, int>>(); //scope -> callbacks key -> slot
+            foreach (StateDescr state in this.m_stateMachine.States.Values)
+            {
+                IEnumerable<EdgeDescr> edges = (state.EventEdges?.Values ?? Enumerable.Empty<EdgeDescr>())
+                    .Concat(state.TimerEdges?.Values ?? Enumerable.Empty<EdgeDescr>());
+                foreach (EdgeDescr edge in edges)
+                {
+                    if (edge.OnTraverseEventTypes.Count == 0)
+                    {
+                        continue;
+                    };
+                    string scope = ComposeCallbackSlotScope(edge.IsTimer, edge.InvokerName);
+                    if (!this.m_callbackSlotEdges.TryGetValue(scope, out List<KeyValuePair<StateDescr, EdgeDescr>>? scopeEdges))
+                    {
+                        scopeEdges = new List<KeyValuePair<StateDescr, EdgeDescr>>();
+                        this.m_callbackSlotEdges.Add(scope, scopeEdges);
+                        slotsByKey.Add(scope, new Dictionary<string, int>());
+                    };
+
+                    //edges with same callbacks (and same sub-edges for functions) share the same code
+                    string key = String.Join("|", edge.OnTraverseEventTypes.Select(t => ExportHelper.ComposeEdgeTraveseCallbackName(t, state, edge, out _, out _)));
+                    if (edge.Targets != null)
+                    {
+                        key += ";" + String.Join("|", edge.Targets.Select(p => p.Key + ":" + p.Value));
+                    };
+                    if (!slotsByKey[scope].TryGetValue(key, out int slot))
+                    {
+                        scopeEdges.Add(new KeyValuePair<StateDescr, EdgeDescr>(state, edge));
+                        slot = scopeEdges.Count; //0 is reserved for 'no callbacks'
+                        slotsByKey[scope].Add(key, slot);
+                    };
+                    this.m_callbackSlots.Add(edge, slot);
+                }
+            }
+        }
+
+        private static string ComposeCallbackSlotScope(bool isTimer, string invokerName)
+        {
+            //all timers are handled by single OnTimer, so they share the slots numbering
+            return isTimer ? "timers" : "event:" + invokerName;
+        }
+
+        private void WriteTableTransitionCallbacks(string returnType, string scope)
+        {
+            if (!this.m_callbackSlotEdges.TryGetValue(scope, out List<KeyValuePair<StateDescr, EdgeDescr>>? scopeEdges))
+            {
+                return;
+            };
+            this.m_writer.WriteLine("switch (transition.callbacks)");
+            this.m_writer.WriteLine("{");
+            {
+                for (int i = 0; i < scopeEdges.Count; ++i)
+                {
+                    this.m_writer.WriteLine($"case {i + 1}:");
+                    ++this.m_writer.Indent;
+                    {
+                        WriteEdgeTraverseCallbacks(returnType, scopeEdges[i].Key, scopeEdges[i].Value);
+                        this.m_writer.WriteLine("break;");
+                    }
+                    --this.m_writer.Indent;
+                }
+                this.m_writer.WriteLine("default:");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("break;");
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+        }
+
+        //forbidden edges fail after their callbacks, same as in switch mode
+        private void WriteTableTransitionApply(string returnType, string invoker, string eventId, bool isTimer)
+        {
+            this.m_writer.WriteLine("if (transition.kind == TransitionKind::failure)");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            WriteStatsIncrement($"forbidden[{invoker}]");
+            WriteTraceRecord(ComposeTraceId("m_currentState"), isTimer ? "static_cast<uint16_t>(invoker)" : invoker, null);
+            this.m_writer.WriteLine(ComposeErrorStatement(returnType, "event_forbidden", eventId, $"std::string(\"Event \") + s_invokerNames[{invoker}] + \" is forbidden in current state\""));
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine("if (transition.kind == TransitionKind::state)");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            WriteSetStateCall(returnType, "transition.target");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+        }
+
+        private void WriteTransitionTable()
+        {
+            if (this.m_invokers.Count == 0)
+            {
+                return;
+            };
+
+            int maxSlots = this.m_callbackSlotEdges.Values.Select(l => l.Count).DefaultIfEmpty(0).Max();
+
+            this.m_writer.WriteLine("enum class TransitionKind : uint8_t");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            this.m_writer.WriteLine("not_expected,");
+            this.m_writer.WriteLine("failure,");
+            this.m_writer.WriteLine("no_change,");
+            this.m_writer.WriteLine("state,");
+            this.m_writer.WriteLine("function, //target state is chosen by callback");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("};");
+            this.m_writer.WriteLine();
+
+            this.m_writer.WriteLine("struct Transition");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            this.m_writer.WriteLine("TransitionKind kind;");
+            this.m_writer.WriteLine($"{(maxSlots < 256 ? "uint8_t" : "uint16_t")} callbacks; //callbacks slot, 0 for none");
+            this.m_writer.WriteLine($"{STATES_ENUM_NAME} target;");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("};");
+            this.m_writer.WriteLine();
+
+            this.m_writer.WriteLine($"static constexpr size_t STATES_COUNT = {this.m_stateMachine.States.Count};");
+            this.m_writer.WriteLine($"static constexpr size_t INVOKERS_COUNT = {this.m_invokers.Count};");
+            this.m_writer.WriteLine();
+
+            this.m_writer.WriteLine("static constexpr const char* s_invokerNames[INVOKERS_COUNT] = {");
+            ++this.m_writer.Indent;
+            foreach (string invoker in this.m_invokers)
+            {
+                this.m_writer.WriteLine($"\"{invoker}\",");
+            }
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("};");
+            this.m_writer.WriteLine();
+
+            this.m_writer.WriteLine("static constexpr Transition s_transitions[STATES_COUNT][INVOKERS_COUNT] = {");
+            ++this.m_writer.Indent;
+            foreach (StateDescr state in this.m_stateMachine.States.Values)
+            {
+                this.m_writer.WriteLine($"{{ //{state.Name}");
+                ++this.m_writer.Indent;
+                for (int i = 0; i < this.m_invokers.Count; ++i)
+                {
+                    string invoker = this.m_invokers[i];
+                    Dictionary<string, EdgeDescr>? edges = i < this.m_stateMachine.Events.Count ? state.EventEdges : state.TimerEdges;
+                    EdgeDescr? edge = null;
+                    edges?.TryGetValue(invoker, out edge);
+                    this.m_writer.Write(ComposeTransitionInitializer(edge));
+                    this.m_writer.WriteLine($", //{invoker}");
+                }
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("},");
+            }
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("};");
+            this.m_writer.WriteLine();
+
+            if (this.m_settings.ErrorMode != CppErrorMode.exceptions)
+            {
+                //checks are inlined into callers
+                return;
+            };
+
+            this.m_writer.WriteLine("const Transition& Dispatch(size_t invoker)");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine($"const Transition& transition = s_transitions[static_cast<size_t>(m_currentState)][invoker];");
+                this.m_writer.WriteLine("switch (transition.kind)");
+                this.m_writer.WriteLine("{");
+                this.m_writer.WriteLine("case TransitionKind::not_expected:");
+                ++this.m_writer.Indent;
+                if (this.m_settings.Instrumentation != CppInstrumentation.none)
+                {
+                    this.m_writer.WriteLine($"if (invoker < {ComposeStatsClassName()}::EVENTS_COUNT) {{ {ComposeStatsIncrement("notExpected[invoker]")}}} else {{ {ComposeStatsIncrement("unexpectedTimers")}}}");
+                };
+                WriteTraceRecord(ComposeTraceId("m_currentState"), "static_cast<uint16_t>(invoker)", null);
+                this.m_writer.WriteLine("throw std::runtime_error(std::string(\"Event \") + s_invokerNames[invoker] + \" is not expected in current state\");");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("default:");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("return transition;");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        private string ComposeTransitionInitializer(EdgeDescr? edge)
+        {
+            if (edge == null)
+            {
+                return "{}";
+            };
+            this.m_callbackSlots.TryGetValue(edge, out int slot);
+            if (edge.Target == null)
+            {
+                return $"{{ TransitionKind::function, {slot}, {{}} }}";
+            };
+            switch (edge.Target.TargetType)
+            {
+            case EdgeTargetType.state:
+                return $"{{ TransitionKind::state, {slot}, {STATES_ENUM_NAME}::{edge.Target.StateName} }}";
+            case EdgeTargetType.failure:
+                return $"{{ TransitionKind::failure, {slot}, {{}} }}";
+            case EdgeTargetType.no_change:
+                return $"{{ TransitionKind::no_change, {slot}, {{}} }}";
+            default:
+                throw new Exception("Unexpected type " + edge.Target.TargetType);
+            }
+        }
+
+        private string ComposeTimerDelayVariable(string timerName)
+        {
+            return $"m_{timerName}_delay";
+        }
+
+        private string ComposeTimerDelayAccess(string timerName)
+        {
+            if (IsWritingMappedPool())
+            {
+                return $"m_slots[handle].{ComposeTimerDelayVariable(timerName)}";
+            };
+            return this.m_writingPool ? $"m_delays_{timerName}[handle]" : ComposeTimerDelayVariable(timerName);
+        }
+
+        private string ComposeTimerPointer(string timerName)
+        {
+            string timerObject = this.m_timerToObject[timerName];
+            if (this.m_writingPool)
+            {
+                return $"m_timers_{timerObject}[handle]";
+            };
+            //compact layout holds timers by value
+            return this.m_settings.CompactLayout ? $"&{timerObject}" : timerObject;
+        }
+
+        private string ComposeTimerAccess(string timerName)
+        {
+            return this.m_settings.CompactLayout && !this.m_writingPool ? $"{this.m_timerToObject[timerName]}." : $"{ComposeTimerPointer(timerName)}->";
+        }
+
+        private bool IsSharedTimerObject(string timerObject)
+        {
+            return this.m_timerObjects[timerObject].Count > 1;
+        }
+
+        //index of the timer a shared timer object was last started for
+        private string ComposeTimerOwnerAccess(string timerObject)
+        {
+            return this.m_writingPool ? $"m_owners_{timerObject}[handle]" : $"m_{timerObject}_owner";
+        }
+
+        //fired timer object, decoded back to the timer if it's shared
+        private string ComposeTimerMatch(string timerName)
+        {
+            string timerObject = this.m_timerToObject[timerName];
+            return IsSharedTimerObject(timerObject)
+                ? $"timer == {ComposeTimerPointer(timerName)} && {ComposeTimerOwnerAccess(timerObject)} == {this.m_timerObjects[timerObject].IndexOf(timerName)}"
+                : $"timer == {ComposeTimerPointer(timerName)}";
+        }
+
+        private string ComposeTimerIsActive(string timerName)
+        {
+            string timerObject = this.m_timerToObject[timerName];
+            string isActive = IsWritingLazyTimers()
+                ? $"{timerObject} != nullptr && {timerObject}->IsActive()"
+                : $"{ComposeTimerAccess(timerName)}IsActive()";
+            return IsSharedTimerObject(timerObject)
+                ? $"{ComposeTimerOwnerAccess(timerObject)} == {this.m_timerObjects[timerObject].IndexOf(timerName)} && {isActive}"
+                : isActive;
+        }
+
+        private string ComposeStateVariable()
+        {
+            if (IsWritingMappedPool())
+            {
+                return "m_slots[handle].m_currentState";
+            };
+            return this.m_writingPool ? "m_states[handle]" : "m_currentState";
+        }
+
+        private bool IsWritingMappedPool()
+        {
+            return this.m_writingPool && this.m_settings.MappedPool;
+        }
+
+        private string ComposeSetStateCall(string state)
+        {
+            return this.m_writingPool ? $"SetState(handle, {state})" : $"SetState({state})";
+        }
+
+        //return type of a generated method defines how its errors are reported
+        private string ComposeReturnType(bool setState, bool onTimer)
+        {
+            //timer events have nobody to return status to, so their errors always go to the error handler
+            switch (this.m_settings.ErrorMode)
+            {
+            case CppErrorMode.exceptions:
+                return "void";
+            case CppErrorMode.status:
+                return onTimer ? "void" : "Result";
+            case CppErrorMode.handler:
+                return setState ? "bool" : "void";
+            default:
+                throw new Exception("Unexpected error mode " + this.m_settings.ErrorMode);
+            }
+        }
+
+        private void WriteSuccessReturn(string returnType)
+        {
+            if (returnType == "Result")
+            {
+                this.m_writer.WriteLine("return {};");
+            }
+            else if (returnType == "bool")
+            {
+                this.m_writer.WriteLine("return true;");
+            };
+        }
+
+        private void WriteSetStateCall(string returnType, string state)
+        {
+            string call = ComposeSetStateCall(state);
+            switch (this.m_settings.ErrorMode)
+            {
+            case CppErrorMode.exceptions:
+                this.m_writer.WriteLine($"{call};");
+                break;
+            case CppErrorMode.status:
+                if (returnType == "Result")
+                {
+                    this.m_writer.WriteLine($"if (Result result = {call}; !result) [[unlikely]] {{ return result; }}");
+                }
+                else
+                {
+                    this.m_writer.WriteLine($"if (Result result = {call}; !result) [[unlikely]] {{ ReportError({ComposeInstanceArguments("result")}); return; }}");
+                };
+                break;
+            case CppErrorMode.handler:
+                //error is already reported
+                this.m_writer.WriteLine($"if (!{call}) [[unlikely]] {{ return{(returnType == "bool" ? " false" : "")}; }}");
+                break;
+            default:
+                throw new Exception("Unexpected error mode " + this.m_settings.ErrorMode);
+            }
+        }
+
+        private string ComposeErrorResult(string errorCode, string? eventId, string? state = null)
+        {
+            return $"Result{{ ErrorCode::{errorCode}, {state ?? ComposeStateVariable()}, {eventId ?? "std::nullopt"} }}";
+        }
+
+        private string ComposeErrorStatement(string returnType, string errorCode, string? eventId, string exceptionMessage, bool markUnlikely = true)
+        {
+            if (this.m_settings.ErrorMode == CppErrorMode.exceptions)
+            {
+                return $"throw std::runtime_error({exceptionMessage});";
+            };
+            string error = ComposeErrorResult(errorCode, eventId);
+            string unlikely = markUnlikely ? "[[unlikely]] " : "";
+            switch (returnType)
+            {
+            case "Result":
+                return $"{unlikely}return {error};";
+            case "bool":
+                return $"{unlikely}{{ ReportError({ComposeInstanceArguments(error)}); return false; }}";
+            default:
+                return $"{unlikely}{{ ReportError({ComposeInstanceArguments(error)}); return; }}";
+            }
+        }
+
+        private void WriteTableDispatch(string returnType, string invoker, string eventId, bool isTimer)
+        {
+            if (this.m_settings.ErrorMode == CppErrorMode.exceptions)
+            {
+                this.m_writer.WriteLine($"const Transition& transition = Dispatch({invoker});");
+                WriteTableTransitionCount(invoker);
+                WriteTraceFrom();
+                return;
+            };
+            this.m_writer.WriteLine($"const Transition& transition = s_transitions[static_cast<size_t>(m_currentState)][{invoker}];");
+            this.m_writer.WriteLine("if (transition.kind == TransitionKind::not_expected)");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            WriteStatsIncrement(isTimer ? "unexpectedTimers" : $"notExpected[{invoker}]");
+            WriteTraceRecord(ComposeTraceId("m_currentState"), isTimer ? "static_cast<uint16_t>(invoker)" : invoker, null);
+            this.m_writer.WriteLine(ComposeErrorStatement(returnType, "event_not_expected", eventId, ""));
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+            WriteTableTransitionCount(invoker);
+            WriteTraceFrom();
+        }
+
+        private void WriteTableTransitionCount(string invoker)
+        {
+            //forbidden edges are reported after callbacks, but are not counted as transitions
+            string increment = ComposeStatsIncrement($"transitions[static_cast<size_t>(m_currentState)][{invoker}]");
+            if (increment.Length > 0)
+            {
+                this.m_writer.WriteLine($"if (transition.kind != TransitionKind::failure) {{ {increment.TrimEnd()} }}");
+            };
+        }
+
+        private bool NeedEventTypes()
+        {
+            //inbox records are event types
+            return this.m_settings.GenerateEventTypes || this.m_settings.GenerateInbox;
+        }
+
+        private bool NeedEventIdEnum()
+        {
+            return this.m_settings.ErrorMode != CppErrorMode.exceptions || NeedEventTypes();
+        }
+
+        private string ComposeCurrentClassName()
+        {
+            return this.m_writingPool ? this.m_settings.ClassName + "Pool" : this.m_settings.ClassName!;
+        }
+
+        private void WriteEventTypes()
+        {
+            if (NeedEventIdEnum())
+            {
+                WriteEnum(EVENTS_ENUM_NAME, null, this.m_invokers); //events, then timers
+            };
+            if (!NeedEventTypes() || this.m_stateMachine.Events.Count == 0)
+            {
+                return;
+            };
+
+            //nested to not clash with timers and with events of other machines in the same namespace
+            this.m_writer.WriteLine("struct Events");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            foreach (EventDescr @event in this.m_stateMachine.Events.Values)
+            {
+                this.m_writer.WriteLine($"struct {@event.Name}");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                foreach (KeyValuePair<string, string> arg in @event.Args)
+                {
+                    this.m_writer.WriteLine($"{arg.Value} {arg.Key};");
+                }
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("};");
+            }
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("};");
+            this.m_writer.WriteLine();
+
+            this.m_writer.WriteLine($"using AnyEvent = std::variant<{String.Join(", ", this.m_stateMachine.Events.Keys.Select(e => "typename Events::" + e))}>;");
+            this.m_writer.WriteLine();
+        }
+
+        private void WriteProcessEventTypes()
+        {
+            if (!NeedEventTypes() || this.m_stateMachine.Events.Count == 0)
+            {
+                return;
+            };
+
+            string returnType = ComposeReturnType(false, false);
+
+            //resolved at compile time, event members are forwarded to ProcessEvent__*
+            this.m_writer.WriteLine("template <class E>");
+            this.m_writer.WriteLine($"{returnType} Process({ComposeInstanceParameters("E&& event")})");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("using Event = std::remove_cvref_t<E>;");
+                string prefix = "";
+                foreach (EventDescr @event in this.m_stateMachine.Events.Values)
+                {
+                    string args = String.Join(", ", @event.Args.Select(arg => $"std::forward<E>(event).{arg.Key}"));
+                    this.m_writer.WriteLine($"{prefix}if constexpr (std::is_same_v<Event, typename Events::{@event.Name}>)");
+                    this.m_writer.WriteLine("{");
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine($"return ProcessEvent__{@event.Name}({ComposeInstanceArguments(args)});");
+                    --this.m_writer.Indent;
+                    this.m_writer.WriteLine("}");
+                    prefix = "else ";
+                }
+                this.m_writer.WriteLine("else if constexpr (std::is_same_v<Event, AnyEvent>)");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine($"return std::visit([&](auto&& alternative) {{ return Process({ComposeInstanceArguments("std::forward<decltype(alternative)>(alternative)")}); }}, std::forward<E>(event));");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine("else");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine($"static_assert(sizeof(Event) == 0, \"Not an event of {this.m_settings.ClassName}\");");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+
+            //for events decoded at runtime: args points to Events::* struct matching the id, may be null for events without args
+            this.m_writer.WriteLine($"{returnType} Process({ComposeInstanceParameters($"{EVENTS_ENUM_NAME} event, const void* args")})");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine($"using Invoker = {returnType}(*)({ComposeCurrentClassName()}&, {ComposeInstanceArgumentTypes("const void*")});");
+                this.m_writer.WriteLine($"static constexpr Invoker s_invokers[] = {{ {String.Join(", ", this.m_stateMachine.Events.Keys.Select(e => $"&ProcessErased<typename Events::{e}>"))} }};");
+                this.m_writer.WriteLine($"if (static_cast<size_t>(event) >= {this.m_stateMachine.Events.Count}) //timers are not accepted");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine(ComposeErrorStatement(returnType, "event_not_expected", "event", "\"Unexpected event id\""));
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine($"return s_invokers[static_cast<size_t>(event)](*this, {ComposeInstanceArguments("args")});");
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        private void WriteProcessErasedEvent()
+        {
+            if (!NeedEventTypes() || this.m_stateMachine.Events.Count == 0)
+            {
+                return;
+            };
+            this.m_writer.WriteLine("template <class E>");
+            this.m_writer.WriteLine($"static {ComposeReturnType(false, false)} ProcessErased({ComposeCurrentClassName()}& machine, {ComposeInstanceParameters("const void* args")})");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            this.m_writer.WriteLine("if constexpr (std::is_empty_v<E>)");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            this.m_writer.WriteLine($"return machine.Process({ComposeInstanceArguments("E{}")});");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine("else");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            this.m_writer.WriteLine($"return machine.Process({ComposeInstanceArguments("*static_cast<const E*>(args)")});");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        private void WriteErrorTypes()
+        {
+            if (this.m_settings.ErrorMode == CppErrorMode.exceptions)
+            {
+                return;
+            };
+
+            string className = ComposeCurrentClassName();
+
+            this.m_writer.WriteLine("enum class ErrorCode : uint8_t");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            this.m_writer.WriteLine("ok,");
+            this.m_writer.WriteLine("event_not_expected,");
+            this.m_writer.WriteLine("event_forbidden,");
+            this.m_writer.WriteLine("unexpected_target_state, //callback function chose a state not listed in its targets");
+            this.m_writer.WriteLine("unexpected_timer,");
+            this.m_writer.WriteLine("unexpected_state,");
+            if (this.m_settings.BatchProcessing)
+            {
+                this.m_writer.WriteLine("invalid_batch, //spans passed to ProcessEventBatch__* don't match in size");
+            };
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("};");
+            this.m_writer.WriteLine();
+
+            this.m_writer.WriteLine("struct [[nodiscard]] Result");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            this.m_writer.WriteLine("ErrorCode code = ErrorCode::ok;");
+            this.m_writer.WriteLine($"{STATES_ENUM_NAME} state{{}}; //state the error happened in");
+            this.m_writer.WriteLine($"std::optional<{EVENTS_ENUM_NAME}> event{{}}; //offending event or timer, if known");
+            this.m_writer.WriteLine();
+            this.m_writer.WriteLine("explicit operator bool() const");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            this.m_writer.WriteLine("return code == ErrorCode::ok;");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("};");
+            this.m_writer.WriteLine();
+
+            //single hook for all instances, so it costs nothing per machine
+            this.m_writer.WriteLine($"using ErrorHandler = void(*)({className}& machine, {ComposeInstanceArgumentTypes("const Result& error")}) noexcept;");
+            this.m_writer.WriteLine();
+            this.m_writer.WriteLine("static void SetErrorHandler(ErrorHandler handler)");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            this.m_writer.WriteLine("s_errorHandler = handler;");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        private void WriteErrorHandlerField()
+        {
+            if (this.m_settings.ErrorMode == CppErrorMode.exceptions)
+            {
+                return;
+            };
+            this.m_writer.WriteLine("static inline ErrorHandler s_errorHandler = nullptr;");
+        }
+
+        private void WriteReportError()
+        {
+            if (this.m_settings.ErrorMode == CppErrorMode.exceptions)
+            {
+                return;
+            };
+            this.m_writer.WriteLine($"void ReportError({ComposeInstanceParameters("const Result& error")}) noexcept");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            this.m_writer.WriteLine($"if (s_errorHandler) {{ s_errorHandler(*this, {ComposeInstanceArguments("error")}); }}");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        private string ComposeInstanceParameters(string parameters)
+        {
+            //pool methods take the handle of a machine first
+            if (!this.m_writingPool)
+            {
+                return parameters;
+            };
+            return parameters.Length > 0 ? $"Handle handle, {parameters}" : "Handle handle";
+        }
+
+        private string ComposeInstanceArguments(string args)
+        {
+            if (!this.m_writingPool)
+            {
+                return args;
+            };
+            return args.Length > 0 ? $"handle, {args}" : "handle";
+        }
+
+        private string ComposeInstanceArgumentTypes(string argTypes)
+        {
+            if (!this.m_writingPool)
+            {
+                return argTypes;
+            };
+            return argTypes.Length > 0 ? $"Handle, {argTypes}" : "Handle";
+        }
+
+        private void WriteFields()
+        {
+            if (this.m_settings.CompactLayout)
+            {
+                WriteCompactFields();
+                return;
+            };
+
+            this.m_writer.WriteLine($"{STATES_ENUM_NAME} m_currentState = {STATES_ENUM_NAME}::{this.m_stateMachine.StartState};");
+            if (this.m_settings.CallbackMode == CppCallbackMode.handler)
+            {
+                this.m_writer.WriteLine("Handler& m_handler;");
+            };
+            if (HasActionBuffer())
+            {
+                this.m_writer.WriteLine("std::vector<Action>* m_actions = nullptr;");
+            };
+
+            if (IsWritingLazyTimers())
+            {
+                this.m_writer.WriteLine("TimerFactory<T> m_timerFactory;");
+                foreach (string timerObject in this.m_timerObjects.Keys)
+                {
+                    this.m_writer.WriteLine($"T* {timerObject} = nullptr;");
+                }
+            }
+            else
+            {
+                foreach (string timerObject in this.m_timerObjects.Keys)
+                {
+                    this.m_writer.WriteLine($"T* {timerObject};");
+                }
+            };
+            WriteTimerOwnersFields();
+            foreach (string timer in this.m_modifiedTimers)
+            {
+                TimerDescr descr = this.m_stateMachine.Timers[timer];
+                this.m_writer.WriteLine($"double {ComposeTimerDelayVariable(timer)} = {descr.IntervalSeconds.ToString(CultureInfo.InvariantCulture)};");
+            }
+            this.m_writer.WriteLine();
+        }
+
+        private void WriteCompactFields()
+        {
+            //ordered by decreasing alignment to avoid padding
+            this.m_writer.WriteLine($"//size before tail padding: {String.Join(" + ", ComposeCompactLayoutSizeTerms())}");
+            if (this.m_settings.CallbackMode == CppCallbackMode.handler)
+            {
+                this.m_writer.WriteLine("Handler& m_handler;");
+            }
+            else if (this.m_sharedCallbacks)
+            {
+                this.m_writer.WriteLine("const Callbacks* m_callbacks;");
+                this.m_writer.WriteLine("void* m_context;");
+            };
+            foreach (string timerObject in this.m_timerObjects.Keys)
+            {
+                this.m_writer.WriteLine($"T {timerObject};");
+            }
+            WriteDelayAndStateFields("float");
+            WriteTimerOwnersFields();
+            this.m_writer.WriteLine();
+        }
+
+        //shared by the compact class and slots of the mapped pool, which are both ordered by decreasing alignment
+        private void WriteDelayAndStateFields(string delayType)
+        {
+            foreach (string timer in this.m_modifiedTimers)
+            {
+                TimerDescr descr = this.m_stateMachine.Timers[timer];
+                this.m_writer.WriteLine($"{delayType} {ComposeTimerDelayVariable(timer)} = {descr.IntervalSeconds.ToString(CultureInfo.InvariantCulture)};");
+            }
+            this.m_writer.WriteLine($"{STATES_ENUM_NAME} m_currentState = {STATES_ENUM_NAME}::{this.m_stateMachine.StartState};");
+        }
+
+        private void WriteTimerOwnersFields()
+        {
+            foreach (string timerObject in this.m_timerObjects.Keys.Where(o => IsSharedTimerObject(o)))
+            {
+                this.m_writer.WriteLine($"uint8_t {ComposeTimerOwnerAccess(timerObject)} = 0; //{String.Join(", ", this.m_timerObjects[timerObject])}");
+            }
+        }
+
+        private List<string> ComposeCompactLayoutSizeTerms()
+        {
+            List<string> result = new List<string>();
+            if (this.m_settings.CallbackMode == CppCallbackMode.handler)
+            {
+                result.Add("sizeof(Handler*)");
+            }
+            else if (this.m_sharedCallbacks)
+            {
+                result.Add("2 * sizeof(void*)");
+            };
+            if (this.m_timerObjects.Count > 0)
+            {
+                result.Add($"{this.m_timerObjects.Count} * sizeof(T)");
+            };
+            if (this.m_modifiedTimers.Count > 0)
+            {
+                result.Add($"{this.m_modifiedTimers.Count} * sizeof(float)");
+            };
+            result.Add($"sizeof({STATES_ENUM_NAME})");
+            int sharedTimerObjectsCount = this.m_timerObjects.Keys.Count(o => IsSharedTimerObject(o));
+            if (sharedTimerObjectsCount > 0)
+            {
+                result.Add($"{sharedTimerObjectsCount} * sizeof(uint8_t)");
+            };
+            return result;
+        }
+
+        private void WriteCompactConstructorStateGetter()
+        {
+            List<string> parameters = new List<string>();
+            List<string> initializers = new List<string>();
+            if (this.m_settings.CallbackMode == CppCallbackMode.handler)
+            {
+                parameters.Add("Handler& handler");
+                initializers.Add("m_handler(handler)");
+            }
+            else if (this.m_sharedCallbacks)
+            {
+                parameters.Add("const Callbacks& callbacks");
+                parameters.Add("void* context");
+                initializers.Add("m_callbacks(&callbacks)");
+                initializers.Add("m_context(context)");
+            };
+            foreach (string timerObject in this.m_timerObjects.Keys)
+            {
+                initializers.Add($"{timerObject}(\"{timerObject}\", std::bind(&{this.m_settings.ClassName}::OnTimer, this, std::placeholders::_1))");
+            }
+
+            this.m_writer.WriteLine($"{this.m_settings.ClassName}({String.Join(", ", parameters)})");
+            ++this.m_writer.Indent;
+            for (int i = 0; i < initializers.Count; ++i)
+            {
+                this.m_writer.WriteLine((i == 0 ? ": " : ", ") + initializers[i]);
+            }
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("{");
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+
+            //timers hold callbacks bound to this instance
+            this.m_writer.WriteLine($"{this.m_settings.ClassName}(const {this.m_settings.ClassName}&) = delete;");
+            this.m_writer.WriteLine($"{this.m_settings.ClassName}& operator=(const {this.m_settings.ClassName}&) = delete;");
+            this.m_writer.WriteLine();
+
+            this.m_writer.WriteLine($"{STATES_ENUM_NAME} GetCurrentState()");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("return m_currentState;");
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        private void WriteConstructorDestructorStateGetter()
+        {
+            if (this.m_settings.CompactLayout)
+            {
+                WriteCompactConstructorStateGetter();
+                return;
+            };
+
+            if (this.m_settings.CallbackMode == CppCallbackMode.handler)
+            {
+                this.m_writer.WriteLine($"{this.m_settings.ClassName}(TimerFactory<T> timerFactory, Handler& handler)");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine(": m_handler(handler)");
+                if (IsWritingLazyTimers())
+                {
+                    this.m_writer.WriteLine(", m_timerFactory(std::move(timerFactory))");
+                };
+                --this.m_writer.Indent;
+            }
+            else
+            {
+                this.m_writer.WriteLine($"{this.m_settings.ClassName}(TimerFactory<T> timerFactory)");
+                if (IsWritingLazyTimers())
+                {
+                    ++this.m_writer.Indent;
+                    this.m_writer.WriteLine(": m_timerFactory(std::move(timerFactory))");
+                    --this.m_writer.Indent;
+                };
+            };
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+
+                if (this.m_stateMachine.Timers.Count > 0 && !IsWritingLazyTimers())
+                {
+                    this.m_writer.WriteLine($"TimerFiredCallback<T> timerCallback = std::bind(&{this.m_settings.ClassName}::OnTimer, this, std::placeholders::_1);");
+                    foreach (string timerObject in this.m_timerObjects.Keys)
+                    {
+                        this.m_writer.WriteLine($"{timerObject} = timerFactory(\"{timerObject}\", timerCallback);");
+                    }
+                };
+
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+
+            this.m_writer.WriteLine($"~{this.m_settings.ClassName}()");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                foreach (string timerObject in this.m_timerObjects.Keys)
+                {
+                    this.m_writer.WriteLine($"delete {timerObject};");
+                }
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+
+            if (HasActionBuffer())
+            {
+                //buffer may be shared by many machines, actions are dropped while there's none
+                this.m_writer.WriteLine("void SetActionBuffer(std::vector<Action>* actions)");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("m_actions = actions;");
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("}");
+                this.m_writer.WriteLine();
+            };
+
+            this.m_writer.WriteLine($"{STATES_ENUM_NAME} GetCurrentState()");
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                this.m_writer.WriteLine("return m_currentState;");
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("}");
+            this.m_writer.WriteLine();
+        }
+
+        private string ComposeStatesUnderlyingType()
+        {
+            int count = this.m_stateMachine.States.Count;
+            if (count <= Byte.MaxValue + 1)
+            {
+                return "uint8_t";
+            }
+            else if (count <= UInt16.MaxValue + 1)
+            {
+                return "uint16_t";
+            }
+            else
+            {
+                return "uint32_t";
+            }
+        }
+
+        private void WriteEnum(string enumName, string? underlyingType, IEnumerable<string> values)
+        {
+            if (underlyingType != null)
+            {
+                this.m_writer.WriteLine($"enum class {enumName} : {underlyingType}");
+            }
+            else
+            {
+                this.m_writer.WriteLine($"enum class {enumName}");
+            }
+            this.m_writer.WriteLine("{");
+            {
+                ++this.m_writer.Indent;
+                foreach (string @event in values)
+                {
+                    this.m_writer.Write(@event);
+                    this.m_writer.WriteLine(",");
+                };
+                --this.m_writer.Indent;
+            }
+            this.m_writer.WriteLine("};");
+            this.m_writer.WriteLine("");
+        }
+
+        private static string ComposeStateEnterCallback(StateDescr state)
+        {
+            return $"OnStateEnter__{state.Name}";
+        }
+
+        private void WriteCommentIfSpecified(string? comment)
+        {
+            if (comment != null)
+            {
+                this.m_writer.Write("/*");
+                this.m_writer.Write(comment); //could be an injection )
+                this.m_writer.WriteLine("*/");
+            }
+        }
+
+        private void WriteCallbackEvents()
+        {
+            if (this.m_settings.CallbackMode == CppCallbackMode.handler)
+            {
+                this.m_writer.WriteLine("//Methods called on Handler. Ones returning a state are mandatory, calls to other ones are compiled away if not implemented:");
+            }
+            else if (this.m_sharedCallbacks)
+            {
+                //one table per callbacks set is shared by many instances, each instance passes its own context
+                this.m_writer.WriteLine("struct Callbacks");
+                this.m_writer.WriteLine("{");
+                ++this.m_writer.Indent;
+            }
+            else if (HasActionBuffer())
+            {
+                WriteActions();
+                if (this.m_stateMachine.States.Values.Any(s => s.OnEnterEventAlluxTargets != null
+                    || (s.EventEdges?.Values.Any(e => e.Targets != null) ?? false)
+                    || (s.TimerEdges?.Values.Any(e => e.Targets != null) ?? false)))
+                {
+                    this.m_writer.WriteLine("//Callbacks returning a state are called right away:");
+                };
+            };
+            foreach (StateDescr state in this.m_stateMachine.States.Values)
+            {
+                if (state.NeedOnEnterEvent && !(this.m_settings.CallbackMode == CppCallbackMode.actions && state.OnEnterEventAlluxTargets == null))
+                {
+                    string callbackName = ComposeStateEnterCallback(state);
+                    WriteCommentIfSpecified(state.OnEnterEventComment);
+                    string returnType = state.OnEnterEventAlluxTargets == null ? "void" : $"std::optional<{STATES_ENUM_NAME}>";
+                    if (this.m_settings.CallbackMode == CppCallbackMode.handler)
+                    {
+                        this.m_writer.WriteLine($"//{returnType} {callbackName}({ComposeInstanceArgumentTypes("")});");
+                    }
+                    else if (this.m_sharedCallbacks)
+                    {
+                        this.m_writer.WriteLine($"{returnType} (*{callbackName})(void* context) = nullptr;");
+                    }
+                    else if (state.OnEnterEventAlluxTargets == null)
+                    {
+                        this.m_writer.WriteLine($"std::function<void({ComposeInstanceArgumentTypes("")})> {callbackName};");
+                    }
+                    else
+                    {
+                        this.m_writer.WriteLine($"std::function<std::optional<{STATES_ENUM_NAME}>({ComposeInstanceArgumentTypes("")})> {callbackName};");
+                    }
+                }
+            }
+            this.m_writer.WriteLine();
+
+            Dictionary<string, bool> declaredEventCallbacks = new Dictionary<string, bool>();    //callback name -> is function callback
+            foreach (StateDescr state in this.m_stateMachine.States.Values)
+            {
+                if (state.EventEdges != null)
+                {
+                    foreach (EdgeDescr edge in state.EventEdges.Values)
+                    {
+                        foreach (EdgeTraverseCallbackType callbackType in edge.OnTraverseEventTypes)
+                        {
+                            EventDescr @event = this.m_stateMachine.Events[edge.InvokerName];
+                            WriteCallbackEvent(state, edge, @event, callbackType, declaredEventCallbacks);
+                        }
+                    }
+                }
+                if (state.TimerEdges != null)
+                {
+                    foreach (EdgeDescr edge in state.TimerEdges.Values)
+                    {
+                        foreach (EdgeTraverseCallbackType callbackType in edge.OnTraverseEventTypes)
+                        {
+                            WriteCallbackEvent(state, edge, null, callbackType, declaredEventCallbacks);
+                        }
+                    }
+                }
+            }
+            if (this.m_sharedCallbacks)
+            {
+                --this.m_writer.Indent;
+                this.m_writer.WriteLine("};");
+            };
+            this.m_writer.WriteLine();
+        }
+
+        //Non-function callbacks are appended to the buffer in the order they would be called, and are processed by the caller later,
+        //e.g. together with ones of other machines. Alternatives of ActionData are in the order of ActionId
+        private void WriteActions()
+        {
+            WriteEnum("ActionId", "uint16_t", this.m_actionCallbacks.Select(c => c.name));
+            this.m_writer.WriteLine("struct Actions");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            foreach ((string name, EventDescr? @event) in this.m_actionCallbacks)
+            {
+                string fields = @event == null ? "" : $" {String.Join(" ", @event.Args.Select(arg => $"{arg.Value.Trim()} {arg.Key};"))}";
+                this.m_writer.WriteLine($"struct {name} {{{fields} }};");
+            }
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("};");
+            this.m_writer.WriteLine($"using ActionData = std::variant<{String.Join(", ", this.m_actionCallbacks.Select(c => $"typename Actions::{c.name}"))}>;");
+            this.m_writer.WriteLine();
+            this.m_writer.WriteLine("struct Action");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            this.m_writer.WriteLine($"{this.m_settings.ClassName}* machine;");
+            this.m_writer.WriteLine("ActionData data;");
+            this.m_writer.WriteLine();
+            this.m_writer.WriteLine("ActionId GetId() const");
+            this.m_writer.WriteLine("{");
+            ++this.m_writer.Indent;
+            this.m_writer.WriteLine("return static_cast<ActionId>(data.index());");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("}");
+            --this.m_writer.Indent;
+            this.m_writer.WriteLine("};");
+            this.m_writer.WriteLine();
+        }
+
+        private void WriteCallbackEvent(StateDescr state, EdgeDescr edge, EventDescr? @event, EdgeTraverseCallbackType callbackType, Dictionary<string, bool> declaredEventCallbacks)
+        {
+            string callbackName = ExportHelper.ComposeEdgeTraveseCallbackName(callbackType, state, edge, out bool needArgs, out bool isFunction);
+            if (declaredEventCallbacks.TryGetValue(callbackName, out bool oldCallbackIsFunction))
+            {
+                if (oldCallbackIsFunction != isFunction)
+                {
+                    throw new Exception("should not happen! check validator!");
+                }
+                return;
+            }
+            else
+            {
+                declaredEventCallbacks.Add(callbackName, isFunction);
+            };
+            if (this.m_settings.CallbackMode == CppCallbackMode.actions && !isFunction)
+            {
+                return;
+            };
+            WriteCommentIfSpecified(edge.TraverseEventComment);
+
+            needArgs = needArgs 
+                && @event != null 
+                && @event.Args.Count > 0;
+
+            string returnType = isFunction ? $"std::optional<{STATES_ENUM_NAME}>" : "void";
+            string argTypes = needArgs ? ComposeEventArgTypes(@event!) : "";
+            if (this.m_settings.CallbackMode == CppCallbackMode.handler)
+            {
+                this.m_writer.WriteLine($"//{returnType} {callbackName}({ComposeInstanceArgumentTypes(argTypes)});");
+            }
+            else if (this.m_sharedCallbacks)
+            {
+                this.m_writer.WriteLine($"{returnType} (*{callbackName})({ComposeSharedCallbackArgs("void* context", argTypes)}) = nullptr;");
+            }
+            else
+            {
+                this.m_writer.WriteLine($"std::function<{returnType}({ComposeInstanceArgumentTypes(argTypes)})> {callbackName}; ");
+            }
+        }
+
+        private static Regex s_splitRegex = new Regex(@"\r?\n", RegexOptions.Compiled);
+        private void WriteVerbatimCode(string code, IndentedTextWriter? writer = null)
+        {
+            writer ??= this.m_writer;
+            foreach (string line in s_splitRegex.Split(code))
+            {
+                writer.WriteLine(line);
+            }
+        }
+
+        private const string STATES_ENUM_NAME = "State";
+        private const string EVENTS_ENUM_NAME = "EventId";
+
+        private const string HEADER_PREAMBLE_CODE =
+@"
+#pragma once
+
+#include <stdexcept>
+#include <functional>
+#include <optional>";
+
+        private const string TIMER_CODE =
+@"
+template<class T>
+concept Timer = requires(T t, double timerDelaySeconds) {
+    { t.StartOrReset(timerDelaySeconds) };
+    { t.Stop() };
+};
+
+template<Timer T>
+using TimerFiredCallback = std::function<void(T* timer)>;
+
+template<Timer T>
+using TimerFactory = std::function<T*(const char* timerName, TimerFiredCallback<T> callback)>;
+
+";
+
+        //hierarchical hashed timer wheel: LEVELS levels of 2^SLOT_BITS slots, each slot is an intrusive list of timers.
+        //Timers of upper levels are cascaded down when lower level wraps around
+        private const string TIMER_WHEEL_CODE =
+@"class TimerWheel;
+
+struct TimerWheelNode
+{
+    TimerWheelNode* prev = this;
+    TimerWheelNode* next = this;
+};
+
+class WheelTimer : private TimerWheelNode
+{
+public:
+    WheelTimer(TimerWheel& wheel, const char* timerName, std::function<void(WheelTimer* timer)> callback)
+        : m_wheel(wheel)
+        , m_name(timerName)
+        , m_callback(std::move(callback))
+    {
+    }
+
+    ~WheelTimer()
+    {
+        Stop();
+    }
+
+    WheelTimer(const WheelTimer&) = delete;
+    WheelTimer& operator=(const WheelTimer&) = delete;
+
+    void StartOrReset(double timerDelaySeconds);
+    void Stop();
+
+    bool IsActive() const
+    {
+        return next != this;
+    }
+
+    double GetRemainingSeconds() const;
+
+    const char* GetName() const
+    {
+        return m_name;
+    }
+
+private:
+    friend class TimerWheel;
+
+    TimerWheel& m_wheel;
+    const char* m_name;
+    std::function<void(WheelTimer* timer)> m_callback;
+    uint64_t m_expiresTick = 0;
+};
+
+class TimerWheel
+{
+public:
+    static constexpr size_t SLOT_BITS = 8;
+    static constexpr size_t SLOTS = size_t(1) << SLOT_BITS;
+    static constexpr size_t SLOT_MASK = SLOTS - 1;
+    static constexpr size_t LEVELS = 4;
+    static constexpr uint64_t MAX_TICK = uint64_t(1) << 62;
+
+    explicit TimerWheel(double tickSeconds, double nowSeconds = 0)
+        : m_tickSeconds(tickSeconds)
+        , m_nowSeconds(nowSeconds)
+        , m_nextTick(static_cast<uint64_t>(nowSeconds / tickSeconds) + 1)
+    {
+    }
+
+    //timers started between ticks are counted from the time returned by clock
+    TimerWheel(double tickSeconds, std::function<double()> clock)
+        : TimerWheel(tickSeconds, clock())
+    {
+        m_clock = std::move(clock);
+    }
+
+    ~TimerWheel()
+    {
+        for (TimerWheelNode (&level)[SLOTS] : m_slots)
+        {
+            for (TimerWheelNode& slot : level)
+            {
+                while (slot.next != &slot)
+                {
+                    Remove(static_cast<WheelTimer*>(slot.next));
+                }
+            }
+        }
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    TimerFactory<WheelTimer> GetFactory()
+    {
+        return [this](const char* timerName, TimerFiredCallback<WheelTimer> callback) {
+            return new WheelTimer(*this, timerName, std::move(callback));
+        };
+    }
+
+    size_t GetActiveTimersCount() const
+    {
+        return m_activeCount;
+    }
+
+    //rounded up to the tick, as the timer is fired
+    double GetRemainingSeconds(const WheelTimer& timer) const
+    {
+        return static_cast<double>(timer.m_expiresTick + 1 - m_nextTick) * m_tickSeconds;
+    }
+
+    void Tick()
+    {
+        Tick(m_clock());
+    }
+
+    //fires all the timers expired by nowSeconds, without a clock timers started later are counted from nowSeconds
+    void Tick(double nowSeconds)
+    {
+        if (nowSeconds > m_nowSeconds)
+        {
+            m_nowSeconds = nowSeconds;
+        }
+        const uint64_t lastTick = static_cast<uint64_t>(nowSeconds / m_tickSeconds);
+        while (m_nextTick <= lastTick)
+        {
+            if (m_activeCount == 0)
+            {
+                m_nextTick = lastTick + 1;
+                break;
+            }
+
+            const size_t index = m_nextTick & SLOT_MASK;
+            if (index == 0)
+            {
+                for (size_t level = 1; level < LEVELS; ++level)
+                {
+                    const size_t levelIndex = (m_nextTick >> (level * SLOT_BITS)) & SLOT_MASK;
+                    Cascade(m_slots[level][levelIndex]);
+                    if (levelIndex != 0)
+                    {
+                        break;
+                    }
+                }
+            }
+            ++m_nextTick;
+
+            //callbacks may start or stop any timers, including expired ones, so the slot is detached first
+            TimerWheelNode expired;
+            Splice(m_slots[0][index], expired);
+            while (expired.next != &expired)
+            {
+                WheelTimer* timer = static_cast<WheelTimer*>(expired.next);
+                Remove(timer);
+                timer->m_callback(timer);
+            }
+        }
+    }
+
+private:
+    friend class WheelTimer;
+
+    void Schedule(WheelTimer* timer, double delaySeconds)
+    {
+        if (timer->IsActive())
+        {
+            Remove(timer);
+        }
+        //expiration is rounded up to a tick boundary from the current time, so timers never fire early.
+        //negative and NaN delays fire on the next tick, too long ones are capped to stay in uint64_t range
+        if (m_clock)
+        {
+            const double nowSeconds = m_clock();
+            if (nowSeconds > m_nowSeconds)
+            {
+                m_nowSeconds = nowSeconds;
+            }
+        }
+        const double delay = delaySeconds > 0 ? delaySeconds : 0;
+        const double expires = std::ceil((m_nowSeconds + delay) / m_tickSeconds);
+        if (!(expires < static_cast<double>(MAX_TICK)))
+        {
+            timer->m_expiresTick = MAX_TICK;
+        }
+        else
+        {
+            const uint64_t expiresTick = static_cast<uint64_t>(expires);
+            timer->m_expiresTick = expiresTick > m_nextTick ? expiresTick : m_nextTick;
+        }
+        Insert(timer);
+        ++m_activeCount;
+    }
+
+    void Remove(WheelTimer* timer)
+    {
+        Unlink(timer);
+        --m_activeCount;
+    }
+
+    void Insert(WheelTimer* timer)
+    {
+        uint64_t expires = timer->m_expiresTick;
+        const uint64_t delta = expires - m_nextTick;
+        size_t level = 0;
+        while (level + 1 < LEVELS && delta >= (uint64_t(1) << ((level + 1) * SLOT_BITS)))
+        {
+            ++level;
+        }
+        if (delta >= (uint64_t(1) << (LEVELS * SLOT_BITS)))
+        {
+            //too far, will be cascaded down and reinserted later
+            expires = m_nextTick + (uint64_t(1) << (LEVELS * SLOT_BITS)) - 1;
+        }
+        TimerWheelNode& slot = m_slots[level][(expires >> (level * SLOT_BITS)) & SLOT_MASK];
+        timer->prev = slot.prev;
+        timer->next = &slot;
+        slot.prev->next = timer;
+        slot.prev = timer;
+    }
+
+    void Cascade(TimerWheelNode& slot)
+    {
+        TimerWheelNode moved;
+        Splice(slot, moved);
+        while (moved.next != &moved)
+        {
+            WheelTimer* timer = static_cast<WheelTimer*>(moved.next);
+            Unlink(timer);
+            Insert(timer);
+        }
+    }
+
+    static void Unlink(TimerWheelNode* node)
+    {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        node->prev = node;
+        node->next = node;
+    }
+
+    static void Splice(TimerWheelNode& from, TimerWheelNode& to)
+    {
+        if (from.next == &from)
+        {
+            return;
+        }
+        to.next = from.next;
+        to.prev = from.prev;
+        to.next->prev = &to;
+        to.prev->next = &to;
+        from.next = &from;
+        from.prev = &from;
+    }
+
+    const double m_tickSeconds;
+    std::function<double()> m_clock;
+    double m_nowSeconds; //latest time seen from Tick() or clock
+    uint64_t m_nextTick; //first tick not processed yet
+    size_t m_activeCount = 0;
+    TimerWheelNode m_slots[LEVELS][SLOTS];
+};
+
+inline void WheelTimer::StartOrReset(double timerDelaySeconds)
+{
+    m_wheel.Schedule(this, timerDelaySeconds);
+}
+
+inline void WheelTimer::Stop()
+{
+    if (IsActive())
+    {
+        m_wheel.Remove(this);
+    }
+}
+
+inline double WheelTimer::GetRemainingSeconds() const
+{
+    return IsActive() ? m_wheel.GetRemainingSeconds(*this) : 0;
+}
+
+";
+
+        //owns per-thread blocks of every thread which has used them, blocks outlive their threads
+        private const string THREAD_REGISTRY_CODE =
+@"template<class Block>
+class ThreadRegistry
+{
+public:
+    Block& Add()
+    {
+        std::unique_ptr<Block> block = std::make_unique<Block>();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_blocks.push_back(std::move(block));
+        return *m_blocks.back();
+    }
+
+    //blocks are visited in order of creation
+    template<class Visitor>
+    void ForEach(Visitor&& visitor) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const std::unique_ptr<Block>& block : m_blocks)
+        {
+            visitor(*block);
+        }
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    std::vector<std::unique_ptr<Block>> m_blocks;
+};
+
+";
+
+        //counters are written by their own thread only, so an increment is a plain load and store, and snapshots may read them at any time
+        private const string STATS_CODE =
+@"class StatCounter
+{
+public:
+    void Increment(uint64_t amount = 1)
+    {
+        m_value.store(m_value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    uint64_t Load() const
+    {
+        return m_value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> m_value{ 0 };
+};
+
+inline void AccumulateStats(uint64_t& to, const StatCounter& from)
+{
+    to += from.Load();
+}
+
+inline void AccumulateStats(uint64_t& to, uint64_t from)
+{
+    to += from;
+}
+
+template<class To, class From, size_t N>
+void AccumulateStats(std::array<To, N>& to, const std::array<From, N>& from)
+{
+    for (size_t i = 0; i < N; ++i)
+    {
+        AccumulateStats(to[i], from[i]);
+    }
+}
+
+";
+
+        private const string LATENCY_STATS_CODE =
+@"//bucket i counts durations of [2^(i-1), 2^i) nanoseconds, the last bucket has no upper bound
+struct LatencyHistogram
+{
+    static constexpr size_t BUCKETS_COUNT = 32;
+
+    std::array<uint64_t, BUCKETS_COUNT> buckets{};
+    uint64_t totalNanoseconds = 0;
+
+    uint64_t GetCount() const
+    {
+        uint64_t result = 0;
+        for (uint64_t bucket : buckets)
+        {
+            result += bucket;
+        }
+        return result;
+    }
+};
+
+struct LatencyCounters
+{
+    std::array<StatCounter, LatencyHistogram::BUCKETS_COUNT> buckets;
+    StatCounter totalNanoseconds;
+
+    void Record(std::chrono::steady_clock::duration duration)
+    {
+        const int64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+        const uint64_t value = nanoseconds > 0 ? static_cast<uint64_t>(nanoseconds) : 0;
+        buckets[std::min<size_t>(std::bit_width(value), LatencyHistogram::BUCKETS_COUNT - 1)].Increment();
+        totalNanoseconds.Increment(value);
+    }
+};
+
+//records time spent in the enclosing block
+class LatencyScope
+{
+public:
+    explicit LatencyScope(LatencyCounters& counters)
+        : m_counters(counters)
+        , m_started(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~LatencyScope()
+    {
+        m_counters.Record(std::chrono::steady_clock::now() - m_started);
+    }
+
+    LatencyScope(const LatencyScope&) = delete;
+    LatencyScope& operator=(const LatencyScope&) = delete;
+
+private:
+    LatencyCounters& m_counters;
+    const std::chrono::steady_clock::time_point m_started;
+};
+
+template<class From>
+void AccumulateStats(LatencyHistogram& to, const From& from)
+{
+    AccumulateStats(to.buckets, from.buckets);
+    AccumulateStats(to.totalNanoseconds, from.totalNanoseconds);
+}
+
+";
+
+        //Records are kept as relaxed atomic words, so any thread may copy a ring while its owner keeps writing.
+        //Owner announces a slot before overwriting it, so that a reader can drop records which could change while being copied (like a seqlock)
+        //little endian, so that snapshots may be moved between hosts
+        private const string SNAPSHOT_CODE =
+@"template<class T>
+concept SnapshotTimer = Timer<T> && requires(T t) {
+    { t.IsActive() } -> std::convertible_to<bool>;
+    { t.GetRemainingSeconds() } -> std::convertible_to<double>;
+};
+
+struct TimerSnapshot
+{
+    bool active;
+    float remainingSeconds;
+};
+
+constexpr size_t SNAPSHOT_HEADER_SIZE = 32; //magic, version, record size, schema hash, records count
+
+class SnapshotWriter
+{
+public:
+    explicit SnapshotWriter(uint8_t* data)
+        : m_data(data)
+    {
+    }
+
+    void WriteHeader(uint32_t version, uint32_t recordSize, uint64_t schemaHash, uint64_t count)
+    {
+        std::memcpy(m_data, ""NSMSNAPS"", 8);
+        m_data += 8;
+        Write(version, 4);
+        Write(recordSize, 4);
+        Write(schemaHash, 8);
+        Write(count, 8);
+    }
+
+    void Write(uint64_t value, size_t size)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            m_data[i] = static_cast<uint8_t>(value >> (8 * i));
+        }
+        m_data += size;
+    }
+
+    void Write(float value)
+    {
+        Write(std::bit_cast<uint32_t>(value), 4);
+    }
+
+    void Write(double value)
+    {
+        Write(std::bit_cast<uint64_t>(value), 8);
+    }
+
+private:
+    uint8_t* m_data;
+};
+
+class SnapshotReader
+{
+public:
+    explicit SnapshotReader(const uint8_t* data)
+        : m_data(data)
+    {
+    }
+
+    uint64_t Read(size_t size)
+    {
+        uint64_t value = 0;
+        for (size_t i = 0; i < size; ++i)
+        {
+            value |= static_cast<uint64_t>(m_data[i]) << (8 * i);
+        }
+        m_data += size;
+        return value;
+    }
+
+    float ReadFloat()
+    {
+        return std::bit_cast<float>(static_cast<uint32_t>(Read(4)));
+    }
+
+    double ReadDouble()
+    {
+        return std::bit_cast<double>(Read(8));
+    }
+
+private:
+    const uint8_t* m_data;
+};
+
+//false unless data starts with a header of expected version and schema, followed by exactly the records it declares
+inline bool ReadSnapshotHeader(std::span<const uint8_t> data, uint32_t version, uint32_t recordSize, uint64_t schemaHash, size_t& count)
+{
+    if (data.size() < SNAPSHOT_HEADER_SIZE || std::memcmp(data.data(), ""NSMSNAPS"", 8) != 0)
+    {
+        return false;
+    }
+    SnapshotReader reader(data.data() + 8);
+    if (reader.Read(4) != version || reader.Read(4) != recordSize || reader.Read(8) != schemaHash)
+    {
+        return false;
+    }
+    const uint64_t declared = reader.Read(8);
+    if (declared != (data.size() - SNAPSHOT_HEADER_SIZE) / recordSize || (data.size() - SNAPSHOT_HEADER_SIZE) % recordSize != 0)
+    {
+        return false;
+    }
+    count = static_cast<size_t>(declared);
+    return true;
+}
+
+";
+
+        //POSIX file mapping. Header is in native byte order, as the file is only reopened on the same host
+        private const string MAPPED_POOL_CODE =
+@"inline double GetMonotonicSeconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//header followed by fixed size slots, mapped into memory so that they survive restarts of the process
+class MappedPoolFile
+{
+public:
+    static constexpr uint32_t VERSION = 1;
+
+    //file of the same schema is resumed (and extended to capacity if smaller), any other file is recreated empty
+    MappedPoolFile(const char* fileName, size_t slotSize, uint64_t schemaHash, uint64_t capacity)
+    {
+        m_fd = ::open(fileName, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (m_fd < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), fileName);
+        }
+        Header header{};
+        struct stat status{};
+        if (::fstat(m_fd, &status) == 0
+            && static_cast<uint64_t>(status.st_size) >= sizeof(Header)
+            && ::pread(m_fd, &header, sizeof(Header), 0) == static_cast<ssize_t>(sizeof(Header))
+            && std::memcmp(header.magic, ""NSMPOOL"", sizeof(header.magic)) == 0
+            && header.version == VERSION
+            && header.slotSize == slotSize
+            && header.schemaHash == schemaHash
+            && static_cast<uint64_t>(status.st_size) == sizeof(Header) + header.capacity * slotSize)
+        {
+            m_resumed = true;
+            capacity = std::max(capacity, header.capacity);
+        }
+        m_capacity = capacity;
+        m_size = sizeof(Header) + capacity * slotSize;
+        //stale contents are dropped, extension is zero filled
+        if ((!m_resumed && ::ftruncate(m_fd, 0) != 0) || ::ftruncate(m_fd, static_cast<off_t>(m_size)) != 0)
+        {
+            Fail(fileName);
+        }
+        void* data = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if (data == MAP_FAILED)
+        {
+            Fail(fileName);
+        }
+        m_data = static_cast<uint8_t*>(data);
+
+        Header* mapped = reinterpret_cast<Header*>(m_data);
+        mapped->version = VERSION;
+        mapped->slotSize = static_cast<uint32_t>(slotSize);
+        mapped->schemaHash = schemaHash;
+        mapped->capacity = capacity;
+        //magic goes last, so that interrupted initialization is not resumed
+        std::memcpy(mapped->magic, ""NSMPOOL"", sizeof(mapped->magic));
+    }
+
+    ~MappedPoolFile()
+    {
+        ::munmap(m_data, m_size);
+        ::close(m_fd);
+    }
+
+    MappedPoolFile(const MappedPoolFile&) = delete;
+    MappedPoolFile& operator=(const MappedPoolFile&) = delete;
+
+    void* GetSlots()
+    {
+        return m_data + sizeof(Header);
+    }
+
+    uint64_t GetCapacity() const
+    {
+        return m_capacity;
+    }
+
+    bool IsResumed() const
+    {
+        return m_resumed;
+    }
+
+    void Sync()
+    {
+        ::msync(m_data, m_size, MS_SYNC);
+    }
+
+private:
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t slotSize;
+        uint64_t schemaHash;
+        uint64_t capacity;
+    };
+
+    [[noreturn]] void Fail(const char* fileName)
+    {
+        const int error = errno;
+        ::close(m_fd);
+        throw std::system_error(error, std::generic_category(), fileName);
+    }
+
+    int m_fd = -1;
+    uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    uint64_t m_capacity = 0;
+    bool m_resumed = false;
+};
+
+";
+
+        private const string TRACE_CODE =
+@"#ifndef NICE_STATE_MACHINE_TRACE_TIMESTAMP
+//may be defined before including generated code to use a cheaper clock, e.g. __rdtsc()
+#define NICE_STATE_MACHINE_TRACE_TIMESTAMP() static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count())
+#endif
+
+//layout of records in a dump
+struct TraceRecord
+{
+    uint64_t timestamp;
+    uint64_t instance; //machine address, or handle for pools
+    uint16_t from; //NO_ID for Start()
+    uint16_t invoker; //event or timer, NO_ID if not known
+    uint16_t to; //NO_ID if the event was rejected
+    uint16_t thread; //index of the recording thread
+};
+static_assert(sizeof(TraceRecord) == 24, ""Unexpected trace record layout"");
+
+template<size_t CAPACITY>
+class TraceRing
+{
+    static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, ""Capacity should be a power of two"");
+
+public:
+    //owner thread only
+    void Push(uint64_t timestamp, uint64_t instance, uint16_t from, uint16_t invoker, uint16_t to)
+    {
+        const uint64_t written = m_written.load(std::memory_order_relaxed);
+        m_claimed.store(written + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        Cell& cell = m_cells[written & (CAPACITY - 1)];
+        cell[0].store(timestamp, std::memory_order_relaxed);
+        cell[1].store(instance, std::memory_order_relaxed);
+        cell[2].store(uint64_t(from) | (uint64_t(invoker) << 16) | (uint64_t(to) << 32), std::memory_order_relaxed);
+        m_written.store(written + 1, std::memory_order_release);
+    }
+
+    //appends records which were not overwritten while being copied
+    void CopyTo(std::vector<TraceRecord>& records, uint16_t thread) const
+    {
+        const uint64_t written = m_written.load(std::memory_order_acquire);
+        const uint64_t first = written > CAPACITY ? written - CAPACITY : 0;
+        const size_t start = records.size();
+        for (uint64_t i = first; i < written; ++i)
+        {
+            const Cell& cell = m_cells[i & (CAPACITY - 1)];
+            const uint64_t ids = cell[2].load(std::memory_order_relaxed);
+            records.push_back(TraceRecord{
+                cell[0].load(std::memory_order_relaxed),
+                cell[1].load(std::memory_order_relaxed),
+                static_cast<uint16_t>(ids),
+                static_cast<uint16_t>(ids >> 16),
+                static_cast<uint16_t>(ids >> 32),
+                thread
+            });
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint64_t claimed = m_claimed.load(std::memory_order_relaxed);
+        const uint64_t intact = claimed > CAPACITY ? claimed - CAPACITY : 0;
+        if (intact > first)
+        {
+            records.erase(records.begin() + start, records.begin() + start + static_cast<size_t>(std::min(intact, written) - first));
+        }
+    }
+
+private:
+    using Cell = std::array<std::atomic<uint64_t>, 3>;
+
+    alignas(64) std::atomic<uint64_t> m_written{ 0 };
+    std::atomic<uint64_t> m_claimed{ 0 };
+    std::array<Cell, CAPACITY> m_cells{};
+};
+
+//header is magic, version, record size, metadata hash and records count, all in native byte order
+inline void WriteTraceDump(std::ostream& out, uint64_t metadataHash, const std::vector<TraceRecord>& records)
+{
+    const uint32_t version = 1;
+    const uint32_t recordSize = sizeof(TraceRecord);
+    const uint64_t count = records.size();
+    out.write(""NSMTRACE"", 8);
+    out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    out.write(reinterpret_cast<const char*>(&recordSize), sizeof(recordSize));
+    out.write(reinterpret_cast<const char*>(&metadataHash), sizeof(metadataHash));
+    out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    out.write(reinterpret_cast<const char*>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(TraceRecord)));
+}
+
+";
+
+        //bounded MPSC ring with a sequence number per cell (after D. Vyukov's bounded queue), and a timer adapter posting fires to it
+        private const string INBOX_CODE =
+@"template<class Record>
+class MpscQueue
+{
+public:
+    explicit MpscQueue(size_t capacity)
+        : m_mask(RoundUpCapacity(capacity) - 1)
+        , m_cells(new Cell[m_mask + 1])
+    {
+        for (size_t i = 0; i <= m_mask; ++i)
+        {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    size_t GetCapacity() const
+    {
+        return m_mask + 1;
+    }
+
+    //may be called from any thread, returns false if the queue is full
+    bool TryPush(Record&& record)
+    {
+        size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& cell = m_cells[pos & m_mask];
+            const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0)
+            {
+                if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.record = std::move(record);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    //consumer thread only. Calls consumer with the oldest record, returns false if the queue is empty
+    template<class Consumer>
+    bool TryConsume(Consumer&& consumer)
+    {
+        Cell& cell = m_cells[m_dequeuePos & m_mask];
+        if (cell.sequence.load(std::memory_order_acquire) != m_dequeuePos + 1)
+        {
+            return false;
+        }
+        //cell is released even if consumer throws
+        struct Release
+        {
+            MpscQueue& queue;
+            Cell& cell;
+            ~Release()
+            {
+                cell.record = Record{};
+                cell.sequence.store(queue.m_dequeuePos + queue.m_mask + 1, std::memory_order_release);
+                ++queue.m_dequeuePos;
+            }
+        } release{ *this, cell };
+        consumer(cell.record);
+        return true;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        Record record;
+    };
+
+    static size_t RoundUpCapacity(size_t capacity)
+    {
+        size_t result = 2;
+        while (result < capacity)
+        {
+            result *= 2;
+        }
+        return result;
+    }
+
+    const size_t m_mask;
+    std::unique_ptr<Cell[]> m_cells;
+    alignas(64) std::atomic<size_t> m_enqueuePos{ 0 };
+    alignas(64) size_t m_dequeuePos = 0;
+};
+
+//Wraps a timer so that its fires are posted by the timer thread and delivered by the inbox thread.
+//A fire of an earlier start, delivered after the timer was restarted or stopped, is dropped.
+//This relies on T::Stop() not returning while the fired callback of T runs on another thread,
+//and on that callback not being called afterwards for the start that was stopped.
+//At most one fire of a timer is queued at a time, later fires only update its generation
+template<Timer T>
+class InboxTimer
+{
+public:
+    template<class Post>
+    InboxTimer(const TimerFactory<T>& timerFactory, const char* timerName, std::function<void(InboxTimer* timer)> callback, Post post)
+        : m_callback(std::move(callback))
+    {
+        m_timer = timerFactory(timerName, [this, post](T*)
+        {
+            m_firedGeneration.store(m_generation.load());
+            if (!m_queued.exchange(true))
+            {
+                post(this);
+            }
+        });
+    }
+
+    ~InboxTimer()
+    {
+        delete m_timer;
+    }
+
+    InboxTimer(const InboxTimer&) = delete;
+    InboxTimer& operator=(const InboxTimer&) = delete;
+
+    //the previous start is stopped first, so its callback can't observe the new generation
+    void StartOrReset(double timerDelaySeconds)
+    {
+        m_timer->Stop();
+        m_generation.fetch_add(1);
+        m_timer->StartOrReset(timerDelaySeconds);
+    }
+
+    void Stop()
+    {
+        m_timer->Stop();
+        m_generation.fetch_add(1);
+    }
+
+    //forwarded for snapshots if the wrapped timer supports them
+    bool IsActive() requires requires(T& t) { t.IsActive(); }
+    {
+        return m_timer->IsActive();
+    }
+
+    double GetRemainingSeconds() requires requires(T& t) { t.GetRemainingSeconds(); }
+    {
+        return m_timer->GetRemainingSeconds();
+    }
+
+    //inbox thread only. Generations start from 1, so 0 means there is no fire to deliver
+    void Fire()
+    {
+        m_queued.store(false);
+        const uint64_t generation = m_firedGeneration.exchange(0);
+        if (generation != 0 && generation == m_generation.load(std::memory_order_relaxed))
+        {
+            m_callback(this);
+        }
+    }
+
+private:
+    T* m_timer = nullptr;
+    std::atomic<uint64_t> m_generation{ 0 };
+    std::atomic<uint64_t> m_firedGeneration{ 0 };
+    std::atomic<bool> m_queued{ false };
+    std::function<void(InboxTimer* timer)> m_callback; //not TimerFiredCallback, as InboxTimer is incomplete here
+};
+
+";
+
+        //global operators are replaced in the benchmark translation unit only
+        private const string BENCHMARK_ALLOCATIONS_CODE =
+@"//every allocation of the process is counted, to see the ones made while processing events
+static uint64_t s_allocations = 0;
+static uint64_t s_allocatedBytes = 0;
+
+#if defined(__GNUC__) && !defined(__clang__)
+//replaced operators get inlined into callers, which GCC mistakes for mismatched new and free
+#pragma GCC diagnostic ignored ""-Wmismatched-new-delete""
+#endif
+
+//all forms are replaced, so that every allocation is counted, and every deallocation is paired with an allocation made here
+static void* CountedAllocate(std::size_t size) noexcept
+{
+    ++s_allocations;
+    s_allocatedBytes += size;
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+//pointer returned by malloc is kept right before the aligned block
+static void* CountedAllocateAligned(std::size_t size, std::align_val_t alignment) noexcept
+{
+    ++s_allocations;
+    s_allocatedBytes += size;
+    const std::size_t align = static_cast<std::size_t>(alignment);
+    void* raw = std::malloc(size + align + sizeof(void*));
+    if (raw == nullptr)
+    {
+        return nullptr;
+    }
+    const uintptr_t aligned = (reinterpret_cast<uintptr_t>(raw) + sizeof(void*) + align - 1) & ~(static_cast<uintptr_t>(align) - 1);
+    reinterpret_cast<void**>(aligned)[-1] = raw;
+    return reinterpret_cast<void*>(aligned);
+}
+
+static void CountedFreeAligned(void* pointer) noexcept
+{
+    if (pointer != nullptr)
+    {
+        std::free(static_cast<void**>(pointer)[-1]);
+    }
+}
+
+static void* CheckAllocated(void* pointer)
+{
+    if (pointer == nullptr)
+    {
+        std::abort();
+    }
+    return pointer;
+}
+
+void* operator new(std::size_t size) { return CheckAllocated(CountedAllocate(size)); }
+void* operator new[](std::size_t size) { return CheckAllocated(CountedAllocate(size)); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return CountedAllocate(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return CountedAllocate(size); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return CheckAllocated(CountedAllocateAligned(size, alignment)); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return CheckAllocated(CountedAllocateAligned(size, alignment)); }
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return CountedAllocateAligned(size, alignment); }
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return CountedAllocateAligned(size, alignment); }
+
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete[](void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, const std::nothrow_t&) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::align_val_t) noexcept { CountedFreeAligned(pointer); }
+void operator delete[](void* pointer, std::align_val_t) noexcept { CountedFreeAligned(pointer); }
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept { CountedFreeAligned(pointer); }
+void operator delete[](void* pointer, std::size_t, std::align_val_t) noexcept { CountedFreeAligned(pointer); }
+void operator delete(void* pointer, std::align_val_t, const std::nothrow_t&) noexcept { CountedFreeAligned(pointer); }
+void operator delete[](void* pointer, std::align_val_t, const std::nothrow_t&) noexcept { CountedFreeAligned(pointer); }
+";
+
+        private const string BENCHMARK_TIMER_CODE =
+@"uint64_t s_errors = 0; //errors reported by machines, and steps that did not go as their walks expected
+
+//Timers run on a virtual clock, which jumps to the moment a timer was due when it fires
+class BenchTimer
+{
+public:
+    static inline double s_now = 0;
+    static inline BenchTimer** s_constructed = nullptr; //timers of the instance being constructed, in order of s_timerNames
+
+    BenchTimer(const char* timerName, std::function<void(BenchTimer* timer)> callback) //not TimerFiredCallback, as BenchTimer is incomplete here
+        : m_callback(std::move(callback))
+    {
+        for (size_t i = 0; i < TIMERS_COUNT; ++i)
+        {
+            if (std::strcmp(s_timerNames[i], timerName) == 0)
+            {
+                s_constructed[i] = this;
+            }
+        }
+    }
+
+    void StartOrReset(double timerDelaySeconds)
+    {
+        m_deadline = s_now + timerDelaySeconds;
+        m_running = true;
+    }
+
+    void Stop()
+    {
+        m_running = false;
+    }
+
+    void Fire()
+    {
+        if (!m_running)
+        {
+            ++s_errors;
+            return;
+        }
+        m_running = false;
+        s_now = std::max(s_now, m_deadline);
+        m_callback(this);
+    }
+
+private:
+    std::function<void(BenchTimer* timer)> m_callback;
+    double m_deadline = 0;
+    bool m_running = false;
+};
+";
+
+        //Validator expands all of the choices, walks take a random one
+        private const string BENCHMARK_DRIVER_CODE =
+@"struct Step
+{
+    uint16_t invoker; //event, then timer, or RESTART
+    int16_t target; //state taken before following next_state, NO_STATE if current state is kept. Returned by function callbacks
+};
+
+//Random walk over the model of the state machine, following the rules of Validator: an event is taken only when it's enabled
+//by after_states and, if it's only_once, was not fired yet; a timer only when it's started. Timers are one-shot, so a fired
+//timer is not taken again until it's restarted. When nothing can be taken, the machine is restarted
+class Walker
+{
+public:
+    Walker()
+    {
+        Restart();
+    }
+
+    int16_t GetState() const
+    {
+        return m_state;
+    }
+
+    Step Next(std::mt19937_64& random)
+    {
+        std::array<uint16_t, INVOKERS_COUNT> candidates{};
+        size_t candidatesCount = 0;
+        for (size_t invoker = 0; invoker < INVOKERS_COUNT; ++invoker)
+        {
+            if (IsEnabled(invoker) && GetTargetsCount(invoker) > 0)
+            {
+                candidates[candidatesCount++] = static_cast<uint16_t>(invoker);
+            }
+        }
+        if (candidatesCount == 0)
+        {
+            Restart();
+            return Step{ RESTART, NO_STATE };
+        }
+
+        const uint16_t invoker = candidates[random() % candidatesCount];
+        const size_t targetIndex = s_targetOffsets[m_state * INVOKERS_COUNT + invoker] + random() % GetTargetsCount(invoker);
+        const int16_t target = s_targets[targetIndex];
+        if (invoker >= EVENTS_COUNT)
+        {
+            ClearBit(TIMER_BITS_OFFSET + invoker - EVENTS_COUNT);
+        }
+        if (target != NO_STATE)
+        {
+            Enter(target, invoker);
+        }
+        return Step{ invoker, target };
+    }
+
+private:
+    Mask m_mask{};
+    int16_t m_state = NO_STATE;
+
+    bool GetBit(size_t bit) const
+    {
+        return ((m_mask[bit / 64] >> (bit % 64)) & 1) != 0;
+    }
+
+    void SetBit(size_t bit)
+    {
+        m_mask[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+
+    void ClearBit(size_t bit)
+    {
+        m_mask[bit / 64] &= ~(uint64_t(1) << (bit % 64));
+    }
+
+    bool IsEnabled(size_t invoker) const
+    {
+        if (invoker < EVENTS_COUNT)
+        {
+            return GetBit(invoker) && !(s_onlyOnce[invoker] && GetBit(FIRED_BITS_OFFSET + invoker));
+        }
+        return GetBit(TIMER_BITS_OFFSET + invoker - EVENTS_COUNT);
+    }
+
+    size_t GetTargetsCount(size_t invoker) const
+    {
+        const size_t index = m_state * INVOKERS_COUNT + invoker;
+        return s_targetOffsets[index + 1] - s_targetOffsets[index];
+    }
+
+    //same as Start() of the machine, which does not follow next_state of the start state
+    void Restart()
+    {
+        m_mask = s_initialMask;
+        Apply(START_STATE, RESTART);
+    }
+
+    void Enter(int16_t state, size_t invoker)
+    {
+        Apply(state, invoker);
+        while (s_stateModels[m_state].next != NO_STATE)
+        {
+            Apply(s_stateModels[m_state].next, RESTART);
+        }
+    }
+
+    //invoker is RESTART when the state is not entered by an event
+    void Apply(int16_t state, size_t invoker)
+    {
+        const StateModel& model = s_stateModels[state];
+        for (size_t i = 0; i < MASK_WORDS; ++i)
+        {
+            m_mask[i] = (m_mask[i] & model.keep[i]) | model.set[i];
+        }
+        if (invoker < EVENTS_COUNT && s_onlyOnce[invoker])
+        {
+            SetBit(FIRED_BITS_OFFSET + invoker);
+        }
+        m_state = state;
+    }
+};
+
+struct Instance
+{
+    std::array<BenchTimer*, TIMERS_COUNT> timers{};
+    std::unique_ptr<Machine> machine;
+};
+";
+
+        private const string BENCHMARK_RUN_CODE =
+@"//Instances take steps of their walks in turn, so with many instances consecutive events go to different machines.
+//Walks are generated beforehand, so that only processing of events is measured
+void Run(const char* title, size_t instancesCount, size_t stepsPerInstance, uint64_t seed)
+{
+    std::mt19937_64 random(seed);
+    std::vector<Instance> instances(instancesCount);
+    std::vector<Walker> walkers(instancesCount);
+    for (Instance& instance : instances)
+    {
+        BenchTimer::s_constructed = instance.timers.data();
+        instance.machine = CreateMachine();
+        Dispatch(instance, Step{ RESTART, NO_STATE });
+    }
+
+    std::vector<Step> steps(instancesCount * stepsPerInstance);
+    uint64_t transitions = 0;
+    uint64_t restarts = 0;
+    for (size_t i = 0; i < steps.size(); ++i)
+    {
+        steps[i] = walkers[i % instancesCount].Next(random);
+        transitions += steps[i].target != NO_STATE ? 1 : 0;
+        restarts += steps[i].invoker == RESTART ? 1 : 0;
+    }
+
+    const uint64_t allocationsBefore = s_allocations;
+    const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < steps.size(); i += instancesCount)
+    {
+        for (size_t k = 0; k < instancesCount; ++k)
+        {
+            Dispatch(instances[k], steps[i + k]);
+        }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    const uint64_t allocations = s_allocations - allocationsBefore;
+
+    for (size_t k = 0; k < instancesCount; ++k)
+    {
+        if (instances[k].machine->GetCurrentState() != static_cast<State>(walkers[k].GetState()))
+        {
+            ++s_errors;
+        }
+    }
+
+    const double events = static_cast<double>(steps.size());
+    std::printf(
+        ""%s: %zu x %zu steps, %llu transitions, %llu restarts: %.2f ns/event, %.2f M transitions/s, %.4f allocations/event\n"",
+        title,
+        instancesCount,
+        stepsPerInstance,
+        static_cast<unsigned long long>(transitions),
+        static_cast<unsigned long long>(restarts),
+        seconds * 1e9 / events,
+        static_cast<double>(transitions) / seconds / 1e6,
+        static_cast<double>(allocations) / events
+    );
+}
+
+//Short lived machines, like transactions: each is constructed, started, walked until it can't go further or for maxSteps steps,
+//and destroyed. Walks are generated beforehand, while construction and destruction are measured together with processing
+void RunLifecycles(const char* title, size_t lifecyclesCount, size_t maxSteps, uint64_t seed)
+{
+    std::mt19937_64 random(seed);
+    std::vector<Step> steps;
+    std::vector<size_t> stepOffsets(1, 0);
+    std::vector<int16_t> endStates;
+    for (size_t i = 0; i < lifecyclesCount; ++i)
+    {
+        Walker walker;
+        int16_t state = walker.GetState();
+        for (size_t k = 0; k < maxSteps; ++k)
+        {
+            const Step step = walker.Next(random);
+            if (step.invoker == RESTART)
+            {
+                break;
+            }
+            steps.push_back(step);
+            state = walker.GetState();
+        }
+        stepOffsets.push_back(steps.size());
+        endStates.push_back(state);
+    }
+
+    const uint64_t allocationsBefore = s_allocations;
+    const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < lifecyclesCount; ++i)
+    {
+        Instance instance;
+        BenchTimer::s_constructed = instance.timers.data();
+        instance.machine = CreateMachine();
+        Dispatch(instance, Step{ RESTART, NO_STATE });
+        for (size_t k = stepOffsets[i]; k < stepOffsets[i + 1]; ++k)
         {
-            return $"m_{timerName}_delay";
+            Dispatch(instance, steps[k]);
         }
-
-        private void WriteFields()
+        if (instance.machine->GetCurrentState() != static_cast<State>(endStates[i]))
         {
-            this.m_writer.WriteLine($"{STATES_ENUM_NAME} m_currentState = {STATES_ENUM_NAME}::{this.m_stateMachine.StartState};");
+            ++s_errors;
+        }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    const uint64_t allocations = s_allocations - allocationsBefore;
 
-            foreach (string timer in this.m_stateMachine.Timers.Keys)
+    const double lifecycles = static_cast<double>(lifecyclesCount);
+    std::printf(
+        ""%s: %zu x up to %zu steps, %zu steps: %.2f ns/lifecycle, %.2f M lifecycles/s, %.2f allocations/lifecycle\n"",
+        title,
+        lifecyclesCount,
+        maxSteps,
+        steps.size(),
+        seconds * 1e9 / lifecycles,
+        lifecycles / seconds / 1e6,
+        static_cast<double>(allocations) / lifecycles
+    );
+}
+
+//Memory taken by many started machines kept alive together, like concurrent transactions. Heap bytes include the machine
+//object itself and everything it allocates, like timers and callbacks, but not the allocator's own overhead
+void RunFootprint(const char* title, size_t instancesCount)
+{
+    std::vector<Instance> instances(instancesCount);
+    const uint64_t allocationsBefore = s_allocations;
+    const uint64_t bytesBefore = s_allocatedBytes;
+    const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (Instance& instance : instances)
+    {
+        BenchTimer::s_constructed = instance.timers.data();
+        instance.machine = CreateMachine();
+        Dispatch(instance, Step{ RESTART, NO_STATE });
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    const uint64_t allocations = s_allocations - allocationsBefore;
+    const uint64_t bytes = s_allocatedBytes - bytesBefore;
+
+    const double count = static_cast<double>(instancesCount);
+    std::printf(
+        ""%s: %zu instances, sizeof %zu: %.1f heap bytes/instance, %.1f MB total, %.2f allocations/instance, %.2f ns/instance\n"",
+        title,
+        instancesCount,
+        sizeof(Machine),
+        static_cast<double>(bytes) / count,
+        static_cast<double>(bytes) / 1e6,
+        static_cast<double>(allocations) / count,
+        seconds * 1e9 / count
+    );
+}
+";
+
+        private const string BENCHMARK_BATCH_CODE =
+@"//Random walks go round by round, and in every round machines taking the same event get it as one batch, delivered in turn
+//with a ProcessEvent__ call per machine in order of instances, with one ProcessEventBatch__ call of the machines only,
+//and with one call of the struct-of-arrays overload. Timers and restarts are dispatched one by one in all runs.
+//Batches are prepared beforehand, so that only processing of events is measured
+void RunBatches(const char* title, size_t instancesCount, size_t rounds, uint64_t seed)
+{
+    std::mt19937_64 random(seed);
+    std::vector<Instance> instances(instancesCount);
+    std::vector<Walker> walkers(instancesCount);
+    std::vector<Machine*> machines(instancesCount);
+    for (size_t k = 0; k < instancesCount; ++k)
+    {
+        BenchTimer::s_constructed = instances[k].timers.data();
+        instances[k].machine = CreateMachine();
+        Dispatch(instances[k], Step{ RESTART, NO_STATE });
+        machines[k] = instances[k].machine.get();
+    }
+
+    enum class Delivery
+    {
+        per_event,
+        batched,
+        struct_of_arrays,
+    };
+
+    //walks of every run go on from where the previous run left them. Machines of a batch are ordered by state, as the batch
+    //groups them, so that function callbacks take choices in the order they are called
+    std::vector<size_t> scratch(instancesCount);
+    size_t batchedSteps = 0;
+    size_t batchesCount = 0;
+    auto run = [&](Delivery delivery)
+    {
+        struct Batch
+        {
+            uint16_t event;
+            size_t first;
+            size_t count;
+            size_t firstChoice;
+        };
+        std::vector<Machine*> batchMachines;
+        std::vector<State> batchStates;
+        std::vector<std::optional<State>> batchChoices;
+        std::vector<std::pair<size_t, Step>> batchSteps;
+        std::vector<Batch> batches;
+        std::vector<size_t> roundBatches(1, 0);
+        std::vector<std::pair<size_t, Step>> singles;
+        std::vector<size_t> roundSingles(1, 0);
+        std::vector<std::vector<std::pair<int16_t, size_t>>> buckets(EVENTS_COUNT);
+        for (size_t round = 0; round < rounds; ++round)
+        {
+            //buckets refer to steps by their index in the round
+            std::vector<std::pair<size_t, Step>> roundSteps;
+            for (size_t k = 0; k < instancesCount; ++k)
             {
-                this.m_writer.WriteLine($"T* {timer};");
+                const int16_t state = walkers[k].GetState();
+                const Step step = walkers[k].Next(random);
+                if (step.invoker < EVENTS_COUNT)
+                {
+                    buckets[step.invoker].emplace_back(state, roundSteps.size());
+                    roundSteps.emplace_back(k, step);
+                }
+                else
+                {
+                    singles.emplace_back(k, step);
+                }
             }
-            foreach (string timer in this.m_modifiedTimers)
+            for (uint16_t event = 0; event < EVENTS_COUNT; ++event)
             {
-                TimerDescr descr = this.m_stateMachine.Timers[timer];
-                this.m_writer.WriteLine($"double {ComposeTimerDelayVariable(timer)} = {descr.IntervalSeconds.ToString(CultureInfo.InvariantCulture)};");
+                std::vector<std::pair<int16_t, size_t>>& bucket = buckets[event];
+                if (bucket.empty())
+                {
+                    continue;
+                }
+                batches.push_back(Batch{ event, batchMachines.size(), bucket.size(), batchChoices.size() });
+                for (const std::pair<int16_t, size_t>& entry : bucket)
+                {
+                    batchSteps.push_back(roundSteps[entry.second]);
+                }
+                std::stable_sort(bucket.begin(), bucket.end(), [](const std::pair<int16_t, size_t>& a, const std::pair<int16_t, size_t>& b) { return a.first < b.first; });
+                for (const std::pair<int16_t, size_t>& entry : bucket)
+                {
+                    const std::pair<size_t, Step>& step = roundSteps[entry.second];
+                    batchMachines.push_back(machines[step.first]);
+                    batchStates.push_back(static_cast<State>(entry.first));
+                    if (s_eventChoices[entry.first * EVENTS_COUNT + event])
+                    {
+                        batchChoices.push_back(step.second.target == NO_STATE ? std::nullopt : std::optional<State>(static_cast<State>(step.second.target)));
+                    }
+                }
+                bucket.clear();
             }
-            this.m_writer.WriteLine();
+            roundBatches.push_back(batches.size());
+            roundSingles.push_back(singles.size());
         }
+        batchedSteps += batchSteps.size();
+        batchesCount += batches.size();
 
-        private void WriteConstructorDestructorStateGetter()
+        const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        for (size_t round = 0; round < rounds; ++round)
         {
-            this.m_writer.WriteLine($"{this.m_settings.ClassName}(TimerFactory<T> timerFactory)");
-            this.m_writer.WriteLine("{");
+            for (size_t b = roundBatches[round]; b < roundBatches[round + 1]; ++b)
             {
-                ++this.m_writer.Indent;
-
-                if (this.m_stateMachine.Timers.Count > 0)
+                const Batch& batch = batches[b];
+                if (delivery == Delivery::per_event)
                 {
-                    this.m_writer.WriteLine($"TimerFiredCallback<T> timerCallback = std::bind(&{this.m_settings.ClassName}::OnTimer, this, std::placeholders::_1);");
-                    foreach (string timer in this.m_stateMachine.Timers.Keys)
+                    for (size_t s = batch.first; s < batch.first + batch.count; ++s)
                     {
-                        this.m_writer.WriteLine($"{timer} = timerFactory(\"{timer}\", timerCallback);");
+                        Dispatch(instances[batchSteps[s].first], batchSteps[s].second);
                     }
-                };
-
-                --this.m_writer.Indent;
-            }
-            this.m_writer.WriteLine("}");
-            this.m_writer.WriteLine();
-
-            this.m_writer.WriteLine($"~{this.m_settings.ClassName}()");
-            this.m_writer.WriteLine("{");
-            {
-                ++this.m_writer.Indent;
-                foreach (string timer in this.m_stateMachine.Timers.Keys)
-                {
-                    this.m_writer.WriteLine($"delete {timer};");
+                    continue;
                 }
-                --this.m_writer.Indent;
+                //states are left empty for the overload of machines only
+                SetBatchChoices(batchChoices.data() + batch.firstChoice);
+                DispatchBatch(
+                    batch.event,
+                    delivery == Delivery::struct_of_arrays ? std::span<State>(batchStates.data() + batch.first, batch.count) : std::span<State>(),
+                    std::span<Machine* const>(batchMachines.data() + batch.first, batch.count),
+                    scratch
+                );
             }
-            this.m_writer.WriteLine("}");
-            this.m_writer.WriteLine();
-
-            this.m_writer.WriteLine($"{STATES_ENUM_NAME} GetCurrentState()");
-            this.m_writer.WriteLine("{");
+            SetBatchChoices(nullptr);
+            for (size_t s = roundSingles[round]; s < roundSingles[round + 1]; ++s)
             {
-                ++this.m_writer.Indent;
-                this.m_writer.WriteLine("return m_currentState;");
-                --this.m_writer.Indent;
+                Dispatch(instances[singles[s].first], singles[s].second);
             }
-            this.m_writer.WriteLine("}");
-            this.m_writer.WriteLine();
         }
+        //events per second
+        return static_cast<double>(batchSteps.size() + singles.size()) / std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    };
+    const double perEvent = run(Delivery::per_event);
+    const double batched = run(Delivery::batched);
+    const double structOfArrays = run(Delivery::struct_of_arrays);
 
-        private void WriteEnum(string enumName, IEnumerable<string> values)
+    for (size_t k = 0; k < instancesCount; ++k)
+    {
+        if (instances[k].machine->GetCurrentState() != static_cast<State>(walkers[k].GetState()))
         {
-            this.m_writer.WriteLine($"enum class {enumName}");
-            this.m_writer.WriteLine("{");
-            {
-                ++this.m_writer.Indent;
-                foreach (string @event in values)
-                {
-                    this.m_writer.Write(@event);
-                    this.m_writer.WriteLine(",");
-                };
-                --this.m_writer.Indent;
-            }
-            this.m_writer.WriteLine("};");
-            this.m_writer.WriteLine("");
+            ++s_errors;
         }
+    }
 
-        private static string ComposeStateEnterCallback(StateDescr state)
+    std::printf(
+        ""%s: %zu x %zu steps, %.1f machines/batch: per-event %.2f M events/s, batched %.2f M events/s (%.2fx), struct-of-arrays %.2f M events/s (%.2fx)\n"",
+        title,
+        instancesCount,
+        rounds,
+        batchesCount == 0 ? 0.0 : static_cast<double>(batchedSteps) / static_cast<double>(batchesCount),
+        perEvent / 1e6,
+        batched / 1e6,
+        batched / perEvent,
+        structOfArrays / 1e6,
+        structOfArrays / perEvent
+    );
+}
+";
+
+        private const string BENCHMARK_WHEEL_CODE =
+@"//Timers of the churn benchmark are numbered, and fired ones are collected to be handled after the tick
+class WheelTimers
+{
+public:
+    static constexpr double TICK_SECONDS = 0.001;
+
+    explicit WheelTimers(size_t timersCount)
+        : m_wheel(TICK_SECONDS)
+    {
+        m_timers.reserve(timersCount);
+        for (size_t i = 0; i < timersCount; ++i)
         {
-            return $"OnStateEnter__{state.Name}";
+            m_timers.push_back(std::make_unique<WheelTimer>(m_wheel, ""churn"", [this, i](WheelTimer*) { m_fired->push_back(i); }));
         }
+    }
 
-        private void WriteCommentIfSpecified(string? comment)
+    void Start(size_t timer, double delaySeconds)
+    {
+        m_timers[timer]->StartOrReset(delaySeconds);
+    }
+
+    void Stop(size_t timer)
+    {
+        m_timers[timer]->Stop();
+    }
+
+    void Advance(double nowSeconds, std::vector<size_t>& fired)
+    {
+        m_fired = &fired;
+        m_wheel.Tick(nowSeconds);
+    }
+
+private:
+    TimerWheel m_wheel;
+    std::vector<std::unique_ptr<WheelTimer>> m_timers;
+    std::vector<size_t>* m_fired = nullptr;
+};
+
+//Baseline: a priority queue of deadlines. Stopped and restarted timers leave stale entries behind, which are skipped when popped
+class HeapTimers
+{
+public:
+    explicit HeapTimers(size_t timersCount)
+        : m_generations(timersCount, 0)
+    {
+    }
+
+    void Start(size_t timer, double delaySeconds)
+    {
+        m_queue.push(Entry{ m_nowSeconds + delaySeconds, timer, ++m_generations[timer] });
+    }
+
+    void Stop(size_t timer)
+    {
+        ++m_generations[timer];
+    }
+
+    void Advance(double nowSeconds, std::vector<size_t>& fired)
+    {
+        m_nowSeconds = nowSeconds;
+        while (!m_queue.empty() && m_queue.top().deadline <= nowSeconds)
         {
-            if (comment != null)
+            const Entry entry = m_queue.top();
+            m_queue.pop();
+            if (entry.generation == m_generations[entry.timer])
             {
-                this.m_writer.Write("/*");
-                this.m_writer.Write(comment); //could be an injection )
-                this.m_writer.WriteLine("*/");
+                ++m_generations[entry.timer];
+                fired.push_back(entry.timer);
             }
         }
+    }
 
-        private void WriteCallbackEvents()
+private:
+    struct Entry
+    {
+        double deadline;
+        size_t timer;
+        uint64_t generation;
+
+        bool operator<(const Entry& other) const
         {
-            foreach (StateDescr state in this.m_stateMachine.States.Values)
-            {
-                if (state.NeedOnEnterEvent)
-                {
-                    string callbackName = ComposeStateEnterCallback(state);
-                    WriteCommentIfSpecified(state.OnEnterEventComment);
-                    if (state.OnEnterEventAlluxTargets == null)
-                    {
-                        this.m_writer.WriteLine($"std::function<void()> {callbackName};");
-                    }
-                    else
-                    {
-                        this.m_writer.WriteLine($"std::function<std::optional<{STATES_ENUM_NAME}>()> {callbackName};");
-                    }
-                }
-            }
-            this.m_writer.WriteLine();
+            return deadline > other.deadline;
+        }
+    };
 
-            Dictionary<string, bool> declaredEventCallbacks = new Dictionary<string, bool>();    //callback name -> is function callback
-            foreach (StateDescr state in this.m_stateMachine.States.Values)
+    std::priority_queue<Entry> m_queue;
+    std::vector<uint64_t> m_generations;
+    double m_nowSeconds = 0;
+};
+
+//Timers of INVITE client transactions, independent of the machine: every transaction starts retransmission Timer A
+//(0.5 s, doubled on every fire) and timeout Timer B (32 s), and gets a final response after a random delay of up to 4 s,
+//which stops both. Answered transactions are started again right away, so all the timers stay in use. Time is virtual,
+//ticks every ms, and starts and answers are generated beforehand
+template<class Timers>
+void RunChurn(const char* title, size_t transactionsCount, size_t seconds, uint64_t seed)
+{
+    std::mt19937_64 random(seed);
+    const size_t ticksCount = static_cast<size_t>(static_cast<double>(seconds) / WheelTimers::TICK_SECONDS);
+    std::uniform_real_distribution<double> startTime(0, 1);
+    std::uniform_real_distribution<double> answerDelay(0, 4);
+    //transaction * 2 + 1 if it's answered, in order of ticks
+    std::vector<std::pair<size_t, size_t>> arrivals;
+    for (size_t t = 0; t < transactionsCount; ++t)
+    {
+        double time = startTime(random);
+        arrivals.emplace_back(static_cast<size_t>(time / WheelTimers::TICK_SECONDS), t * 2);
+        for (;;)
+        {
+            time += answerDelay(random);
+            const size_t tick = static_cast<size_t>(time / WheelTimers::TICK_SECONDS);
+            if (tick >= ticksCount)
             {
-                if (state.EventEdges != null)
-                {
-                    foreach (EdgeDescr edge in state.EventEdges.Values)
-                    {
-                        foreach (EdgeTraverseCallbackType callbackType in edge.OnTraverseEventTypes)
-                        {
-                            EventDescr @event = this.m_stateMachine.Events[edge.InvokerName];
-                            WriteCallbackEvent(state, edge, @event.Args, callbackType, declaredEventCallbacks);
-                        }
-                    }
-                }
-                if (state.TimerEdges != null)
-                {
-                    foreach (EdgeDescr edge in state.TimerEdges.Values)
-                    {
-                        foreach (EdgeTraverseCallbackType callbackType in edge.OnTraverseEventTypes)
-                        {
-                            WriteCallbackEvent(state, edge, null, callbackType, declaredEventCallbacks);
-                        }
-                    }
-                }
+                break;
             }
-            this.m_writer.WriteLine();
+            arrivals.emplace_back(tick, t * 2 + 1);
         }
+    }
+    std::stable_sort(arrivals.begin(), arrivals.end(), [](const std::pair<size_t, size_t>& a, const std::pair<size_t, size_t>& b) { return a.first < b.first; });
 
-        private void WriteCallbackEvent(StateDescr state, EdgeDescr edge, List<KeyValuePair<string, string>>? eventArgs, EdgeTraverseCallbackType callbackType, Dictionary<string, bool> declaredEventCallbacks)
+    Timers timers(2 * transactionsCount);
+    std::vector<double> intervals(transactionsCount, 0.5);
+    std::vector<size_t> fired;
+    fired.reserve(2 * transactionsCount);
+    uint64_t starts = 0;
+    uint64_t stops = 0;
+    uint64_t fires = 0;
+    size_t next = 0;
+    const uint64_t allocationsBefore = s_allocations;
+    const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (size_t tick = 0; tick < ticksCount; ++tick)
+    {
+        timers.Advance(static_cast<double>(tick) * WheelTimers::TICK_SECONDS, fired);
+        for (size_t timer : fired)
         {
-            string callbackName = ExportHelper.ComposeEdgeTraveseCallbackName(callbackType, state, edge, out bool needArgs, out bool isFunction);
-            if (declaredEventCallbacks.TryGetValue(callbackName, out bool oldCallbackIsFunction))
+            ++fires;
+            const size_t t = timer / 2;
+            if (timer % 2 == 0)
             {
-                if (oldCallbackIsFunction != isFunction)
-                {
-                    throw new Exception("should not happen! check validator!");
-                }
-                return;
+                //retransmission
+                intervals[t] *= 2;
+                timers.Start(timer, intervals[t]);
+                ++starts;
             }
             else
             {
-                declaredEventCallbacks.Add(callbackName, isFunction);
-            };
-            WriteCommentIfSpecified(edge.TraverseEventComment);
+                //timeout
+                timers.Stop(timer - 1);
+                ++stops;
+            }
+        }
+        fired.clear();
+        for (; next < arrivals.size() && arrivals[next].first == tick; ++next)
+        {
+            const size_t t = arrivals[next].second / 2;
+            if (arrivals[next].second % 2 != 0)
+            {
+                timers.Stop(t * 2);
+                timers.Stop(t * 2 + 1);
+                stops += 2;
+            }
+            intervals[t] = 0.5;
+            timers.Start(t * 2, intervals[t]);
+            timers.Start(t * 2 + 1, 32);
+            starts += 2;
+        }
+    }
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    const uint64_t allocations = s_allocations - allocationsBefore;
 
-            needArgs = needArgs 
-                && eventArgs != null 
-                && eventArgs.Count > 0;
+    const double operations = static_cast<double>(starts + stops + fires);
+    std::printf(
+        ""%s: %zu timers, %zu s: %llu starts, %llu stops, %llu fires: %.2f ns/operation, %.2f M operations/s, %.4f allocations/operation\n"",
+        title,
+        2 * transactionsCount,
+        seconds,
+        static_cast<unsigned long long>(starts),
+        static_cast<unsigned long long>(stops),
+        static_cast<unsigned long long>(fires),
+        elapsed * 1e9 / operations,
+        operations / elapsed / 1e6,
+        static_cast<double>(allocations) / operations
+    );
+}
+";
 
-            this.m_writer.Write($"std::function<");
-            this.m_writer.Write(isFunction ? $"std::optional<{STATES_ENUM_NAME}>" : "void");
-            this.m_writer.Write("(");
-            if (needArgs)
+        private const string BENCHMARK_INBOX_CODE =
+@"//Producers post records through the queue of the inbox, and the machine is run by the thread draining it
+double RunInboxHandoff(Instance& instance, size_t producersCount, const std::vector<Step>& steps)
+{
+    const size_t perProducer = steps.size() / producersCount;
+    MpscQueue<uint32_t> queue(1024);
+    std::vector<size_t> received(producersCount, 0);
+    std::atomic<bool> go{ false };
+    std::vector<std::thread> producers;
+    for (size_t p = 0; p < producersCount; ++p)
+    {
+        producers.emplace_back([&queue, &go, p, perProducer]
+        {
+            while (!go.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+            for (size_t i = 0; i < perProducer; ++i)
             {
-                for (int i = 0; i < eventArgs!.Count; ++i)
+                while (!queue.TryPush(static_cast<uint32_t>(p)))
                 {
-                    KeyValuePair<string, string> arg = eventArgs[i];
-                    if (i != 0)
-                    {
-                        this.m_writer.Write(", ");
-                    };
-                    this.m_writer.Write($"{arg.Value}");
+                    std::this_thread::yield();
                 }
-            };
-            this.m_writer.Write(")");
-            this.m_writer.WriteLine($"> {callbackName}; ");
+            }
+        });
+    }
+
+    const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    size_t processed = 0;
+    while (processed < steps.size())
+    {
+        if (queue.TryConsume([&](uint32_t& producer) { ++received[producer]; Dispatch(instance, steps[processed]); }))
+        {
+            ++processed;
+        }
+        else
+        {
+            std::this_thread::yield();
         }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
 
-        private static Regex s_splitRegex = new Regex(@"\r?\n", RegexOptions.Compiled);
-        private void WriteVerbatimCode(string code)
+    for (std::thread& producer : producers)
+    {
+        producer.join();
+    }
+    for (size_t count : received)
+    {
+        if (count != perProducer)
         {
-            foreach (string line in s_splitRegex.Split(code))
+            ++s_errors;
+        }
+    }
+    return seconds;
+}
+
+//Baseline: every producer runs the machine itself, holding a mutex
+double RunMutexHandoff(Instance& instance, size_t producersCount, const std::vector<Step>& steps)
+{
+    const size_t perProducer = steps.size() / producersCount;
+    std::mutex mutex;
+    size_t next = 0;
+    std::atomic<bool> go{ false };
+    std::vector<std::thread> producers;
+    for (size_t p = 0; p < producersCount; ++p)
+    {
+        producers.emplace_back([&instance, &steps, &mutex, &next, &go, perProducer]
+        {
+            while (!go.load(std::memory_order_acquire))
             {
-                this.m_writer.WriteLine(line);
+                std::this_thread::yield();
             }
-        }
+            for (size_t i = 0; i < perProducer; ++i)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                Dispatch(instance, steps[next++]);
+            }
+        });
+    }
 
-        private const string STATES_ENUM_NAME = "State";
+    const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (std::thread& producer : producers)
+    {
+        producer.join();
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
 
-        private const string HEADER_PREAMBLE_CODE =
-@"
-#pragma once
+//N producer threads hand events over to one machine, through the inbox and under a mutex. Events of different producers
+//interleave arbitrarily, while the machine has to follow its walk, so a record only carries its producer, and every record
+//handed over takes the next step of a walk generated beforehand. Both runs take the same steps, so only handoffs differ
+void RunContention(const char* title, size_t producersCount, size_t stepsCount, uint64_t seed)
+{
+    std::mt19937_64 random(seed);
+    Walker walker;
+    std::vector<Step> steps(std::max<size_t>(stepsCount / producersCount, 1) * producersCount);
+    for (Step& step : steps)
+    {
+        step = walker.Next(random);
+    }
 
-#include <stdexcept>
-#include <functional>
-#include <optional>
+    double seconds[2] = {};
+    for (size_t run = 0; run < 2; ++run)
+    {
+        Instance instance;
+        BenchTimer::s_constructed = instance.timers.data();
+        instance.machine = CreateMachine();
+        Dispatch(instance, Step{ RESTART, NO_STATE });
+        seconds[run] = run == 0 ? RunInboxHandoff(instance, producersCount, steps) : RunMutexHandoff(instance, producersCount, steps);
+        if (instance.machine->GetCurrentState() != static_cast<State>(walker.GetState()))
+        {
+            ++s_errors;
+        }
+    }
 
+    const double events = static_cast<double>(steps.size());
+    std::printf(
+        ""%s: %zu producers, %zu events: inbox %.2f ns/event, %.2f M events/s, mutex %.2f ns/event, %.2f M events/s\n"",
+        title,
+        producersCount,
+        steps.size(),
+        seconds[0] * 1e9 / events,
+        events / seconds[0] / 1e6,
+        seconds[1] * 1e9 / events,
+        events / seconds[1] / 1e6
+    );
+}
 ";
 
-        private const string TIMER_CODE =
-@"
-template<class T>
-concept Timer = requires(T t) {
-    { t.StartOrReset(double timerDelaySeconds) };
-    { t.Stop() };
-};
-
-template<Timer T>
-using TimerFiredCallback = void(*)(const T* timer);
-
-template<Timer T>
-using TimerFactory = T*(*)(const char* timerName, TimerFiredCallback<T> callback);
-
-";
+        private const string BENCHMARK_ARGUMENTS_CODE =
+@"const size_t steps = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+const size_t instances = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000;
+const uint64_t seed = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1;
+const size_t largeInstances = argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 1000000;
+if (steps == 0 || instances == 0 || largeInstances == 0)
+{
+    std::printf(""Usage: %s [steps] [instances] [seed] [large instances]\n"", argv[0]);
+    return 1;
+}";
 
     }
 }
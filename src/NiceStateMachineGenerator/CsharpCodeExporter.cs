@@ -25,27 +25,38 @@ namespace NiceStateMachineGenerator
             public bool AsyncCallbacks { get; set; } = false;
 
             internal string NullableQuantifier => this.NullableReferenceTypes ? "?" : "";
+
+            //settings may be used for several state machines at once, so they are copied rather than changed
+            internal Settings WithClassName(string className)
+            {
+                Settings result = (Settings)this.MemberwiseClone();
+                result.ClassName = className;
+                return result;
+            }
         }
 
         public static void Export(StateMachineDescr stateMachine, string stateMachineFileName, string? commonCodeFileName, Settings settings)
         {
             if (String.IsNullOrEmpty(settings.ClassName))
             {
-                settings.ClassName = ExportHelper.GetClassNameFromFileName(stateMachineFileName);
+                settings = settings.WithClassName(ExportHelper.GetClassNameFromFileName(stateMachineFileName));
             };
             if (commonCodeFileName != null && commonCodeFileName != stateMachineFileName)
             {
-                using (StreamWriter stateMachineWriter = new StreamWriter(stateMachineFileName))
-                using (StreamWriter commonCodeWriter = new StreamWriter(commonCodeFileName))
+                using (StringWriter stateMachineWriter = new StringWriter())
+                using (StringWriter commonCodeWriter = new StringWriter())
                 {
                     Export(stateMachine, stateMachineWriter, commonCodeWriter, settings);
+                    OutputFileWriter.WriteIfChanged(stateMachineFileName, stateMachineWriter.ToString());
+                    OutputFileWriter.WriteIfChanged(commonCodeFileName, commonCodeWriter.ToString());
                 }
             }
             else
             {
-                using (StreamWriter stateMachineWriter = new StreamWriter(stateMachineFileName))
+                using (StringWriter stateMachineWriter = new StringWriter())
                 {
                     Export(stateMachine, stateMachineWriter, null, settings);
+                    OutputFileWriter.WriteIfChanged(stateMachineFileName, stateMachineWriter.ToString());
                 }
             }
 
@@ -81,6 +92,7 @@ namespace NiceStateMachineGenerator
         private readonly IndentedTextWriter? m_commonCodeWriter;
         private readonly Settings m_settings;
         private readonly HashSet<string> m_modifiedTimers;
+        private readonly TimerLiveness m_timerLiveness;
         private readonly string m_generatedBy;
 
         private CsharpCodeExporter(StateMachineDescr stateMachine, IndentedTextWriter mainCodeWriter, IndentedTextWriter? commonCodeWriter, Settings settings)
@@ -97,6 +109,8 @@ namespace NiceStateMachineGenerator
                 .Select(t => t.TimerName)
                 .ToHashSet();
 
+            this.m_timerLiveness = Validator.ComputeTimerLiveness(this.m_stateMachine);
+
             this.m_generatedBy = $"// generated by {nameof(NiceStateMachineGenerator)} v{Assembly.GetExecutingAssembly().GetName().Version}";
         }
 
@@ -539,7 +553,8 @@ namespace NiceStateMachineGenerator
                 this.m_mainCodeWriter.WriteLine($"this.OnStateEnter?.Invoke({STATES_ENUM_NAME}.{state.Name});");
             }
 
-            foreach (string timer in state.StopTimers)
+            //timers that can't be running on entering the state need not be stopped
+            foreach (string timer in state.StopTimers.Where(t => this.m_timerLiveness.MayBeActiveOnEntry(state.Name, t)))
             {
                 this.m_mainCodeWriter.WriteLine($"this.{timer}.Stop();");
             }
@@ -43,9 +43,10 @@ namespace NiceStateMachineGenerator
 
         public static void Export(StateMachineDescr stateMachine, string fileName, Settings settings)
         {
-            using (StreamWriter writer = new StreamWriter(fileName))
+            using (StringWriter writer = new StringWriter())
             {
                 Export(stateMachine, writer, settings);
+                OutputFileWriter.WriteIfChanged(fileName, writer.ToString());
             }
         }
 
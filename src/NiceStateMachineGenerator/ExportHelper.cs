@@ -21,6 +21,18 @@ namespace NiceStateMachineGenerator
             return className;
         }
 
+        //64 bit FNV-1a of UTF-8 bytes, stable across runs unlike String.GetHashCode
+        internal static ulong ComputeFnv1aHash(string value)
+        {
+            ulong hash = 14695981039346656037UL;
+            foreach (byte b in Encoding.UTF8.GetBytes(value))
+            {
+                hash ^= b;
+                hash *= 1099511628211UL;
+            }
+            return hash;
+        }
+
         internal static string ComposeEdgeTraveseCallbackName(EdgeTraverseCallbackType callbackType, StateDescr source, EdgeDescr edge, out bool eventMayHaveArgs, out bool eventIsFunction)
         {
             StringBuilder builder = new StringBuilder();
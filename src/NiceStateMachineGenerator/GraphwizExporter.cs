@@ -19,9 +19,10 @@ namespace NiceStateMachineGenerator
 
         public static void Export(StateMachineDescr stateMachine, string fileName, Settings settings)
         {
-            using (StreamWriter writer = new StreamWriter(fileName))
+            using (StringWriter writer = new StringWriter())
             {
                 Export(stateMachine, writer, settings);
+                OutputFileWriter.WriteIfChanged(fileName, writer.ToString());
             }
         }
 
@@ -34,6 +35,12 @@ namespace NiceStateMachineGenerator
         }
 
         public static void Export(StateMachineDescr stateMachine, IndentedTextWriter writer, Settings settings)
+        {
+            Export(stateMachine, writer, settings, null);
+        }
+
+        //overlay is written after all regular nodes and edges, so that it may add new edges and restyle nodes
+        internal static void Export(StateMachineDescr stateMachine, IndentedTextWriter writer, Settings settings, Action<IndentedTextWriter>? writeOverlay)
         {
             writer.WriteLine("digraph {");
 
@@ -123,6 +130,13 @@ namespace NiceStateMachineGenerator
                 --writer.Indent;
             }
 
+            if (writeOverlay != null)
+            {
+                ++writer.Indent;
+                writeOverlay(writer);
+                --writer.Indent;
+            };
+
             writer.WriteLine("}");
         }
 
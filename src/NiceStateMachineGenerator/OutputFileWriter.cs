@@ -0,0 +1,43 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Text;
+using System.Threading.Tasks;
+
+namespace NiceStateMachineGenerator
+{
+    public static class OutputFileWriter
+    {
+        private static readonly Encoding s_encoding = new UTF8Encoding(encoderShouldEmitUTF8Identifier: false); //same as StreamWriter default
+
+        //Replaces the file only if its content has actually changed, so that modification time of unchanged outputs is kept
+        //and build systems do not rebuild everything that depends on them. New content goes to a temporary file that is then
+        //moved over the old one, so readers never see a partially written file.
+        //Returns true if file was written.
+        public static bool WriteIfChanged(string fileName, string content)
+        {
+            byte[] bytes = s_encoding.GetBytes(content);
+            if (File.Exists(fileName))
+            {
+                FileInfo fileInfo = new FileInfo(fileName);
+                if (fileInfo.Length == bytes.Length && File.ReadAllBytes(fileName).AsSpan().SequenceEqual(bytes))
+                {
+                    return false;
+                }
+            };
+
+            string tempFileName = $"{fileName}.{Guid.NewGuid():N}.tmp";
+            try
+            {
+                File.WriteAllBytes(tempFileName, bytes);
+                File.Move(tempFileName, fileName, overwrite: true);
+            }
+            finally
+            {
+                File.Delete(tempFileName); //no-op if moved
+            }
+            return true;
+        }
+    }
+}
@@ -546,7 +546,28 @@ namespace NiceStateMachineGenerator
                         {
                             throw new ParseValidationException(property, $"duplicate arg name '{argName}'");
                         };
-                        string argType = ParserHelper.CheckAndConvertToString(property.Value, "arg value");
+                        string argType;
+                        if (property.Value.Type == JTokenType.Object)
+                        {
+                            //{ "type": "...", "pass": "const_ref" }
+                            JObject argObject = (JObject)property.Value;
+                            HashSet<string> argHandledTokens = new HashSet<string>();
+                            argType = ParserHelper.GetJStringRequired(argObject, "type", argHandledTokens, out _);
+                            string? passMode = ParserHelper.GetJString(argObject, "pass", argHandledTokens, out JToken? passModeToken, required: false);
+                            if (passMode != null)
+                            {
+                                if (!Enum.TryParse(passMode, out ArgPassMode value))
+                                {
+                                    throw new ParseValidationException(passModeToken!, $"Failed to convert value '{passMode}' to arg pass mode. Possible values are {String.Join(", ", Enum.GetNames<ArgPassMode>())}");
+                                };
+                                eventDescr.ArgPassModes.Add(argName, value);
+                            };
+                            ParserHelper.CheckAllTokensHandled(argObject, argHandledTokens);
+                        }
+                        else
+                        {
+                            argType = ParserHelper.CheckAndConvertToString(property.Value, "arg value");
+                        };
                         eventDescr.Args.Add(new KeyValuePair<string, string>(argName, argType));
                     }
                 }
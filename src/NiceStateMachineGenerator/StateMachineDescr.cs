@@ -30,10 +30,26 @@ namespace NiceStateMachineGenerator
         target_only,
     }
 
+    public enum ArgPassMode
+    {
+        //copied to event method and to every callback
+        value,
+
+        //const reference
+        const_ref,
+
+        //by value, moved to the last callback invoked for the event
+        move,
+
+        //std::string_view for std::string, std::span<const T> for std::vector<T>, const reference for other types
+        view,
+    }
+
     public sealed class EventDescr
     {
         public readonly string Name;
         public readonly List<KeyValuePair<string, string>> Args = new List<KeyValuePair<string, string>>();
+        public readonly Dictionary<string, ArgPassMode> ArgPassModes = new Dictionary<string, ArgPassMode>(); //only for args with explicitly specified mode
         public HashSet<string>? AfterStates { get; set; }
         public bool OnlyOnce { get; set; }
 
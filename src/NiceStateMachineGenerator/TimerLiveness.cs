@@ -0,0 +1,38 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text;
+using System.Threading.Tasks;
+
+namespace NiceStateMachineGenerator
+{
+    //Timers that may be running when entering each state, and together with each other, see Validator.ComputeTimerLiveness.
+    //Stopping a timer that is not in the set is a no-op, so exporters may omit it. Timers that are never running
+    //together may be backed by the same timer object
+    public sealed class TimerLiveness
+    {
+        private readonly Dictionary<string, HashSet<string>> m_activeOnEntry; //by state
+        private readonly Dictionary<string, HashSet<string>> m_activeTogether; //by timer
+
+        public TimerLiveness(Dictionary<string, HashSet<string>> activeOnEntry, Dictionary<string, HashSet<string>> activeTogether)
+        {
+            this.m_activeOnEntry = activeOnEntry;
+            this.m_activeTogether = activeTogether;
+        }
+
+        public IReadOnlySet<string> GetActiveOnEntry(string state)
+        {
+            return this.m_activeOnEntry[state];
+        }
+
+        public bool MayBeActiveOnEntry(string state, string timer)
+        {
+            return this.m_activeOnEntry[state].Contains(timer);
+        }
+
+        public bool MayBeActiveTogether(string timer, string otherTimer)
+        {
+            return this.m_activeTogether[timer].Contains(otherTimer);
+        }
+    }
+}
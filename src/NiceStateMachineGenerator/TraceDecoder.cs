@@ -0,0 +1,206 @@
+﻿using System;
+using System.CodeDom.Compiler;
+using System.Collections.Generic;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using System.Text;
+using System.Threading.Tasks;
+
+namespace NiceStateMachineGenerator
+{
+    public readonly struct TraceRecord
+    {
+        public readonly ulong Timestamp;
+        public readonly ulong Instance;
+        public readonly ushort From;
+        public readonly ushort Invoker;
+        public readonly ushort To;
+        public readonly ushort Thread;
+
+        public TraceRecord(ulong timestamp, ulong instance, ushort from, ushort invoker, ushort to, ushort thread)
+        {
+            this.Timestamp = timestamp;
+            this.Instance = instance;
+            this.From = from;
+            this.Invoker = invoker;
+            this.To = to;
+            this.Thread = thread;
+        }
+    }
+
+    //Decodes dumps of traces recorded by generated C++ code (see CppCodeExporter.Settings.Trace)
+    public static class TraceDecoder
+    {
+        public const ushort NO_ID = 0xFFFF;
+
+        private const string MAGIC = "NSMTRACE";
+        private const uint VERSION = 1;
+        private const uint RECORD_SIZE = 24;
+
+        //events, then timers, same as ids in trace records
+        public static List<string> GetInvokerNames(StateMachineDescr stateMachine)
+        {
+            return stateMachine.Events.Keys
+                .Concat(stateMachine.Timers.Keys)
+                .ToList();
+        }
+
+        //FNV-1a of state and invoker names, so that a dump is not decoded with a different version of state machine
+        public static ulong ComputeMetadataHash(StateMachineDescr stateMachine)
+        {
+            return ExportHelper.ComputeFnv1aHash(String.Join("\n", stateMachine.States.Keys) + "\n\n" + String.Join("\n", GetInvokerNames(stateMachine)));
+        }
+
+        //dumps are written in native byte order, so only little endian producers are supported
+        public static List<TraceRecord> ReadDump(string fileName, StateMachineDescr stateMachine)
+        {
+            using (BinaryReader reader = new BinaryReader(File.OpenRead(fileName)))
+            {
+                string magic = Encoding.ASCII.GetString(reader.ReadBytes(MAGIC.Length));
+                if (magic != MAGIC)
+                {
+                    throw new Exception($"{fileName} is not a state machine trace dump");
+                };
+                uint version = reader.ReadUInt32();
+                uint recordSize = reader.ReadUInt32();
+                if (version != VERSION || recordSize != RECORD_SIZE)
+                {
+                    throw new Exception($"Unsupported trace dump version {version} with record size {recordSize}");
+                };
+                ulong metadataHash = reader.ReadUInt64();
+                if (metadataHash != ComputeMetadataHash(stateMachine))
+                {
+                    throw new Exception("Trace dump was recorded by code generated from a different state machine (states or events do not match)");
+                };
+                ulong count = reader.ReadUInt64();
+
+                int statesCount = stateMachine.States.Count;
+                int invokersCount = stateMachine.Events.Count + stateMachine.Timers.Count;
+                List<TraceRecord> result = new List<TraceRecord>();
+                for (ulong i = 0; i < count; ++i)
+                {
+                    TraceRecord record = new TraceRecord(
+                        timestamp: reader.ReadUInt64(),
+                        instance: reader.ReadUInt64(),
+                        from: reader.ReadUInt16(),
+                        invoker: reader.ReadUInt16(),
+                        to: reader.ReadUInt16(),
+                        thread: reader.ReadUInt16()
+                    );
+                    if ((record.From != NO_ID && record.From >= statesCount)
+                        || (record.To != NO_ID && record.To >= statesCount)
+                        || (record.Invoker != NO_ID && record.Invoker >= invokersCount))
+                    {
+                        throw new Exception($"Trace record {i} has unexpected state or event id");
+                    };
+                    result.Add(record);
+                }
+                return result;
+            }
+        }
+
+        public static void ExportText(StateMachineDescr stateMachine, IReadOnlyList<TraceRecord> records, string fileName)
+        {
+            using (StringWriter writer = new StringWriter())
+            {
+                ExportText(stateMachine, records, writer);
+                OutputFileWriter.WriteIfChanged(fileName, writer.ToString());
+            }
+        }
+
+        public static void ExportText(StateMachineDescr stateMachine, IReadOnlyList<TraceRecord> records, TextWriter writer)
+        {
+            List<string> states = stateMachine.States.Keys.ToList();
+            List<string> invokers = GetInvokerNames(stateMachine);
+
+            writer.WriteLine($"# {records.Count} records of {records.Select(r => r.Instance).Distinct().Count()} instances from {records.Select(r => r.Thread).Distinct().Count()} threads, timestamps are relative to the first record");
+            foreach (TraceRecord record in records)
+            {
+                string timestamp = (record.Timestamp - records[0].Timestamp).ToString(CultureInfo.InvariantCulture);
+                string transition;
+                if (record.From == NO_ID)
+                {
+                    transition = $"Start -> {states[record.To]}";
+                }
+                else if (record.To == NO_ID)
+                {
+                    transition = $"{states[record.From]} --{(record.Invoker == NO_ID ? "<unknown timer>" : invokers[record.Invoker])}--> rejected";
+                }
+                else
+                {
+                    transition = $"{states[record.From]} --{invokers[record.Invoker]}--> {states[record.To]}";
+                };
+                writer.WriteLine($"+{timestamp}\tthread {record.Thread}\tinstance 0x{record.Instance:x}\t{transition}");
+            }
+        }
+
+        public static void ExportGraphwiz(StateMachineDescr stateMachine, IReadOnlyList<TraceRecord> records, string fileName, GraphwizExporter.Settings settings)
+        {
+            using (StringWriter writer = new StringWriter())
+            {
+                using (IndentedTextWriter indentedWriter = new IndentedTextWriter(writer))
+                {
+                    ExportGraphwiz(stateMachine, records, indentedWriter, settings);
+                }
+                OutputFileWriter.WriteIfChanged(fileName, writer.ToString());
+            }
+        }
+
+        //Regular graph with traced transitions drawn over it in red. For a single instance edges are labelled
+        //with step numbers, so that the path can be followed; otherwise with number of traversals
+        public static void ExportGraphwiz(StateMachineDescr stateMachine, IReadOnlyList<TraceRecord> records, IndentedTextWriter writer, GraphwizExporter.Settings settings)
+        {
+            List<string> states = stateMachine.States.Keys.ToList();
+            List<string> invokers = GetInvokerNames(stateMachine);
+            bool singleInstance = records.Select(r => r.Instance).Distinct().Count() == 1;
+
+            //ordered by first traversal
+            Dictionary<(ushort from, ushort invoker, ushort to), List<int>> steps = new Dictionary<(ushort from, ushort invoker, ushort to), List<int>>();
+            HashSet<ushort> visitedStates = new HashSet<ushort>();
+            for (int i = 0; i < records.Count; ++i)
+            {
+                TraceRecord record = records[i];
+                if (record.From == NO_ID)
+                {
+                    visitedStates.Add(record.To);
+                    continue;
+                };
+                visitedStates.Add(record.From);
+                if (record.To != NO_ID)
+                {
+                    visitedStates.Add(record.To);
+                };
+                (ushort, ushort, ushort) key = (record.From, record.Invoker, record.To);
+                if (!steps.TryGetValue(key, out List<int>? edgeSteps))
+                {
+                    edgeSteps = new List<int>();
+                    steps.Add(key, edgeSteps);
+                };
+                edgeSteps.Add(i + 1);
+            }
+
+            GraphwizExporter.Export(stateMachine, writer, settings, overlayWriter => {
+                foreach (ushort state in visitedStates.OrderBy(s => s))
+                {
+                    overlayWriter.WriteLine($"{states[state]} [color = \"red\"; penwidth = 2];");
+                }
+                foreach (KeyValuePair<(ushort from, ushort invoker, ushort to), List<int>> edge in steps)
+                {
+                    string invoker = edge.Key.invoker == NO_ID ? "<unknown timer>" : invokers[edge.Key.invoker];
+                    string label = singleInstance
+                        ? $"#{String.Join(", #", edge.Value)} {invoker}"
+                        : $"{invoker} x{edge.Value.Count}";
+                    if (edge.Key.to == NO_ID)
+                    {
+                        overlayWriter.WriteLine($"{states[edge.Key.from]} -> {states[edge.Key.from]} [label = \"{label} rejected\"; color = \"red\"; fontcolor = \"red\"; style = dashed; constraint = false];");
+                    }
+                    else
+                    {
+                        overlayWriter.WriteLine($"{states[edge.Key.from]} -> {states[edge.Key.to]} [label = \"{label}\"; color = \"red\"; fontcolor = \"red\"; penwidth = 2; constraint = false];");
+                    };
+                }
+            });
+        }
+    }
+}
@@ -1,7 +1,10 @@
 ﻿using System;
+using System.Collections.Concurrent;
 using System.Collections.Generic;
 using System.Linq;
+using System.Runtime.ExceptionServices;
 using System.Text;
+using System.Threading;
 using System.Threading.Tasks;
 
 namespace NiceStateMachineGenerator
@@ -10,24 +13,65 @@ namespace NiceStateMachineGenerator
     {
         public static void Validate(StateMachineDescr stateMachine)
         {
-            Validator validator = new Validator(stateMachine);
-            validator.ValidatePaths();
+            Validate(stateMachine, maxDegreeOfParallelism: -1);
+        }
+
+        //maxDegreeOfParallelism: number of threads used for paths exploration, -1 means all available cores
+        public static void Validate(StateMachineDescr stateMachine, int maxDegreeOfParallelism)
+        {
+            Validate(stateMachine, maxDegreeOfParallelism, out _);
+        }
+
+        //executionStatesCount: number of distinct execution states (state with enabled events, fired only_once events and running timers) explored
+        public static void Validate(StateMachineDescr stateMachine, int maxDegreeOfParallelism, out int executionStatesCount)
+        {
+            Validator validator = new Validator(stateMachine, maxDegreeOfParallelism);
+            executionStatesCount = validator.ValidatePaths();
             validator.CheckUnusedTimers();
             validator.CheckEventsConsistency();
         }
 
+        //Timers that may be running when a state is entered, before its stop_timers and start_timers are applied,
+        //and pairs of timers that may be running at the same time.
+        //Unlike validation, this follows what generated code does rather than what the state machine declares: any event
+        //of a state may come regardless of after_states and only_once, and on_enter targets are entered after the source state
+        //has started and stopped its timers. Same as in validation, a fired timer stays enabled until it's stopped, as timer
+        //backends are not required to be one-shot. Errors of the state machine are not reported
+        public static TimerLiveness ComputeTimerLiveness(StateMachineDescr stateMachine)
+        {
+            Validator validator = new Validator(stateMachine, maxDegreeOfParallelism: 1);
+            return validator.ExploreTimerLiveness();
+        }
+
         private readonly StateMachineDescr m_stateMachine;
+        private readonly int m_threadsCount;
         private readonly Dictionary<string, int> m_timersToIndex;
         private readonly string[] m_timers;
         private readonly Dictionary<string, int> m_eventsToIndex;
         private readonly string[] m_events;
+        private readonly EventDescr[] m_eventDescrs;
+        private readonly Dictionary<string, int> m_statesToIndex;
+        private readonly StateDescr[] m_states;
+
+        private const int NO_STATE_INDEX = -1;
+        private const int NO_EVENT_INDEX = -1;
+
+        //execution state bits layout, see ExecutionState
+        private readonly int m_firedBitsOffset;
+        private readonly int m_timerBitsOffset;
+        private readonly int m_wordsCount;
+        private readonly ulong[][] m_stateKeepMasks; //bits of previous execution state that survive entering a state
+        private readonly ulong[][] m_stateSetMasks; //bits that are set on entering a state
+        private readonly EdgeDescr?[][] m_stateEventEdges; //[state][event]
+        private readonly EdgeDescr?[][] m_stateTimerEdges; //[state][timer]
 
         private readonly HashSet<EdgeDescr> m_traversedEdges = new HashSet<EdgeDescr>();
         private readonly HashSet<StateDescr> m_visitedStates = new HashSet<StateDescr>();
 
-        private Validator(StateMachineDescr stateMachine)
+        private Validator(StateMachineDescr stateMachine, int maxDegreeOfParallelism)
         {
             this.m_stateMachine = stateMachine;
+            this.m_threadsCount = maxDegreeOfParallelism > 0 ? Math.Min(maxDegreeOfParallelism, Environment.ProcessorCount) : Environment.ProcessorCount;
             {
                 this.m_timers = new string[this.m_stateMachine.Timers.Count];
                 this.m_timersToIndex = new Dictionary<string, int>(this.m_timers.Length);
@@ -41,15 +85,79 @@ namespace NiceStateMachineGenerator
             };
             {
                 this.m_events = new string[this.m_stateMachine.Events.Count];
+                this.m_eventDescrs = new EventDescr[this.m_events.Length];
                 this.m_eventsToIndex = new Dictionary<string, int>(this.m_events.Length);
                 int index = 0;
-                foreach (string @event in this.m_stateMachine.Events.Keys)
+                foreach (EventDescr @event in this.m_stateMachine.Events.Values)
                 {
-                    this.m_events[index] = @event;
-                    this.m_eventsToIndex.Add(@event, index);
+                    this.m_events[index] = @event.Name;
+                    this.m_eventDescrs[index] = @event;
+                    this.m_eventsToIndex.Add(@event.Name, index);
                     ++index;
                 }
             };
+            {
+                this.m_states = new StateDescr[this.m_stateMachine.States.Count];
+                this.m_statesToIndex = new Dictionary<string, int>(this.m_states.Length);
+                int index = 0;
+                foreach (StateDescr state in this.m_stateMachine.States.Values)
+                {
+                    this.m_states[index] = state;
+                    this.m_statesToIndex.Add(state.Name, index);
+                    ++index;
+                }
+            };
+            {
+                this.m_firedBitsOffset = this.m_events.Length;
+                this.m_timerBitsOffset = this.m_firedBitsOffset + this.m_events.Length;
+                this.m_wordsCount = (this.m_timerBitsOffset + this.m_timers.Length + 63) / 64;
+                this.m_stateKeepMasks = new ulong[this.m_states.Length][];
+                this.m_stateSetMasks = new ulong[this.m_states.Length][];
+                this.m_stateEventEdges = new EdgeDescr?[this.m_states.Length][];
+                this.m_stateTimerEdges = new EdgeDescr?[this.m_states.Length][];
+                for (int stateIndex = 0; stateIndex < this.m_states.Length; ++stateIndex)
+                {
+                    StateDescr state = this.m_states[stateIndex];
+                    ulong[] keepMask = new ulong[this.m_wordsCount];
+                    Array.Fill(keepMask, UInt64.MaxValue);
+                    ulong[] setMask = new ulong[this.m_wordsCount];
+                    for (int timerIndex = 0; timerIndex < this.m_timers.Length; ++timerIndex)
+                    {
+                        string timer = this.m_timers[timerIndex];
+                        if (state.StartTimers.ContainsKey(timer))
+                        {
+                            SetBit(setMask, this.m_timerBitsOffset + timerIndex);
+                        }
+                        else if (state.StopTimers.Contains(timer))
+                        {
+                            ClearBit(keepMask, this.m_timerBitsOffset + timerIndex);
+                        }
+                    }
+                    for (int eventIndex = 0; eventIndex < this.m_events.Length; ++eventIndex)
+                    {
+                        HashSet<string>? afterStates = this.m_eventDescrs[eventIndex].AfterStates;
+                        if (afterStates != null && afterStates.Contains(state.Name))
+                        {
+                            SetBit(setMask, eventIndex);
+                        }
+                    }
+                    this.m_stateKeepMasks[stateIndex] = keepMask;
+                    this.m_stateSetMasks[stateIndex] = setMask;
+
+                    EdgeDescr?[] eventEdges = new EdgeDescr?[this.m_events.Length];
+                    for (int eventIndex = 0; eventIndex < this.m_events.Length; ++eventIndex)
+                    {
+                        eventEdges[eventIndex] = state.EventEdges?.GetValueOrDefault(this.m_events[eventIndex]);
+                    }
+                    this.m_stateEventEdges[stateIndex] = eventEdges;
+                    EdgeDescr?[] timerEdges = new EdgeDescr?[this.m_timers.Length];
+                    for (int timerIndex = 0; timerIndex < this.m_timers.Length; ++timerIndex)
+                    {
+                        timerEdges[timerIndex] = state.TimerEdges?.GetValueOrDefault(this.m_timers[timerIndex]);
+                    }
+                    this.m_stateTimerEdges[stateIndex] = timerEdges;
+                }
+            };
         }
 
         private void CheckEventsConsistency()
@@ -119,9 +227,9 @@ namespace NiceStateMachineGenerator
             }
         }
 
-        private void ValidatePaths()
+        private int ValidatePaths()
         {
-            this.Dfs(CreateBeforeStartState(), this.m_stateMachine.StartState, null, new Stack<ExecutionState>(), new Stack<string>());
+            int executionStatesCount = this.ExplorePaths();
 
             List<string> errors = new List<string>();
             foreach (StateDescr state in this.m_stateMachine.States.Values)
@@ -155,219 +263,435 @@ namespace NiceStateMachineGenerator
             {
                 throw new LogicValidationException(errors);
             };
+            return executionStatesCount;
         }
 
         private ExecutionState CreateBeforeStartState()
         {
-            bool[] timersEnabledMask = new bool[this.m_timers.Length]; //all timers are disabled by default
-
-            bool[] eventsEnabledMask = new bool[this.m_events.Length];
+            //all timers are disabled and all events are not fired by default
+            ulong[] bits = new ulong[this.m_wordsCount];
             for (int eventIndex = 0; eventIndex < this.m_events.Length; ++eventIndex)
             {
-                string @event = this.m_events[eventIndex];
-                EventDescr eventDescr = this.m_stateMachine.Events[@event];
-                if (eventDescr.AfterStates == null)
+                if (this.m_eventDescrs[eventIndex].AfterStates == null)
                 {
-                    eventsEnabledMask[eventIndex] = true;
+                    SetBit(bits, eventIndex);
                 }
             }
+            return new ExecutionState(NO_STATE_INDEX, bits);
+        }
 
-            bool[] onetimeEventFiredMask = new bool[this.m_events.Length]; //all events are not fired
-
-            ExecutionState noState = new ExecutionState(
-                stateName: "",
-                eventsEnabledMask: eventsEnabledMask,
-                timersEnabledMask: timersEnabledMask,
-                onetimeEventFiredMask: onetimeEventFiredMask
-            );
-
-            return noState;
+        private ExecutionState EnterState(ExecutionState prevState, int stateIndex, int entryEventIndex)
+        {
+            ulong[] keepMask = this.m_stateKeepMasks[stateIndex];
+            ulong[] setMask = this.m_stateSetMasks[stateIndex];
+            ulong[] bits = new ulong[this.m_wordsCount];
+            for (int wordIndex = 0; wordIndex < bits.Length; ++wordIndex)
+            {
+                bits[wordIndex] = (prevState.bits[wordIndex] & keepMask[wordIndex]) | setMask[wordIndex];
+            }
+            if (entryEventIndex != NO_EVENT_INDEX && this.m_eventDescrs[entryEventIndex].OnlyOnce)
+            {
+                SetBit(bits, this.m_firedBitsOffset + entryEventIndex);
+            }
+            return new ExecutionState(stateIndex, bits);
         }
 
-        private void Dfs(ExecutionState prevState, string stateName, int? entryEventIndex, Stack<ExecutionState> steps, Stack<string> edges)
+        //Walks every reachable execution state exactly once. Each execution state is expanded only when it's seen for the first time,
+        //so the work is proportional to the number of reachable (state, masks) configurations rather than to the number of distinct paths.
+        //Paths for error messages are restored from parent links.
+        //
+        //Exploration runs on several threads. Workers take pending steps from a shared work-stealing bag, which prefers steps added
+        //by the same thread, so every worker mostly goes depth-first, and takes steps of others only when it runs out of its own.
+        //Which error is met first then depends on scheduling, so when there are errors, state machine is explored once more
+        //breadth-first in a single thread, and the first error in that order is reported. The path in error message is then
+        //one of the shortest, and it does not depend on the number of threads.
+        private int ExplorePaths()
         {
-            StateDescr state = this.m_stateMachine.States[stateName];
-            this.m_visitedStates.Add(state);
+            Exploration exploration = new Exploration(this.m_stateEventEdges, this.m_stateTimerEdges);
+            LogicValidationException? error = ExploreInParallel(exploration);
+            if (error != null)
+            {
+                throw FindFirstError() ?? error;
+            };
 
-            if (state.IsFinal)
+            for (int stateIndex = 0; stateIndex < this.m_states.Length; ++stateIndex)
             {
-                //finished
-                return;
+                if (exploration.visitedStates[stateIndex])
+                {
+                    this.m_visitedStates.Add(this.m_states[stateIndex]);
+                };
+                MarkTraversedEdges(this.m_stateEventEdges[stateIndex], exploration.traversedEventEdges[stateIndex]);
+                MarkTraversedEdges(this.m_stateTimerEdges[stateIndex], exploration.traversedTimerEdges[stateIndex]);
             }
+            return exploration.visitedExecutionStates.Count;
+        }
 
-            bool[] timersEnabledMask = new bool[prevState.timersEnabledMask.Length];
+        //execution states here only hold timer bits, and are keyed by the state being entered and timers running before that
+        private TimerLiveness ExploreTimerLiveness()
+        {
+            int wordsCount = (this.m_timers.Length + 63) / 64;
+            ulong[][] keepMasks = new ulong[this.m_states.Length][];
+            ulong[][] setMasks = new ulong[this.m_states.Length][];
+            ulong[][] activeOnEntry = new ulong[this.m_states.Length][];
+            ulong[][] activeTogether = new ulong[this.m_timers.Length][];
             for (int timerIndex = 0; timerIndex < this.m_timers.Length; ++timerIndex)
             {
-                string timer = this.m_timers[timerIndex];
-                bool enabled;
-                if (state.StartTimers.ContainsKey(timer))
+                activeTogether[timerIndex] = new ulong[wordsCount];
+            }
+            for (int stateIndex = 0; stateIndex < this.m_states.Length; ++stateIndex)
+            {
+                keepMasks[stateIndex] = new ulong[wordsCount];
+                setMasks[stateIndex] = new ulong[wordsCount];
+                activeOnEntry[stateIndex] = new ulong[wordsCount];
+                for (int timerIndex = 0; timerIndex < this.m_timers.Length; ++timerIndex)
                 {
-                    enabled = true;
+                    int bit = this.m_timerBitsOffset + timerIndex;
+                    if ((this.m_stateKeepMasks[stateIndex][bit >> 6] & (1UL << (bit & 63))) != 0)
+                    {
+                        SetBit(keepMasks[stateIndex], timerIndex);
+                    };
+                    if ((this.m_stateSetMasks[stateIndex][bit >> 6] & (1UL << (bit & 63))) != 0)
+                    {
+                        SetBit(setMasks[stateIndex], timerIndex);
+                    };
                 }
-                else if (state.StopTimers.Contains(timer))
+            }
+
+            HashSet<ExecutionState> visited = new HashSet<ExecutionState>();
+            Queue<ExecutionState> pending = new Queue<ExecutionState>();
+            pending.Enqueue(new ExecutionState(this.m_statesToIndex[this.m_stateMachine.StartState], new ulong[wordsCount]));
+            while (pending.TryDequeue(out ExecutionState? entry))
+            {
+                if (!visited.Add(entry))
+                {
+                    continue;
+                };
+                int stateIndex = entry.stateIndex;
+                StateDescr state = this.m_states[stateIndex];
+                for (int wordIndex = 0; wordIndex < wordsCount; ++wordIndex)
                 {
-                    enabled = false;
+                    activeOnEntry[stateIndex][wordIndex] |= entry.bits[wordIndex];
                 }
-                else
+
+                //timers are stopped before others are started, so at no point more timers are running than after entering the state
+                ulong[] bits = new ulong[wordsCount];
+                for (int wordIndex = 0; wordIndex < wordsCount; ++wordIndex)
                 {
-                    enabled = prevState.timersEnabledMask[timerIndex];
+                    bits[wordIndex] = (entry.bits[wordIndex] & keepMasks[stateIndex][wordIndex]) | setMasks[stateIndex][wordIndex];
                 }
-                timersEnabledMask[timerIndex] = enabled;
-            }
+                for (int timerIndex = 0; timerIndex < this.m_timers.Length; ++timerIndex)
+                {
+                    if ((bits[timerIndex >> 6] & (1UL << (timerIndex & 63))) != 0)
+                    {
+                        for (int wordIndex = 0; wordIndex < wordsCount; ++wordIndex)
+                        {
+                            activeTogether[timerIndex][wordIndex] |= bits[wordIndex];
+                        }
+                    };
+                }
+                if (state.IsFinal)
+                {
+                    continue;
+                };
 
-            bool[] eventsEnabledMask = new bool[prevState.eventsEnabledMask.Length];
-            for (int eventIndex = 0; eventIndex < this.m_events.Length; ++eventIndex)
-            {
-                string @event = this.m_events[eventIndex];
-                bool enabled;
-                EventDescr eventDescr = this.m_stateMachine.Events[@event];
-                if (eventDescr.AfterStates != null && eventDescr.AfterStates.Contains(stateName))
+                if (state.NextStateName != null)
                 {
-                    enabled = true;
+                    pending.Enqueue(new ExecutionState(this.m_statesToIndex[state.NextStateName], bits));
+                };
+                if (state.OnEnterEventAlluxTargets != null)
+                {
+                    EnqueueLivenessTargets(state.OnEnterEventAlluxTargets.Values, bits, pending);
+                };
+                foreach (EdgeDescr? edge in this.m_stateEventEdges[stateIndex])
+                {
+                    if (edge != null)
+                    {
+                        EnqueueLivenessTargets(edge, bits, pending);
+                    };
                 }
-                else
+                for (int timerIndex = 0; timerIndex < this.m_timers.Length; ++timerIndex)
                 {
-                    enabled = prevState.eventsEnabledMask[eventIndex];
+                    EdgeDescr? edge = this.m_stateTimerEdges[stateIndex][timerIndex];
+                    if (edge != null && (bits[timerIndex >> 6] & (1UL << (timerIndex & 63))) != 0)
+                    {
+                        EnqueueLivenessTargets(edge, bits, pending);
+                    };
                 }
-                eventsEnabledMask[eventIndex] = enabled;
             }
 
-            bool[] onetimeEventFiredMask = new bool[prevState.onetimeEventFiredMask.Length];
-            for (int eventIndex = 0; eventIndex < this.m_events.Length; ++eventIndex)
+            Dictionary<string, HashSet<string>> statesResult = new Dictionary<string, HashSet<string>>(this.m_states.Length);
+            for (int stateIndex = 0; stateIndex < this.m_states.Length; ++stateIndex)
+            {
+                statesResult.Add(this.m_states[stateIndex].Name, GetTimersSet(activeOnEntry[stateIndex]));
+            }
+            Dictionary<string, HashSet<string>> timersResult = new Dictionary<string, HashSet<string>>(this.m_timers.Length);
+            for (int timerIndex = 0; timerIndex < this.m_timers.Length; ++timerIndex)
+            {
+                HashSet<string> timers = GetTimersSet(activeTogether[timerIndex]);
+                timers.Remove(this.m_timers[timerIndex]);
+                timersResult.Add(this.m_timers[timerIndex], timers);
+            }
+            return new TimerLiveness(statesResult, timersResult);
+        }
+
+        private HashSet<string> GetTimersSet(ulong[] bits)
+        {
+            HashSet<string> result = new HashSet<string>();
+            for (int timerIndex = 0; timerIndex < this.m_timers.Length; ++timerIndex)
             {
-                onetimeEventFiredMask[eventIndex] = prevState.onetimeEventFiredMask[eventIndex];
-                if (eventIndex == entryEventIndex)
+                if ((bits[timerIndex >> 6] & (1UL << (timerIndex & 63))) != 0)
                 {
-                    string @event = this.m_events[eventIndex];
-                    if (this.m_stateMachine.Events[@event].OnlyOnce)
+                    result.Add(this.m_timers[timerIndex]);
+                };
+            }
+            return result;
+        }
+
+        private void EnqueueLivenessTargets(EdgeDescr edge, ulong[] bits, Queue<ExecutionState> pending)
+        {
+            if (edge.Target != null)
+            {
+                EnqueueLivenessTargets(new EdgeTarget[] { edge.Target }, bits, pending);
+            }
+            else if (edge.Targets != null)
+            {
+                EnqueueLivenessTargets(edge.Targets.Values, bits, pending);
+            };
+        }
+
+        private void EnqueueLivenessTargets(IEnumerable<EdgeTarget> targets, ulong[] bits, Queue<ExecutionState> pending)
+        {
+            foreach (EdgeTarget target in targets)
+            {
+                if (target.TargetType == EdgeTargetType.state && target.StateName != null)
+                {
+                    pending.Enqueue(new ExecutionState(this.m_statesToIndex[target.StateName], bits));
+                };
+            }
+        }
+
+        private PendingStep CreateStartStep()
+        {
+            return new PendingStep(CreateBeforeStartState(), this.m_statesToIndex[this.m_stateMachine.StartState], NO_EVENT_INDEX, null, "");
+        }
+
+        private LogicValidationException? ExploreInParallel(Exploration exploration)
+        {
+            ConcurrentBag<PendingStep> pending = new ConcurrentBag<PendingStep>();
+            pending.Add(CreateStartStep());
+            int pendingCount = 1; //steps that are added, but not processed yet
+            LogicValidationException? error = null;
+            Exception? fatal = null; //any other failure, stops all workers as the failed step never accounts as processed
+
+            ParallelOptions parallelOptions = new ParallelOptions { MaxDegreeOfParallelism = this.m_threadsCount };
+            Parallel.For(0, this.m_threadsCount, parallelOptions, _ => {
+                List<PendingStep> successors = new List<PendingStep>();
+                SpinWait spinWait = new SpinWait();
+                while (Volatile.Read(ref pendingCount) > 0 && Volatile.Read(ref error) == null && Volatile.Read(ref fatal) == null)
+                {
+                    if (!pending.TryTake(out PendingStep step))
+                    {
+                        //other workers are still expanding their steps
+                        spinWait.SpinOnce();
+                        continue;
+                    };
+                    spinWait.Reset();
+
+                    successors.Clear();
+                    try
                     {
-                        onetimeEventFiredMask[eventIndex] = true;
+                        ProcessStep(exploration, step, successors);
                     }
+                    catch (LogicValidationException e)
+                    {
+                        Interlocked.CompareExchange(ref error, e, null);
+                    }
+                    catch (Exception e)
+                    {
+                        Interlocked.CompareExchange(ref fatal, e, null);
+                        break;
+                    }
+                    //keep declaration order of traversal for steps taken by the same thread
+                    for (int i = successors.Count - 1; i >= 0; --i)
+                    {
+                        pending.Add(successors[i]);
+                    }
+                    //successors are added before this step is accounted as processed, so the counter never drops to zero prematurely
+                    Interlocked.Add(ref pendingCount, successors.Count - 1);
+                }
+            });
+            if (fatal != null)
+            {
+                ExceptionDispatchInfo.Capture(fatal).Throw();
+            };
+            return error;
+        }
+
+        private LogicValidationException? FindFirstError()
+        {
+            Exploration exploration = new Exploration(this.m_stateEventEdges, this.m_stateTimerEdges);
+            Queue<PendingStep> pending = new Queue<PendingStep>();
+            pending.Enqueue(CreateStartStep());
+            List<PendingStep> successors = new List<PendingStep>();
+            while (pending.TryDequeue(out PendingStep step))
+            {
+                successors.Clear();
+                try
+                {
+                    ProcessStep(exploration, step, successors);
+                }
+                catch (LogicValidationException e)
+                {
+                    return e;
+                }
+                foreach (PendingStep successor in successors)
+                {
+                    pending.Enqueue(successor);
                 }
             }
+            return null;
+        }
 
-            ExecutionState newState = new ExecutionState(
-                stateName: stateName,
-                eventsEnabledMask: eventsEnabledMask,
-                timersEnabledMask: timersEnabledMask,
-                onetimeEventFiredMask: onetimeEventFiredMask
-            );
+        private void ProcessStep(Exploration exploration, PendingStep step, List<PendingStep> successors)
+        {
+            StateDescr state = this.m_states[step.stateIndex];
+            exploration.visitedStates[step.stateIndex] = true;
 
-            if (steps.Contains(newState))
+            if (state.IsFinal)
+            {
+                //finished
+                return;
+            }
+
+            ExecutionState newState = EnterState(step.prevState, step.stateIndex, step.entryEventIndex);
+            bool isNewExecutionState = exploration.visitedExecutionStates.TryAdd(newState, 0);
+            bool needOnEnterTargets = state.NextStateName == null
+                && state.OnEnterEventAlluxTargets != null
+                && exploration.expandedOnEnterSources.TryAdd((step.prevState, step.entryEventIndex, step.stateIndex), 0);
+            if (!isNewExecutionState && !needOnEnterTargets)
             {
                 //already visited
                 return;
             }
 
+            PathStep path = new PathStep(step.stateIndex, step.parentPath, step.edgeName);
+            if (isNewExecutionState)
+            {
+                CollectSuccessors(exploration, newState, path, successors);
+            }
+            if (needOnEnterTargets)
+            {
+                foreach (EdgeTarget target in state.OnEnterEventAlluxTargets!.Values)
+                {
+                    if (target.TargetType != EdgeTargetType.state)
+                    {
+                        continue;
+                    };
+                    if (target.StateName == null)
+                    {
+                        throw new Exception("Should not happen");
+                    };
+                    successors.Add(new PendingStep(step.prevState, this.m_statesToIndex[target.StateName], step.entryEventIndex, path, "[on_enter]"));
+                }
+            };
+        }
 
-            //ok, go deeper
-            steps.Push(newState);
+        private void MarkTraversedEdges(EdgeDescr?[] edges, bool[] traversed)
+        {
+            for (int i = 0; i < edges.Length; ++i)
+            {
+                if (traversed[i])
+                {
+                    this.m_traversedEdges.Add(edges[i]!);
+                }
+            }
+        }
 
+        private void CollectSuccessors(Exploration exploration, ExecutionState newState, PathStep path, List<PendingStep> successors)
+        {
+            StateDescr state = this.m_states[newState.stateIndex];
+            EdgeDescr?[] eventEdges = this.m_stateEventEdges[newState.stateIndex];
+            EdgeDescr?[] timerEdges = this.m_stateTimerEdges[newState.stateIndex];
             if (state.NextStateName != null)
             {
-                edges.Push("[next_state]");
-                Dfs(newState, state.NextStateName, null, steps, edges);
-                edges.Pop();
+                successors.Add(new PendingStep(newState, this.m_statesToIndex[state.NextStateName], NO_EVENT_INDEX, path, "[next_state]"));
+                return;
             }
-            else
+
+            bool traversedSomething = false;
+            for (int eventIndex = 0; eventIndex < this.m_events.Length; ++eventIndex)
             {
-                bool traversedSomething = false;
-                for (int eventIndex = 0; eventIndex < this.m_events.Length; ++eventIndex)
+                string @event = this.m_events[eventIndex];
+                if (newState.GetBit(eventIndex))
                 {
-                    string @event = this.m_events[eventIndex];
-                    if (newState.eventsEnabledMask[eventIndex])
+                    EventDescr eventDescr = this.m_eventDescrs[eventIndex];
+                    if (!eventDescr.OnlyOnce || !newState.GetBit(this.m_firedBitsOffset + eventIndex))
                     {
-                        EventDescr eventDescr = this.m_stateMachine.Events[@event];
-                        if (!eventDescr.OnlyOnce || !newState.onetimeEventFiredMask[eventIndex])
+                        //event is available to traverse
+                        EdgeDescr? edge = eventEdges[eventIndex];
+                        if (edge == null)
+                        {
+                            throw new LogicValidationException($"In state {state.Name} event {@event} is NOT specified while it's enabled and available. Path: {PrintPath(path)}");
+                        }
+                        else
                         {
-                            //event is available to traverse
-                            if (state.EventEdges == null || !state.EventEdges.TryGetValue(@event, out EdgeDescr? edge))
-                            {
-                                throw new LogicValidationException($"In state {stateName} event {@event} is NOT specified while it's enabled and available. Path: {PrintPath(steps, edges)}");
-                            }
-                            else
-                            {
-                                this.m_traversedEdges.Add(edge);
-                                if (edge.Target != null)
-                                {
-                                    DfsForEdgeTarget(edge, edge.Target, ref traversedSomething, newState, eventIndex, steps, edges);
-                                }
-                                else if (edge.Targets != null)
-                                {
-                                    foreach (KeyValuePair<string, EdgeTarget> subEdge in edge.Targets)
-                                    {
-                                        DfsForEdgeTarget(edge, subEdge.Value, ref traversedSomething, newState, eventIndex, steps, edges);
-                                    }
-                                }
-                            }
+                            exploration.traversedEventEdges[newState.stateIndex][eventIndex] = true;
+                            CollectEdgeSuccessors(edge, ref traversedSomething, newState, eventIndex, path, successors);
                         }
                     }
-                };
+                }
+            };
 
-                for (int timerIndex = 0; timerIndex < this.m_timers.Length; ++timerIndex)
+            for (int timerIndex = 0; timerIndex < this.m_timers.Length; ++timerIndex)
+            {
+                string timer = this.m_timers[timerIndex];
+                if (!newState.GetBit(this.m_timerBitsOffset + timerIndex))
                 {
-                    string timer = this.m_timers[timerIndex];
-                    if (!newState.timersEnabledMask[timerIndex])
+                    //timer is disabled
+                    if (timerEdges[timerIndex] != null)
                     {
-                        //timer is disabled
-                        if (state.TimerEdges != null && state.TimerEdges.TryGetValue(timer, out _))
-                        {
-                            //actually this may happen when in later loops we enter same state again. Let's think on fixing this if it actually happens
-                            throw new LogicValidationException($"In state {stateName} timer {timer} is specified while it's not enabled. Path: {PrintPath(steps, edges)}");
-                        };
+                        //actually this may happen when in later loops we enter same state again. Let's think on fixing this if it actually happens
+                        throw new LogicValidationException($"In state {state.Name} timer {timer} is specified while it's not enabled. Path: {PrintPath(path)}");
+                    };
+                }
+                else
+                {
+                    //timer is enabled
+                    EdgeDescr? edge = timerEdges[timerIndex];
+                    if (edge == null)
+                    {
+                        throw new LogicValidationException($"In state {state.Name} timer {timer} is NOT specified while it's enabled. Path: {PrintPath(path)}");
                     }
                     else
                     {
-                        //timer is enabled
-                        if (state.TimerEdges == null || !state.TimerEdges.TryGetValue(timer, out EdgeDescr? edge))
-                        {
-                            throw new LogicValidationException($"In state {stateName} timer {timer} is NOT specified while it's enabled. Path: {PrintPath(steps, edges)}");
-                        }
-                        else
-                        {
-                            this.m_traversedEdges.Add(edge);
-                            if (edge.Target != null)
-                            {
-                                DfsForEdgeTarget(edge, edge.Target, ref traversedSomething, newState, null, steps, edges);
-                            }
-                            else if (edge.Targets != null)
-                            {
-                                foreach (KeyValuePair<string, EdgeTarget> subEdge in edge.Targets)
-                                {
-                                    DfsForEdgeTarget(edge, subEdge.Value, ref traversedSomething, newState, null, steps, edges);
-                                }
-                            }
-                        }
+                        exploration.traversedTimerEdges[newState.stateIndex][timerIndex] = true;
+                        CollectEdgeSuccessors(edge, ref traversedSomething, newState, NO_EVENT_INDEX, path, successors);
                     }
-                };
-                if (!traversedSomething)
-                {
-                    throw new LogicValidationException($"Stall detected in state {stateName}. Path: {PrintPath(steps, edges)}");
-                };
-                if (state.OnEnterEventAlluxTargets != null)
+                }
+            };
+            if (!traversedSomething)
+            {
+                throw new LogicValidationException($"Stall detected in state {state.Name}. Path: {PrintPath(path)}");
+            };
+        }
+
+        private void CollectEdgeSuccessors(EdgeDescr edge, ref bool traversedSomething, ExecutionState prevState, int entryEventIndex, PathStep path, List<PendingStep> successors)
+        {
+            string edgeName = $"[{(edge.IsTimer ? "timer" : "event")}: {edge.InvokerName}]";
+            if (edge.Target != null)
+            {
+                CollectEdgeTargetSuccessor(edge.Target, edgeName, ref traversedSomething, prevState, entryEventIndex, path, successors);
+            }
+            else if (edge.Targets != null)
+            {
+                foreach (KeyValuePair<string, EdgeTarget> subEdge in edge.Targets)
                 {
-                    foreach (EdgeTarget target in state.OnEnterEventAlluxTargets.Values)
-                    {
-                        if (target.TargetType != EdgeTargetType.state)
-                        {
-                            return;
-                        };
-                        if (target.StateName == null)
-                        {
-                            throw new Exception("Should not happen");
-                        };
-                        edges.Push($"[on_enter]");
-                        Dfs(prevState, target.StateName, entryEventIndex, steps, edges);
-                        edges.Pop();
-                    }
-                };
+                    CollectEdgeTargetSuccessor(subEdge.Value, edgeName, ref traversedSomething, prevState, entryEventIndex, path, successors);
+                }
             }
-
-            steps.Pop();
         }
 
-
-        private void DfsForEdgeTarget(EdgeDescr edge, EdgeTarget target, ref bool traversedSomething, ExecutionState prevState, int? entryEventIndex, Stack<ExecutionState> steps, Stack<string> edges)
+        private void CollectEdgeTargetSuccessor(EdgeTarget target, string edgeName, ref bool traversedSomething, ExecutionState prevState, int entryEventIndex, PathStep path, List<PendingStep> successors)
         {
             if (target.TargetType != EdgeTargetType.state)
             {
@@ -378,56 +702,112 @@ namespace NiceStateMachineGenerator
                 throw new Exception("Should not happen");
             };
             traversedSomething = true;
-            edges.Push($"[{(edge.IsTimer? "timer": "event")}: {edge.InvokerName}]");
-            Dfs(prevState, target.StateName, entryEventIndex, steps, edges);
-            edges.Pop();
+            successors.Add(new PendingStep(prevState, this.m_statesToIndex[target.StateName], entryEventIndex, path, edgeName));
         }
 
-        private static string PrintPath(Stack<ExecutionState> steps, Stack<string> edges)
+        private string PrintPath(PathStep path)
         {
-            edges.Push("");
-            string result = String.Join(
-                " -> ",
-                steps.Reverse()
-                .Zip(edges.Reverse())
-                .Select(t => t.First.stateName + " " + t.Second)
-            );
-            edges.Pop();
-            return result;
+            List<string> parts = new List<string>();
+            string nextEdgeName = "";
+            for (PathStep? step = path; step != null; step = step.parent)
+            {
+                parts.Add(this.m_states[step.stateIndex].Name + " " + nextEdgeName);
+                nextEdgeName = step.edgeName;
+            }
+            parts.Reverse();
+            return String.Join(" -> ", parts);
         }
 
-        private sealed class ExecutionState : IEquatable<ExecutionState>
+        private static void SetBit(ulong[] bits, int index)
+        {
+            bits[index >> 6] |= 1UL << (index & 63);
+        }
+
+        private static void ClearBit(ulong[] bits, int index)
+        {
+            bits[index >> 6] &= ~(1UL << (index & 63));
+        }
+
+        private readonly struct PendingStep
         {
-            public readonly string stateName;
-            public readonly bool[] eventsEnabledMask;
-            public readonly bool[] onetimeEventFiredMask;
-            public readonly bool[] timersEnabledMask;
+            public readonly ExecutionState prevState;
+            public readonly int stateIndex;
+            public readonly int entryEventIndex;
+            public readonly PathStep? parentPath;
+            public readonly string edgeName;
 
-            public ExecutionState(string stateName, bool[] eventsEnabledMask, bool[] timersEnabledMask, bool[] onetimeEventFiredMask)
+            public PendingStep(ExecutionState prevState, int stateIndex, int entryEventIndex, PathStep? parentPath, string edgeName)
             {
-                this.stateName = stateName;
-                this.eventsEnabledMask = eventsEnabledMask;
-                this.timersEnabledMask = timersEnabledMask;
-                this.onetimeEventFiredMask = onetimeEventFiredMask;
+                this.prevState = prevState;
+                this.stateIndex = stateIndex;
+                this.entryEventIndex = entryEventIndex;
+                this.parentPath = parentPath;
+                this.edgeName = edgeName;
             }
+        }
 
-            public override int GetHashCode()
+        private sealed class PathStep
+        {
+            public readonly int stateIndex;
+            public readonly PathStep? parent;
+            public readonly string edgeName; //edge that led to this step from parent
+
+            public PathStep(int stateIndex, PathStep? parent, string edgeName)
             {
-                int result = 31;
-                result = result * 27 + this.stateName.GetHashCode();
-                for (int i = 0; i < this.eventsEnabledMask.Length; ++i)
-                {
-                    result = result * 27 + this.eventsEnabledMask[i].GetHashCode();
-                }
-                for (int i = 0; i < this.timersEnabledMask.Length; ++i)
-                {
-                    result = result * 27 + this.timersEnabledMask[i].GetHashCode();
-                }
-                for (int i = 0; i < this.onetimeEventFiredMask.Length; ++i)
+                this.stateIndex = stateIndex;
+                this.parent = parent;
+                this.edgeName = edgeName;
+            }
+        }
+
+        //visited execution states and everything that is reached, shared between worker threads
+        private sealed class Exploration
+        {
+            public readonly ConcurrentDictionary<ExecutionState, byte> visitedExecutionStates = new ConcurrentDictionary<ExecutionState, byte>();
+            //on_enter targets are entered with the execution state that preceded the source state, so they are keyed separately
+            public readonly ConcurrentDictionary<(ExecutionState prevState, int entryEventIndex, int stateIndex), byte> expandedOnEnterSources = new ConcurrentDictionary<(ExecutionState, int, int), byte>();
+            //flags are only ever set to true, so concurrent writes are fine
+            public readonly bool[] visitedStates;
+            public readonly bool[][] traversedEventEdges; //[state][event]
+            public readonly bool[][] traversedTimerEdges; //[state][timer]
+
+            public Exploration(EdgeDescr?[][] stateEventEdges, EdgeDescr?[][] stateTimerEdges)
+            {
+                this.visitedStates = new bool[stateEventEdges.Length];
+                this.traversedEventEdges = stateEventEdges.Select(edges => new bool[edges.Length]).ToArray();
+                this.traversedTimerEdges = stateTimerEdges.Select(edges => new bool[edges.Length]).ToArray();
+            }
+        }
+
+        //state index and all the masks packed in a single bitset, layout is: [events enabled][onetime events fired][timers enabled]
+        private sealed class ExecutionState : IEquatable<ExecutionState>
+        {
+            public readonly int stateIndex;
+            public readonly ulong[] bits;
+            private readonly int m_hashCode;
+
+            public ExecutionState(int stateIndex, ulong[] bits)
+            {
+                this.stateIndex = stateIndex;
+                this.bits = bits;
+
+                HashCode hashCode = new HashCode();
+                hashCode.Add(stateIndex);
+                for (int i = 0; i < bits.Length; ++i)
                 {
-                    result = result * 27 + this.onetimeEventFiredMask[i].GetHashCode();
+                    hashCode.Add(bits[i]);
                 }
-                return result;
+                this.m_hashCode = hashCode.ToHashCode();
+            }
+
+            public bool GetBit(int index)
+            {
+                return (this.bits[index >> 6] & (1UL << (index & 63))) != 0;
+            }
+
+            public override int GetHashCode()
+            {
+                return this.m_hashCode;
             }
 
             public override bool Equals(object? obj)
@@ -442,21 +822,9 @@ namespace NiceStateMachineGenerator
                     return false;
                 }
 
-                if (this.stateName != other.stateName)
-                {
-                    return false;
-                }
-
-                if (!this.eventsEnabledMask.SequenceEqual(other.eventsEnabledMask))
-                {
-                    return false;
-                }
-                if (!this.timersEnabledMask.SequenceEqual(other.timersEnabledMask))
-                {
-                    return false;
-                }
-
-                return true;
+                return this.m_hashCode == other.m_hashCode
+                    && this.stateIndex == other.stateIndex
+                    && this.bits.AsSpan().SequenceEqual(other.bits);
             }
         }
 